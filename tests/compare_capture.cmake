@@ -0,0 +1,24 @@
+# Plays TUNE unpaced into a capture file and compares it with GOLDEN, so a
+# change to register processing, scheduling or the capture format shows up
+# as a failing test. Goldens are regenerated with
+#   ymplayer -fast -frames <FRAMES> -capture tests/data/<name>.cap tests/data/<name>.ym
+# after checking that the difference is intended.
+#
+# cmake -DPLAYER=<ymplayer> -DTUNE=<file> -DGOLDEN=<file.cap> -DOUTPUT=<file.cap> -DFRAMES=<n> -P compare_capture.cmake
+
+execute_process(
+	COMMAND "${PLAYER}" -fast -frames ${FRAMES} -capture "${OUTPUT}" "${TUNE}"
+	RESULT_VARIABLE result
+	OUTPUT_QUIET
+)
+if(NOT result EQUAL 0)
+	message(FATAL_ERROR "ymplayer failed (${result}) on ${TUNE}")
+endif()
+
+execute_process(
+	COMMAND "${CMAKE_COMMAND}" -E compare_files "${OUTPUT}" "${GOLDEN}"
+	RESULT_VARIABLE different
+)
+if(different)
+	message(FATAL_ERROR "${OUTPUT} differs from ${GOLDEN}")
+endif()
@@ -0,0 +1,242 @@
+// Feeds the frames of a fixture tune to live::run as raw 16 byte frames and
+// as tagged records mixing full, delta and timestamped frames with stray
+// bytes between them, the tagged ones once from a file and once through a
+// FIFO a few bytes at a time so records arrive split. Every run has to
+// capture the same bytes, and the tagged runs have to count every stray
+// byte as a bad record.
+//
+// The clock is virtual, so nothing waits. The fixture stays below the ring
+// and the adapt window, so no frame is dropped however the reader and the
+// player interleave.
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "live.h"
+#include "loader.h"
+#include "sink.h"
+
+static const uint32_t MAX_FRAMES = 200;
+// bytes a FIFO write, prime so records straddle the reads
+static const uint32_t PIECE_SIZE = 7;
+
+class VirtualClock : public player::Clock
+{
+public:
+	VirtualClock() : _now(1) {}
+	uint64_t now_us() override { return _now; }
+	void sleep_until(uint64_t time_us) override {
+		uint64_t now = _now;
+		while (time_us > now && !_now.compare_exchange_weak(now, time_us)) {}
+	}
+
+private:
+	std::atomic<uint64_t> _now;
+};
+
+static void put_u64(std::vector<uint8_t> &out, uint64_t value)
+{
+	for (int i = 0; i < 8; ++i)
+		out.push_back((uint8_t)(value >> (i * 8)));
+}
+
+// every third frame whole, the others as deltas, every fifth with a
+// timestamp and every seventh followed by two bytes that start no record
+static uint32_t encode_tagged(const uint8_t *frames, uint32_t frame_count, std::vector<uint8_t> &out)
+{
+	uint8_t previous[16] = {};
+	uint32_t stray_bytes = 0;
+	for (uint32_t f = 0; f < frame_count; ++f) {
+		const uint8_t *regs = frames + f * 16;
+		uint8_t type = 0;
+		if (f % 3 != 0)
+			type |= live::RECORD_DELTA;
+		if (f % 5 == 0)
+			type |= live::RECORD_TIMESTAMP;
+
+		out.push_back(type);
+		if (type & live::RECORD_TIMESTAMP)
+			put_u64(out, live::monotonic_us());
+		if (type & live::RECORD_DELTA) {
+			uint16_t mask = 0;
+			for (uint32_t r = 0; r < 16; ++r) {
+				if (regs[r] != previous[r])
+					mask |= (uint16_t)(1 << r);
+			}
+			out.push_back((uint8_t)mask);
+			out.push_back((uint8_t)(mask >> 8));
+			for (uint32_t r = 0; r < 16; ++r) {
+				if (mask & (1 << r))
+					out.push_back(regs[r]);
+			}
+		}
+		else {
+			out.insert(out.end(), regs, regs + 16);
+		}
+		memcpy(previous, regs, 16);
+
+		if (f % 7 == 0) {
+			out.push_back(0xa5);
+			out.push_back(0x80);
+			stray_bytes += 2;
+		}
+	}
+	return stray_bytes;
+}
+
+static bool write_file(const std::string &filename, const std::vector<uint8_t> &data)
+{
+	FILE *file = fopen(filename.c_str(), "wb");
+	if (!file)
+		return false;
+	fwrite(data.data(), 1, data.size(), file);
+	bool ok = ferror(file) == 0;
+	fclose(file);
+	return ok;
+}
+
+static bool read_file(const std::string &filename, std::vector<uint8_t> &data)
+{
+	FILE *file = fopen(filename.c_str(), "rb");
+	if (!file)
+		return false;
+	uint8_t buffer[4096];
+	size_t count;
+	while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		data.insert(data.end(), buffer, buffer + count);
+	fclose(file);
+	return true;
+}
+
+// writes data to the FIFO once live::run has opened it
+static void feed_fifo(const std::string &fifo, const std::vector<uint8_t> &data)
+{
+	int fd = open(fifo.c_str(), O_WRONLY);
+	if (fd < 0)
+		return;
+	for (size_t pos = 0; pos < data.size(); pos += PIECE_SIZE) {
+		size_t count = data.size() - pos < PIECE_SIZE ? data.size() - pos : PIECE_SIZE;
+		if (write(fd, data.data() + pos, count) != (ssize_t)count)
+			break;
+		std::this_thread::sleep_for(std::chrono::microseconds(50));
+	}
+	close(fd);
+}
+
+// plays input through live::run into a capture file
+static bool play(const std::string &input, live::InputFormat format, const std::string &capture, live::Stats &stats)
+{
+	sink::Sink out;
+	if (!sink::open_capture(out, capture.c_str())) {
+		printf("couldn't open %s\n", capture.c_str());
+		return false;
+	}
+	live::Options options;
+	options.format = format;
+	options.frame_rate = 50;
+	options.initial_depth = 2;
+	VirtualClock clock;
+	std::atomic<bool> quit(false);
+	bool ok = live::run(input.c_str(), options, out, clock, quit, stats);
+	sink::close(out);
+	if (!ok)
+		printf("couldn't open %s\n", input.c_str());
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3) {
+		printf("usage: live_parser <tune> <scratch prefix>\n");
+		return 1;
+	}
+
+	YMTune tune;
+	loader::LoadResult result = loader::load_tune(argv[1], tune);
+	if (result != loader::LOAD_OK) {
+		printf("%s: %s\n", argv[1], loader::result_string(result));
+		return 1;
+	}
+	uint32_t frame_count = tune.header.frame_count < MAX_FRAMES ? tune.header.frame_count : MAX_FRAMES;
+	std::vector<uint8_t> frames(frame_count * 16);
+	for (uint32_t f = 0; f < frame_count; ++f)
+		memcpy(&frames[f * 16], tune.data.registers + f * tune.data.register_stride, 16);
+	destroy_ym_tune(tune);
+
+	std::string prefix = argv[2];
+	std::vector<uint8_t> tagged;
+	uint32_t stray_bytes = encode_tagged(frames.data(), frame_count, tagged);
+	if (!write_file(prefix + ".raw", frames) || !write_file(prefix + ".tagged", tagged)) {
+		printf("couldn't write the inputs\n");
+		return 1;
+	}
+
+	live::Stats raw_stats;
+	if (!play(prefix + ".raw", live::FORMAT_RAW, prefix + ".raw.cap", raw_stats))
+		return 1;
+	uint32_t failed = 0;
+	if (raw_stats.frames_sent != frame_count || raw_stats.frames_dropped != 0 || raw_stats.bad_records != 0) {
+		printf("raw: %llu of %u frames sent\n", (unsigned long long)raw_stats.frames_sent, frame_count);
+		failed++;
+	}
+	std::vector<uint8_t> raw_capture;
+	if (!read_file(prefix + ".raw.cap", raw_capture) || raw_capture.empty()) {
+		printf("raw: no capture\n");
+		return 1;
+	}
+
+	std::string fifo = prefix + ".fifo";
+	unlink(fifo.c_str());
+	if (mkfifo(fifo.c_str(), 0600) != 0) {
+		printf("couldn't create %s\n", fifo.c_str());
+		return 1;
+	}
+
+	const char *const names[] = { "tagged file", "tagged fifo" };
+	for (int run = 0; run < 2; ++run) {
+		const char *name = names[run];
+		std::string capture = prefix + (run ? ".fifo.cap" : ".tagged.cap");
+		live::Stats stats;
+		bool ok;
+		if (run) {
+			std::thread writer(feed_fifo, fifo, std::cref(tagged));
+			ok = play(fifo, live::FORMAT_TAGGED, capture, stats);
+			writer.join();
+		}
+		else {
+			ok = play(prefix + ".tagged", live::FORMAT_TAGGED, capture, stats);
+		}
+		if (!ok)
+			return 1;
+
+		if (stats.frames_sent != frame_count || stats.frames_dropped != 0) {
+			printf("%s: %llu of %u frames sent\n", name, (unsigned long long)stats.frames_sent, frame_count);
+			failed++;
+		}
+		if (stats.bad_records != stray_bytes) {
+			printf("%s: %llu bad records, expected %u\n", name, (unsigned long long)stats.bad_records, stray_bytes);
+			failed++;
+		}
+		if (stats.timestamped_frames != (frame_count + 4) / 5) {
+			printf("%s: %llu timestamped frames\n", name, (unsigned long long)stats.timestamped_frames);
+			failed++;
+		}
+		std::vector<uint8_t> tagged_capture;
+		if (!read_file(capture, tagged_capture) || tagged_capture != raw_capture) {
+			printf("%s: capture differs from the raw one\n", name);
+			failed++;
+		}
+	}
+	unlink(fifo.c_str());
+
+	if (failed)
+		printf("%u checks failed\n", failed);
+	return failed ? 1 : 0;
+}
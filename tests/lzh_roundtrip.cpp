@@ -0,0 +1,97 @@
+// Packs buffers of awkward shapes at every level and checks that the
+// existing -lh5- decoder gives back the original bytes.
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "lzh.h"
+
+static uint32_t random_state = 0x12345678;
+
+static uint32_t next_random()
+{
+	// xorshift32, the same sequence on every run
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+static bool round_trip(const char *name, std::vector<char> &data, int level)
+{
+	uint32_t size = (uint32_t)data.size();
+	// a valid pointer even for the empty buffer
+	char empty = 0;
+	char *input = size ? data.data() : &empty;
+
+	std::vector<char> archive;
+	if (!lzh::pack(input, size, "test.ym", 0, level, archive)) {
+		printf("%s, level %d: pack failed\n", name, level);
+		return false;
+	}
+
+	lzh::LZHeader header;
+	bool ok = lzh::read_header(archive.data(), (uint32_t)archive.size(), header);
+	if (!ok || header.decompressed_size != size) {
+		printf("%s, level %d: bad header\n", name, level);
+		lzh::free_header(header);
+		return false;
+	}
+
+	std::vector<char> output(size + 1);
+	ok = lzh::decompress(header.compressed_data, header.compressed_size, output.data(), size) &&
+		memcmp(output.data(), input, size) == 0;
+	lzh::free_header(header);
+	if (!ok)
+		printf("%s, level %d: decompressed data differs\n", name, level);
+	return ok;
+}
+
+int main()
+{
+	struct Case
+	{
+		const char *name;
+		std::vector<char> data;
+	};
+	std::vector<Case> cases(5);
+
+	cases[0].name = "empty";
+
+	cases[1].name = "one byte";
+	cases[1].data.push_back('Y');
+
+	// -lh5- matches reach back 8 KB. Random blocks repeated at distances
+	// either side of that and well past it, only the near ones can match
+	cases[2].name = "repeats around the 8 KB window";
+	const uint32_t distances[] = { 8191, 8192, 8193, 12000 };
+	for (uint32_t distance : distances) {
+		std::vector<char> block(distance);
+		for (char &c : block)
+			c = (char)next_random();
+		for (int repeat = 0; repeat < 3; ++repeat)
+			cases[2].data.insert(cases[2].data.end(), block.begin(), block.end());
+	}
+
+	cases[3].name = "incompressible";
+	for (uint32_t i = 0; i < 100000; ++i)
+		cases[3].data.push_back((char)next_random());
+
+	// runs longer than the longest match
+	cases[4].name = "long runs";
+	for (uint32_t run = 0; run < 64; ++run)
+		cases[4].data.insert(cases[4].data.end(), 1000 + next_random() % 5000, (char)(next_random() & 3));
+
+	uint32_t failed = 0;
+	for (const Case &test : cases) {
+		for (int level = lzh::MIN_LEVEL; level <= lzh::MAX_LEVEL; ++level) {
+			std::vector<char> data = test.data;
+			if (!round_trip(test.name, data, level))
+				failed++;
+		}
+	}
+
+	if (failed)
+		printf("%u round trips failed\n", failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,142 @@
+// Plays the frames of a fixture tune through transmit::take with loops of
+// many lengths, short ones that get unrolled and long ones read from the
+// tune, in chunks of awkward sizes. Every frame taken, its special
+// registers, the frame take returns and the wrap count have to match a
+// frame by frame walk of the tune.
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "loader.h"
+#include "transmit.h"
+
+using transmit::FRAME_SIZE;
+using transmit::CHUNK_FRAMES;
+
+// frames of the tiled fixture, longer than any unrolled loop
+static const uint32_t FRAME_COUNT = 1500;
+
+struct Frames
+{
+	std::vector<uint8_t> registers;
+	std::vector<uint8_t> special_registers;
+};
+
+// the fixture repeated to FRAME_COUNT frames, each stamped with its number
+// in registers 0-1 and special registers 14-15 so a frame from the wrong
+// place can't match
+static bool make_frames(const char *filename, Frames &frames)
+{
+	YMTune tune;
+	loader::LoadResult result = loader::load_tune(filename, tune);
+	if (result != loader::LOAD_OK) {
+		printf("%s: %s\n", filename, loader::result_string(result));
+		return false;
+	}
+	frames.registers.resize(FRAME_COUNT * FRAME_SIZE);
+	frames.special_registers.resize(FRAME_COUNT * FRAME_SIZE);
+	for (uint32_t f = 0; f < FRAME_COUNT; ++f) {
+		uint32_t source = (f % tune.header.frame_count) * tune.data.register_stride;
+		uint8_t *regs = &frames.registers[f * FRAME_SIZE];
+		uint8_t *special = &frames.special_registers[f * FRAME_SIZE];
+		memcpy(regs, tune.data.registers + source, FRAME_SIZE);
+		memcpy(special, tune.data.special_registers + source, FRAME_SIZE);
+		regs[0] = (uint8_t)f;
+		regs[1] = (uint8_t)(f >> 8);
+		special[14] = (uint8_t)f;
+		special[15] = (uint8_t)(f >> 8);
+	}
+	destroy_ym_tune(tune);
+	return true;
+}
+
+static bool check_loop(const Frames &frames, uint32_t frame_count, uint32_t loop_frame, transmit::Plan &plan)
+{
+	YMTune tune;
+	memset(&tune, 0, sizeof(YMTune));
+	tune.header.frame_count = frame_count;
+	tune.header.loop_frame = loop_frame;
+	tune.data.registers = (char*)frames.registers.data();
+	tune.data.special_registers = (char*)frames.special_registers.data();
+	tune.data.register_stride = FRAME_SIZE;
+	transmit::build(plan, tune);
+	// a loop frame past the end loops the whole tune
+	uint32_t expected_loop = loop_frame < frame_count ? loop_frame : 0;
+
+	// start on either side of the loop frame and the end, and at the start
+	const uint32_t starts[] = { 0, expected_loop, expected_loop + 1, frame_count - 1,
+		expected_loop > 0 ? expected_loop - 1 : 0, frame_count > CHUNK_FRAMES ? frame_count - CHUNK_FRAMES : 0 };
+	const uint32_t counts[] = { 1, 3, 7, 64, 511, CHUNK_FRAMES, CHUNK_FRAMES + 100 };
+
+	for (uint32_t start : starts) {
+		if (start >= frame_count)
+			continue;
+		uint32_t frame = start;
+		uint32_t walked = start;
+		for (uint32_t step = 0; step < 40; ++step) {
+			uint32_t count = counts[(start + step) % (sizeof(counts) / sizeof(counts[0]))];
+			transmit::Batch batch;
+			uint32_t next = transmit::take(plan, frame, count, batch);
+
+			uint32_t expected_count = count < CHUNK_FRAMES ? count : CHUNK_FRAMES;
+			uint32_t wraps = 0;
+			uint32_t taken = 0;
+			for (uint32_t s = 0; s < batch.span_count; ++s) {
+				const transmit::Span &span = batch.spans[s];
+				for (uint32_t i = 0; i < span.frame_count; ++i) {
+					if (memcmp(span.data + i * FRAME_SIZE, &frames.registers[walked * FRAME_SIZE], FRAME_SIZE) != 0 ||
+						memcmp(span.special + i * FRAME_SIZE, &frames.special_registers[walked * FRAME_SIZE], FRAME_SIZE) != 0) {
+						printf("loop %u-%u from %u: frame %u of a batch isn't frame %u\n", expected_loop, frame_count, frame, taken, walked);
+						return false;
+					}
+					if (++walked == frame_count) {
+						walked = expected_loop;
+						wraps++;
+					}
+					taken++;
+				}
+			}
+
+			if (batch.span_count > transmit::MAX_SPANS || taken != expected_count || batch.frame_count != taken ||
+				batch.wraps != wraps || next != walked) {
+				printf("loop %u-%u from %u: %u frames in %u spans, %u wraps, next %u; expected %u frames, %u wraps, next %u\n",
+					expected_loop, frame_count, frame, batch.frame_count, batch.span_count, batch.wraps, next,
+					expected_count, wraps, walked);
+				return false;
+			}
+			frame = next;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		printf("usage: transmit_take <tune>\n");
+		return 1;
+	}
+	Frames frames;
+	if (!make_frames(argv[1], frames))
+		return 1;
+
+	// loops from one frame to the whole tune, either side of a chunk where
+	// unrolling stops, then a loop frame past the end
+	const uint32_t loop_lengths[] = { 1, 2, 3, 200, CHUNK_FRAMES - 1, CHUNK_FRAMES, CHUNK_FRAMES + 1, 1000, FRAME_COUNT };
+	transmit::Plan *plan = new transmit::Plan;
+	uint32_t failed = 0;
+	for (uint32_t length : loop_lengths) {
+		if (!check_loop(frames, FRAME_COUNT, FRAME_COUNT - length, *plan))
+			failed++;
+		// and the same loop behind a short intro
+		if (length < CHUNK_FRAMES && !check_loop(frames, length + 10, 10, *plan))
+			failed++;
+	}
+	if (!check_loop(frames, 700, 900, *plan))
+		failed++;
+	delete plan;
+
+	if (failed)
+		printf("%u loops failed\n", failed);
+	return failed ? 1 : 0;
+}
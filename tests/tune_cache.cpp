@@ -0,0 +1,122 @@
+// Loads the fixture tunes through a tune_cache and checks hits by contents,
+// least recently used eviction over the budget, that held tunes are never
+// evicted and that a handle keeps its tune valid after the cache is gone.
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <memory>
+#include <string>
+#include "fs.h"
+#include "loader.h"
+#include "pages.h"
+#include "tune_cache.h"
+
+static uint32_t failed = 0;
+
+static void check(bool ok, const char *what)
+{
+	if (!ok) {
+		printf("%s\n", what);
+		failed++;
+	}
+}
+
+static tune_cache::Handle load(tune_cache::Cache &cache, const std::string &filename, bool &hit)
+{
+	tune_cache::Handle tune;
+	loader::LoadResult result = cache.load(filename.c_str(), tune, &hit);
+	if (result != loader::LOAD_OK)
+		printf("%s: %s\n", filename.c_str(), loader::result_string(result));
+	return tune;
+}
+
+// the tune decoded straight from the file, registers and all
+static bool same_as_file(const tune_cache::Handle &tune, const std::string &filename)
+{
+	YMTune fresh;
+	if (!tune || loader::load_tune(filename.c_str(), fresh) != loader::LOAD_OK)
+		return false;
+	uint32_t register_size = fresh.header.frame_count * fresh.data.register_stride;
+	bool same = tune->header.frame_count == fresh.header.frame_count &&
+		tune->data.register_stride == fresh.data.register_stride &&
+		memcmp(tune->data.registers, fresh.data.registers, register_size) == 0 &&
+		memcmp(tune->data.special_registers, fresh.data.special_registers, register_size) == 0;
+	destroy_ym_tune(fresh);
+	return same;
+}
+
+static bool copy_file(const std::string &from, const std::string &to)
+{
+	char *data;
+	uint32_t size;
+	if (!fs::read_file(from.c_str(), data, size))
+		return false;
+	FILE *file = fopen(to.c_str(), "wb");
+	bool ok = file && fwrite(data, 1, size, file) == size;
+	if (file && fclose(file) != 0)
+		ok = false;
+	pages::release(data);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3) {
+		printf("usage: tune_cache <fixture dir> <scratch dir>\n");
+		return 1;
+	}
+	std::string a = fs::join_path(argv[1], "capture_linear.ym");
+	std::string b = fs::join_path(argv[1], "capture_interleaved.ym");
+	std::string c = fs::join_path(argv[1], "digidrums.ym");
+	std::string a_copy = fs::join_path(argv[2], "tune_cache_copy.ym");
+	if (!copy_file(a, a_copy)) {
+		printf("couldn't copy %s to %s\n", a.c_str(), a_copy.c_str());
+		return 1;
+	}
+
+	std::unique_ptr<tune_cache::Cache> cache(new tune_cache::Cache());
+	bool hit;
+
+	// hits go by contents, not by name
+	tune_cache::Handle first = load(*cache, a, hit);
+	check(first && !hit, "first load of a tune hit");
+	check(load(*cache, a, hit) == first && hit, "second load of a tune missed");
+	check(load(*cache, a_copy, hit) == first && hit, "copy of a tune missed");
+	check(same_as_file(first, a), "cached tune differs from the file");
+
+	// a budget of one tune, held tunes stay over it
+	tune_cache::Handle second = load(*cache, b, hit);
+	tune_cache::Handle third = load(*cache, c, hit);
+	uint64_t one_tune = tune_cache::tune_bytes(*third);
+	cache->set_budget(one_tune);
+	tune_cache::Stats stats = cache->stats();
+	check(stats.entries == 3 && stats.in_use == 3 && stats.evictions == 0, "held tunes were evicted");
+
+	// released tunes go least recently used first, the newest fits
+	first.reset();
+	second.reset();
+	third.reset();
+	cache->set_budget(one_tune);
+	stats = cache->stats();
+	check(stats.entries == 1 && stats.evictions == 2 && stats.bytes <= one_tune, "eviction left the wrong entries");
+	third = load(*cache, c, hit);
+	check(hit, "most recently used tune was evicted");
+	first = load(*cache, a, hit);
+	check(!hit, "evicted tune hit");
+
+	// nothing but the held tune is left at a budget of zero
+	first.reset();
+	cache->set_budget(0);
+	stats = cache->stats();
+	check(stats.entries == 1 && stats.in_use == 1, "held tune was evicted");
+	check(same_as_file(third, c), "held tune changed");
+
+	// the handle outlives the cache
+	cache.reset();
+	check(same_as_file(third, c), "held tune changed after the cache went");
+	third.reset();
+
+	if (failed)
+		printf("%u checks failed\n", failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,131 @@
+// The YM2, YM3, YM3b and YM4 fixtures hold the registers of
+// capture_interleaved.ym, a YM6. Each has to load to the same frames as
+// the YM6 with the header its version implies, the YM3b loop frame read
+// little endian. Every truncation of the YM4 and YM6 files has to be
+// rejected, without reading past the end of the buffer.
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include "fs.h"
+#include "loader.h"
+#include "pages.h"
+
+// frames of YM2 and YM3 tunes have no registers 14 and 15
+static const uint32_t YM3_REGISTERS = 14;
+
+struct Fixture
+{
+	const char *name;
+	const char *version;
+	uint32_t registers;
+	// the YM6 loops at 200, YM2 and YM3 have no loop frame
+	uint32_t loop_frame;
+	bool has_strings;
+};
+
+static uint32_t failed = 0;
+
+static void check(bool ok, const char *name, const char *what)
+{
+	if (!ok) {
+		printf("%s: %s\n", name, what);
+		failed++;
+	}
+}
+
+static bool same_registers(const YMTune &a, const YMTune &b, uint32_t registers)
+{
+	for (uint32_t f = 0; f < a.header.frame_count; ++f) {
+		uint32_t offset = f * a.data.register_stride;
+		if (memcmp(a.data.registers + offset, b.data.registers + offset, registers) != 0 ||
+			memcmp(a.data.special_registers + offset, b.data.special_registers + offset, registers) != 0)
+			return false;
+	}
+	return true;
+}
+
+static void check_fixture(const std::string &dir, const Fixture &fixture, const YMTune &reference)
+{
+	const char *name = fixture.name;
+	YMTune tune;
+	loader::LoadResult result = loader::load_tune(fs::join_path(dir, name).c_str(), tune);
+	if (result != loader::LOAD_OK) {
+		printf("%s: %s\n", name, loader::result_string(result));
+		failed++;
+		return;
+	}
+
+	const YMHeader &header = tune.header;
+	check(memcmp(tune.version, fixture.version, 4) == 0, name, "wrong version");
+	check(header.frame_count == reference.header.frame_count, name, "wrong frame count");
+	check(header.loop_frame == fixture.loop_frame, name, "wrong loop frame");
+	check(header.clock == 2000000 && header.frame_rate == 50, name, "not an Atari ST clock and frame rate");
+	check(tune.data.register_stride == 16, name, "frames not widened to 16 registers");
+	check(header.frame_count != reference.header.frame_count || same_registers(tune, reference, fixture.registers),
+		name, "registers differ from the YM6");
+	if (fixture.has_strings) {
+		check(strcmp(tune.song_info.name, reference.song_info.name) == 0 &&
+			strcmp(tune.song_info.author, reference.song_info.author) == 0, name, "wrong song strings");
+	}
+	destroy_ym_tune(tune);
+}
+
+// every cut of the file short of its end marker
+static void check_truncated(const std::string &filename, const char *name)
+{
+	char *data;
+	uint32_t size;
+	if (!fs::read_file(filename.c_str(), data, size)) {
+		printf("%s: couldn't read\n", name);
+		failed++;
+		return;
+	}
+
+	uint32_t accepted = 0;
+	for (uint32_t cut = 4; cut < size; ++cut) {
+		char *copy = pages::allocate(cut);
+		memcpy(copy, data, cut);
+		YMTune tune;
+		if (loader::create_tune(copy, cut, tune) == loader::LOAD_OK) {
+			destroy_ym_tune(tune);
+			accepted++;
+		}
+	}
+	pages::release(data);
+	check(accepted == 0, name, "a truncated file was accepted");
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		printf("usage: ym_loaders <fixture dir>\n");
+		return 1;
+	}
+	std::string dir = argv[1];
+
+	YMTune reference;
+	loader::LoadResult result = loader::load_tune(fs::join_path(dir, "capture_interleaved.ym").c_str(), reference);
+	if (result != loader::LOAD_OK) {
+		printf("capture_interleaved.ym: %s\n", loader::result_string(result));
+		return 1;
+	}
+
+	const Fixture fixtures[] =
+	{
+		{ "loader_ym2.ym", "YM2", YM3_REGISTERS, 0, false },
+		{ "loader_ym3.ym", "YM3", YM3_REGISTERS, 0, false },
+		{ "loader_ym3b.ym", "YM3", YM3_REGISTERS, 200, false },
+		{ "loader_ym4.ym", "YM4", 16, 200, true },
+	};
+	for (const Fixture &fixture : fixtures)
+		check_fixture(dir, fixture, reference);
+	destroy_ym_tune(reference);
+
+	check_truncated(fs::join_path(dir, "loader_ym4.ym"), "loader_ym4.ym");
+	check_truncated(fs::join_path(dir, "capture_interleaved.ym"), "capture_interleaved.ym");
+
+	if (failed)
+		printf("%u checks failed\n", failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,126 @@
+// Writes a tune as a YMC cache file, raw and blockpacked, reads it back and
+// checks it matches the tune it came from. A cache file whose strings
+// section ends after the name has to be rejected.
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "fs.h"
+#include "loader.h"
+#include "pages.h"
+#include "ymc.h"
+
+static bool same_string(const char *a, const char *b)
+{
+	return strcmp(a ? a : "", b ? b : "") == 0;
+}
+
+static bool same_bytes(const char *a, const char *b, uint32_t size)
+{
+	return size == 0 || (a && b && memcmp(a, b, size) == 0);
+}
+
+static bool same_tune(const YMTune &a, const YMTune &b)
+{
+	const YMHeader &x = a.header;
+	const YMHeader &y = b.header;
+	if (memcmp(a.version, b.version, 4) != 0 || x.id != y.id || memcmp(x.leonardo, y.leonardo, 8) != 0 ||
+		x.frame_count != y.frame_count || x.attributes != y.attributes || x.digidrum_count != y.digidrum_count ||
+		x.clock != y.clock || x.frame_rate != y.frame_rate || x.loop_frame != y.loop_frame)
+		return false;
+
+	if (!same_string(a.song_info.name, b.song_info.name) || !same_string(a.song_info.author, b.song_info.author) ||
+		!same_string(a.song_info.description, b.song_info.description))
+		return false;
+
+	const YMData &p = a.data;
+	const YMData &q = b.data;
+	uint32_t register_size = x.frame_count * p.register_stride;
+	return p.register_stride == q.register_stride && p.digidrums_size == q.digidrums_size &&
+		same_bytes(p.registers, q.registers, register_size) &&
+		same_bytes(p.special_registers, q.special_registers, register_size) &&
+		same_bytes(p.digidrums, q.digidrums, p.digidrums_size);
+}
+
+static bool round_trip(const YMTune &tune, const char *filename, bool compress)
+{
+	const char *name = compress ? "blockpacked" : "raw";
+	if (!ymc::write(tune, filename, compress)) {
+		printf("%s: write failed\n", name);
+		return false;
+	}
+
+	YMTune copy;
+	loader::LoadResult result = loader::load_tune(filename, copy);
+	if (result != loader::LOAD_OK) {
+		printf("%s: %s\n", name, loader::result_string(result));
+		return false;
+	}
+	bool ok = same_tune(tune, copy);
+	if (!ok)
+		printf("%s: tune differs after the round trip\n", name);
+	destroy_ym_tune(copy);
+	return ok;
+}
+
+// appends "ab\0" to the file and points the strings section at it, so
+// author would start past the end of the buffer
+static bool rejects_short_strings(const char *filename)
+{
+	char *file;
+	uint32_t file_size;
+	if (!fs::read_file(filename, file, file_size) || file_size < sizeof(ymc::FileHeader)) {
+		printf("short strings: couldn't read %s\n", filename);
+		return false;
+	}
+	uint32_t size = file_size + 3;
+	char *data = pages::allocate(size);
+	memcpy(data, file, file_size);
+	memcpy(data + file_size, "ab", 3);
+	pages::release(file);
+
+	const ymc::FileHeader *header = (const ymc::FileHeader*)data;
+	ymc::Section *table = (ymc::Section*)(data + sizeof(ymc::FileHeader));
+	for (uint32_t i = 0; i < header->section_count; ++i) {
+		if (table[i].type == ymc::SECTION_STRINGS) {
+			table[i].offset = file_size;
+			table[i].size = table[i].unpacked_size = 3;
+		}
+	}
+
+	YMTune tune;
+	loader::LoadResult result = loader::create_tune(data, size, tune);
+	if (result == loader::LOAD_OK) {
+		printf("short strings: accepted\n");
+		destroy_ym_tune(tune);
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3) {
+		printf("usage: ymc_roundtrip <tune> <scratch file>\n");
+		return 1;
+	}
+
+	YMTune tune;
+	loader::LoadResult result = loader::load_tune(argv[1], tune);
+	if (result != loader::LOAD_OK) {
+		printf("%s: %s\n", argv[1], loader::result_string(result));
+		return 1;
+	}
+
+	uint32_t failed = 0;
+	if (!round_trip(tune, argv[2], false))
+		failed++;
+	if (!round_trip(tune, argv[2], true))
+		failed++;
+	if (!rejects_short_strings(argv[2]))
+		failed++;
+	destroy_ym_tune(tune);
+
+	if (failed)
+		printf("%u checks failed\n", failed);
+	return failed ? 1 : 0;
+}
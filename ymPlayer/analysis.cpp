@@ -0,0 +1,341 @@
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "analysis.h"
+#include "fs.h"
+#include "loader.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE2 1
+#include <emmintrin.h>
+#else
+#define USE_SSE2 0
+#endif
+
+namespace analysis
+{
+
+static const char *const issue_names[] =
+{
+	"no_frames",
+	"bad_frame_rate",
+	"loop_out_of_range",
+	"bad_digidrum",
+	"silent",
+};
+
+// voice is 1-3 in bits 4-5 of the effect register, 0 for no effect. The
+// digidrum number is in the voice's level register.
+static void count_effect(TuneStats &stats, uint32_t digidrum_count, const uint8_t *frame, uint8_t special, int effect)
+{
+	uint32_t voice = (special >> 4) & 3;
+	if (voice == 0)
+		return;
+	stats.effect_frames[effect]++;
+	if (effect == EFFECT_DIGIDRUM && (uint32_t)(frame[8 + voice - 1] & 0x1f) >= digidrum_count)
+		stats.issues |= ISSUE_BAD_DIGIDRUM;
+}
+
+// YM5 has a SID voice in register 1 and a digidrum in register 3, YM6 says
+// which effect in the top bits of each
+static void count_effects(TuneStats &stats, uint32_t digidrum_count, const uint8_t *frame, const uint8_t *special, bool ym6)
+{
+	count_effect(stats, digidrum_count, frame, special[1], ym6 ? special[1] >> 6 : EFFECT_SID);
+	count_effect(stats, digidrum_count, frame, special[3], ym6 ? special[3] >> 6 : EFFECT_DIGIDRUM);
+}
+
+#if USE_SSE2
+
+// byte counters of the frame loop, added up before they can wrap
+struct Counters
+{
+	__m128i changes;	// per register
+	__m128i active;	// lanes 8-10, channel audible
+	__m128i tone;	// lanes 8-10
+	__m128i noise;	// lanes 8-10
+	__m128i envelope;	// lanes 8-10 envelope level, lane 13 envelope shape writes
+};
+
+static void add_lanes(uint32_t *totals, __m128i counts, int first, int count)
+{
+	uint8_t bytes[16];
+	_mm_storeu_si128((__m128i*)bytes, counts);
+	for (int i = 0; i < count; ++i)
+		totals[i] += bytes[first + i];
+}
+
+static void flush(Counters &counters, TuneStats &stats)
+{
+	add_lanes(stats.register_changes, counters.changes, 0, 16);
+	add_lanes(stats.active_frames, counters.active, 8, 3);
+	add_lanes(stats.tone_frames, counters.tone, 8, 3);
+	add_lanes(stats.noise_frames, counters.noise, 8, 3);
+	add_lanes(stats.envelope_frames, counters.envelope, 8, 3);
+	add_lanes(&stats.envelope_writes, counters.envelope, 13, 1);
+	memset(&counters, 0, sizeof(Counters));
+}
+
+static inline __m128i lanes(uint8_t value, int first, int count)
+{
+	uint8_t bytes[16] = {};
+	for (int i = 0; i < count; ++i)
+		bytes[first + i] = value;
+	return _mm_loadu_si128((const __m128i*)bytes);
+}
+
+// every frame is one 16 byte vector. A compare and movemask against the
+// previous frame finds the changed registers, the channel state is worked
+// out in the level register lanes 8-10 with the mixer shifted across.
+static void scan_frames(const uint8_t *regs, const uint8_t *special, uint32_t frame_count, bool ym5, bool ym6,
+	uint32_t digidrum_count, TuneStats &stats)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi8(1);
+	const __m128i channel_lanes = lanes(1, 8, 3);
+	const __m128i level_bits = _mm_set1_epi8(0x1f);
+	const __m128i envelope_bit = _mm_set1_epi8(0x10);
+	const __m128i mixer_8 = lanes(0xff, 8, 1);
+	const __m128i mixer_9 = lanes(0xff, 9, 1);
+	const __m128i mixer_10 = lanes(0xff, 10, 1);
+	const __m128i tone_bits = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 4, 0, 0, 0, 0, 0);
+	const __m128i noise_bits = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 8, 16, 32, 0, 0, 0, 0, 0);
+	const __m128i shape_lane = lanes(1, 13, 1);
+	const __m128i no_shape_write = _mm_set1_epi8((char)0xf0);
+	// voice bits of both effect registers
+	const __m128i effect_voices = _mm_setr_epi8(0, 0x30, 0, 0x30, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+	Counters counters;
+	memset(&counters, 0, sizeof(Counters));
+	__m128i previous = _mm_loadu_si128((const __m128i*)regs);
+	uint32_t changed_frames = 0;
+	uint32_t pending = 0;
+
+	for (uint32_t f = 0; f < frame_count; ++f) {
+		__m128i current = _mm_loadu_si128((const __m128i*)(regs + f * 16));
+		__m128i current_special = _mm_loadu_si128((const __m128i*)(special + f * 16));
+
+		// the first frame compares with itself and counts no changes
+		__m128i same = _mm_cmpeq_epi8(current, previous);
+		changed_frames += _mm_movemask_epi8(same) != 0xffff;
+		counters.changes = _mm_add_epi8(counters.changes, _mm_andnot_si128(same, one));
+		previous = current;
+
+		__m128i silent = _mm_cmpeq_epi8(_mm_and_si128(current, level_bits), zero);
+		__m128i on = _mm_andnot_si128(silent, channel_lanes);
+		__m128i mixer = _mm_or_si128(_mm_or_si128(
+			_mm_and_si128(_mm_slli_si128(current, 1), mixer_8),
+			_mm_and_si128(_mm_slli_si128(current, 2), mixer_9)),
+			_mm_and_si128(_mm_slli_si128(current, 3), mixer_10));
+		__m128i tone_on = _mm_cmpeq_epi8(_mm_and_si128(mixer, tone_bits), zero);
+		__m128i noise_on = _mm_cmpeq_epi8(_mm_and_si128(mixer, noise_bits), zero);
+		__m128i envelope = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(current, envelope_bit), envelope_bit), channel_lanes);
+		__m128i shape_write = _mm_andnot_si128(_mm_cmpeq_epi8(current_special, no_shape_write), shape_lane);
+
+		counters.active = _mm_add_epi8(counters.active, on);
+		counters.tone = _mm_add_epi8(counters.tone, _mm_and_si128(tone_on, on));
+		counters.noise = _mm_add_epi8(counters.noise, _mm_and_si128(noise_on, on));
+		counters.envelope = _mm_add_epi8(counters.envelope, _mm_or_si128(envelope, shape_write));
+
+		// effects are rare, only frames with a voice set go the slow way
+		if ((ym5 || ym6) && _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(current_special, effect_voices), zero)) != 0xffff)
+			count_effects(stats, digidrum_count, regs + f * 16, special + f * 16, ym6);
+
+		if (++pending == 255) {
+			flush(counters, stats);
+			pending = 0;
+		}
+	}
+	flush(counters, stats);
+	stats.changed_frames = changed_frames;
+}
+
+#else
+
+// the same counts a frame and a register at a time
+static void scan_frames(const uint8_t *regs, const uint8_t *special, uint32_t frame_count, bool ym5, bool ym6,
+	uint32_t digidrum_count, TuneStats &stats)
+{
+	for (uint32_t f = 0; f < frame_count; ++f) {
+		const uint8_t *current = regs + f * 16;
+		const uint8_t *current_special = special + f * 16;
+
+		if (f > 0) {
+			const uint8_t *previous = current - 16;
+			bool changed = false;
+			for (int r = 0; r < 16; ++r) {
+				if (current[r] != previous[r]) {
+					stats.register_changes[r]++;
+					changed = true;
+				}
+			}
+			stats.changed_frames += changed;
+		}
+
+		uint8_t mixer = current[7];
+		for (int c = 0; c < 3; ++c) {
+			uint8_t level = current[8 + c];
+			if (level & 0x10)
+				stats.envelope_frames[c]++;
+			if (!(level & 0x1f))
+				continue;
+			stats.active_frames[c]++;
+			if (!(mixer & (1 << c)))
+				stats.tone_frames[c]++;
+			if (!(mixer & (8 << c)))
+				stats.noise_frames[c]++;
+		}
+		if (current_special[13] != 0xf0)
+			stats.envelope_writes++;
+
+		if (ym5 || ym6)
+			count_effects(stats, digidrum_count, current, current_special, ym6);
+	}
+}
+
+#endif
+
+void analyze(const YMTune &tune, TuneStats &stats)
+{
+	TRACE_SCOPE("analysis::analyze");
+	memset(&stats, 0, sizeof(TuneStats));
+	memcpy(stats.version, tune.version, 4);
+	const YMHeader &header = tune.header;
+	stats.frame_count = header.frame_count;
+	stats.frame_rate = header.frame_rate;
+	stats.loop_frame = header.loop_frame;
+	stats.loop_length = header.loop_frame < header.frame_count ? header.frame_count - header.loop_frame : header.frame_count;
+
+	if (header.frame_rate == 0)
+		stats.issues |= ISSUE_BAD_FRAME_RATE;
+	if (header.frame_count > 0 && header.loop_frame >= header.frame_count)
+		stats.issues |= ISSUE_LOOP_OUT_OF_RANGE;
+	const uint8_t *regs = (const uint8_t*)tune.data.registers;
+	const uint8_t *special = (const uint8_t*)tune.data.special_registers;
+	// every loader widens frames to 16 registers
+	if (header.frame_count == 0 || !regs || !special || tune.data.register_stride != 16) {
+		stats.issues |= ISSUE_NO_FRAMES;
+		return;
+	}
+
+	// YM4 and YM5 share the fixed effect registers
+	bool ym5 = memcmp(tune.version, "YM5", 3) == 0 || memcmp(tune.version, "YM4", 3) == 0;
+	bool ym6 = memcmp(tune.version, "YM6", 3) == 0;
+	scan_frames(regs, special, header.frame_count, ym5, ym6, header.digidrum_count, stats);
+	for (int r = 0; r < 16; ++r)
+		stats.changed_bytes += stats.register_changes[r];
+
+	if (stats.active_frames[0] + stats.active_frames[1] + stats.active_frames[2] == 0)
+		stats.issues |= ISSUE_SILENT;
+}
+
+void write_csv_header(FILE *file)
+{
+	fprintf(file, "path,version,frames,frame_rate,loop_frame,loop_length,seconds,changed_frames,avg_changed_bytes,envelope_writes");
+	for (int r = 0; r < 16; ++r)
+		fprintf(file, ",r%d_changes", r);
+	const char *const kinds[] = { "active", "tone", "noise", "envelope" };
+	for (int k = 0; k < 4; ++k)
+		fprintf(file, ",%s_a,%s_b,%s_c", kinds[k], kinds[k], kinds[k]);
+	fprintf(file, ",sid,digidrum,sinus_sid,sync_buzzer,issues\n");
+}
+
+void write_issues(FILE *file, uint32_t issues)
+{
+	bool first = true;
+	for (uint32_t i = 0; i < sizeof(issue_names) / sizeof(issue_names[0]); ++i) {
+		if (issues & (1 << i)) {
+			fprintf(file, "%s%s", first ? "" : "|", issue_names[i]);
+			first = false;
+		}
+	}
+}
+
+void write_csv_row(FILE *file, const char *path, const TuneStats &stats)
+{
+	fputc('"', file);
+	for (const char *p = path; *p; ++p) {
+		if (*p == '"')
+			fputc('"', file);
+		fputc(*p, file);
+	}
+	fprintf(file, "\",%.4s,%u,%u,%u,%u,%.2f,%u,%.3f,%u", stats.version, stats.frame_count, stats.frame_rate, stats.loop_frame,
+		stats.loop_length, stats.frame_rate ? (double)stats.frame_count / stats.frame_rate : 0.0, stats.changed_frames,
+		average_changed_bytes(stats), stats.envelope_writes);
+	for (int r = 0; r < 16; ++r)
+		fprintf(file, ",%u", stats.register_changes[r]);
+	const uint32_t *const kinds[] = { stats.active_frames, stats.tone_frames, stats.noise_frames, stats.envelope_frames };
+	for (int k = 0; k < 4; ++k)
+		fprintf(file, ",%u,%u,%u", kinds[k][0], kinds[k][1], kinds[k][2]);
+	for (int e = 0; e < EFFECT_COUNT; ++e)
+		fprintf(file, ",%u", stats.effect_frames[e]);
+	fputc(',', file);
+	write_issues(file, stats.issues);
+	fputc('\n', file);
+}
+
+bool analyze_directory(const char *dir, const char *csv_filename, uint32_t thread_count, BatchStats &stats)
+{
+	memset(&stats, 0, sizeof(BatchStats));
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::string> files;
+	fs::list_files(dir, ".ym", files);
+	std::sort(files.begin(), files.end());
+
+	std::vector<TuneStats> results(files.size());
+	std::vector<char> ok(files.size(), 0);
+
+	std::mutex stats_mutex;
+	{
+		ThreadPool pool(thread_count);
+		for (size_t i = 0; i < files.size(); ++i) {
+			pool.submit([&, i] {
+				YMTune tune;
+				loader::LoadResult result = loader::load_tune(files[i].c_str(), tune);
+				double seconds = 0.0;
+				if (result == loader::LOAD_OK) {
+					auto analyze_start = std::chrono::steady_clock::now();
+					analyze(tune, results[i]);
+					seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - analyze_start).count();
+					destroy_ym_tune(tune);
+					ok[i] = 1;
+				}
+
+				std::lock_guard<std::mutex> lock(stats_mutex);
+				stats.files++;
+				stats.analyze_seconds += seconds;
+				if (ok[i]) {
+					stats.frames += results[i].frame_count;
+					if (results[i].issues)
+						stats.with_issues++;
+				}
+				else {
+					stats.failed++;
+					fprintf(stderr, "%s: %s\n", files[i].c_str(), loader::result_string(result));
+				}
+			});
+		}
+		pool.wait();
+	}
+
+	FILE *file = fopen(csv_filename, "w");
+	if (!file)
+		return false;
+	write_csv_header(file);
+	for (size_t i = 0; i < files.size(); ++i) {
+		if (ok[i])
+			write_csv_row(file, files[i].c_str(), results[i]);
+	}
+	bool written = ferror(file) == 0;
+	fclose(file);
+
+	stats.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return written;
+}
+
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include "ym.h"
+
+// Per tune statistics and sanity checks over processed register data, for
+// curating the library and sizing the transport.
+namespace analysis
+{
+
+enum Issue
+{
+	ISSUE_NO_FRAMES = 1 << 0,
+	ISSUE_BAD_FRAME_RATE = 1 << 1,
+	ISSUE_LOOP_OUT_OF_RANGE = 1 << 2,
+	// an effect plays a digidrum the file doesn't have
+	ISSUE_BAD_DIGIDRUM = 1 << 3,
+	ISSUE_SILENT = 1 << 4,
+};
+
+// effect types of the YM6 effect slots, YM5 only has SID on the first
+// slot and digidrums on the second
+enum Effect
+{
+	EFFECT_SID,
+	EFFECT_DIGIDRUM,
+	EFFECT_SINUS_SID,
+	EFFECT_SYNC_BUZZER,
+	EFFECT_COUNT,
+};
+
+struct TuneStats
+{
+	char version[4];
+	uint32_t frame_count;
+	uint16_t frame_rate;
+	uint32_t loop_frame;
+	// frames played again on every loop
+	uint32_t loop_length;
+
+	// against the previous frame, the first frame doesn't count
+	uint32_t register_changes[16];
+	uint32_t changed_frames;
+	uint64_t changed_bytes;
+	// frames that restart the envelope
+	uint32_t envelope_writes;
+
+	// frames each channel is audible, and with tone, noise or envelope on
+	uint32_t active_frames[3];
+	uint32_t tone_frames[3];
+	uint32_t noise_frames[3];
+	uint32_t envelope_frames[3];
+	uint32_t effect_frames[EFFECT_COUNT];
+
+	uint32_t issues;
+};
+
+// registers must be processed (YMData::registers and special_registers)
+void analyze(const YMTune &tune, TuneStats &stats);
+
+inline double average_changed_bytes(const TuneStats &stats)
+{
+	return stats.frame_count > 1 ? (double)stats.changed_bytes / (stats.frame_count - 1) : 0.0;
+}
+
+// one line per tune, the path is quoted
+void write_csv_header(FILE *file);
+void write_csv_row(FILE *file, const char *path, const TuneStats &stats);
+void write_issues(FILE *file, uint32_t issues);
+
+struct BatchStats
+{
+	uint32_t files;
+	uint32_t failed;
+	uint32_t with_issues;
+	uint64_t frames;
+	// time in analyze(), summed over the workers
+	double analyze_seconds;
+	double wall_seconds;
+};
+
+// analyzes every .ym file under dir on a work stealing pool and writes the
+// rows in path order
+bool analyze_directory(const char *dir, const char *csv_filename, uint32_t thread_count, BatchStats &stats);
+
+}
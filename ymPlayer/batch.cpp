@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "batch.h"
+#include "fs.h"
+#include "loader.h"
+#include "lzh.h"
+#include "pages.h"
+#include "thread_pool.h"
+#include "wav.h"
+
+namespace batch
+{
+
+static const uint32_t WAV_BUFFER_SIZE = 1024 * 1024;
+
+bool render_tune(const YMTune &tune, const char *wav_filename, psg::ChipType type, uint32_t sample_rate, double &audio_seconds)
+{
+	uint32_t frame_rate = tune.header.frame_rate ? tune.header.frame_rate : 50;
+	uint32_t clock = tune.header.clock ? tune.header.clock : 2000000;
+
+	wav::Writer writer;
+	if (!wav::open(writer, wav_filename, sample_rate, 1, WAV_BUFFER_SIZE))
+		return false;
+
+	psg::Chip *chip = psg::create(type, clock, sample_rate);
+	float *samples = new float[sample_rate / frame_rate + 1];
+
+	const YMData &data = tune.data;
+	uint64_t rendered = 0;
+	for (uint32_t frame = 0; frame < tune.header.frame_count; ++frame) {
+		psg::write_registers(*chip, (const uint8_t*)&data.registers[frame * 16], is_envelope_write(data, frame));
+
+		// frame n ends at sample (n + 1) * rate / frame_rate, no drift
+		uint64_t frame_end = (uint64_t)(frame + 1) * sample_rate / frame_rate;
+		uint32_t count = (uint32_t)(frame_end - rendered);
+		psg::render(*chip, samples, count);
+		wav::write_samples(writer, samples, count);
+		rendered = frame_end;
+	}
+
+	delete [] samples;
+	psg::destroy(chip);
+	if (!wav::close(writer))
+		return false;
+
+	audio_seconds = (double)rendered / sample_rate;
+	return true;
+}
+
+static std::string output_name(const std::string &input_dir, const std::string &path, const char *extension)
+{
+	std::string relative = path.substr(input_dir.size());
+	while (!relative.empty() && (relative[0] == '/' || relative[0] == '\\'))
+		relative.erase(0, 1);
+
+	for (size_t i = 0; i < relative.size(); ++i) {
+		if (relative[i] == '/' || relative[i] == '\\')
+			relative[i] = '_';
+	}
+	return fs::replace_extension(relative, extension);
+}
+
+RenderStats render_directory(const char *input_dir, const char *output_dir, psg::ChipType type, uint32_t sample_rate, uint32_t thread_count)
+{
+	RenderStats stats = {};
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::string> files;
+	fs::list_files(input_dir, ".ym", files);
+	if (!fs::make_directory(output_dir)) {
+		fprintf(stderr, "couldn't create output directory %s\n", output_dir);
+		stats.files = stats.failed = (uint32_t)files.size();
+		return stats;
+	}
+
+	std::mutex stats_mutex;
+	{
+		ThreadPool pool(thread_count);
+		for (size_t i = 0; i < files.size(); ++i) {
+			const std::string &path = files[i];
+			pool.submit([&, path] {
+				double audio_seconds = 0.0;
+				bool ok = false;
+
+				YMTune tune;
+				loader::LoadResult result = loader::load_tune(path.c_str(), tune);
+				if (result == loader::LOAD_OK) {
+					std::string wav_path = fs::join_path(output_dir, output_name(input_dir, path, ".wav"));
+					ok = render_tune(tune, wav_path.c_str(), type, sample_rate, audio_seconds);
+					destroy_ym_tune(tune);
+				}
+
+				std::lock_guard<std::mutex> lock(stats_mutex);
+				stats.files++;
+				if (ok) {
+					stats.audio_seconds += audio_seconds;
+				}
+				else {
+					stats.failed++;
+					fprintf(stderr, "%s: %s\n", path.c_str(), result == loader::LOAD_OK ? "couldn't write wav" : loader::result_string(result));
+				}
+			});
+		}
+		pool.wait();
+	}
+
+	stats.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return stats;
+}
+
+static uint32_t dos_time_now()
+{
+	time_t now = time(nullptr);
+	struct tm *t = localtime(&now);
+	return ((uint32_t)(t->tm_year - 80) << 25) | ((uint32_t)(t->tm_mon + 1) << 21) | ((uint32_t)t->tm_mday << 16) |
+		((uint32_t)t->tm_hour << 11) | ((uint32_t)t->tm_min << 5) | ((uint32_t)t->tm_sec >> 1);
+}
+
+static bool verify_archive(std::vector<char> &archive, const char *data, uint32_t size)
+{
+	lzh::LZHeader header;
+	bool ok = lzh::read_header(archive.data(), (uint32_t)archive.size(), header) && header.decompressed_size == size;
+	if (ok) {
+		char *decompressed = new char[size];
+		ok = lzh::decompress(header.compressed_data, header.compressed_size, decompressed, size) && memcmp(decompressed, data, size) == 0;
+		delete [] decompressed;
+	}
+	lzh::free_header(header);
+	return ok;
+}
+
+static bool pack_file(const std::string &path, const std::string &output_path, int level, uint32_t timestamp, uint64_t &input_bytes, uint64_t &output_bytes)
+{
+	char *data;
+	uint32_t size;
+	if (!fs::read_file(path.c_str(), data, size))
+		return false;
+
+	// already packed tunes keep their original time stamp
+	if (size < 4 || !is_ym_file(data)) {
+		lzh::LZHeader header;
+		if (lzh::read_header(data, size, header))
+			timestamp = header.timestamp;
+		lzh::free_header(header);
+	}
+
+	bool ok = loader::unpack(data, size) == loader::LOAD_OK;
+
+	std::vector<char> archive;
+	std::string name = fs::file_name(output_path);
+	ok = ok && lzh::pack(data, size, name.c_str(), timestamp, level, archive);
+	ok = ok && verify_archive(archive, data, size);
+
+	if (ok) {
+		FILE *file = fopen(output_path.c_str(), "wb");
+		ok = file && fwrite(archive.data(), 1, archive.size(), file) == archive.size();
+		if (file)
+			fclose(file);
+		input_bytes = size;
+		output_bytes = archive.size();
+	}
+
+	pages::release(data);
+	return ok;
+}
+
+PackStats pack_directory(const char *input_dir, const char *output_dir, int level, uint32_t thread_count)
+{
+	PackStats stats = {};
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::string> files;
+	fs::list_files(input_dir, ".ym", files);
+	uint32_t timestamp = dos_time_now();
+	if (!fs::make_directory(output_dir)) {
+		fprintf(stderr, "couldn't create output directory %s\n", output_dir);
+		stats.files = stats.failed = (uint32_t)files.size();
+		return stats;
+	}
+
+	std::mutex stats_mutex;
+	{
+		ThreadPool pool(thread_count);
+		for (size_t i = 0; i < files.size(); ++i) {
+			const std::string &path = files[i];
+			pool.submit([&, path] {
+				std::string output_path = fs::join_path(output_dir, output_name(input_dir, path, ".ym"));
+				uint64_t input_bytes = 0;
+				uint64_t output_bytes = 0;
+				bool ok = pack_file(path, output_path, level, timestamp, input_bytes, output_bytes);
+
+				std::lock_guard<std::mutex> lock(stats_mutex);
+				stats.files++;
+				if (ok) {
+					stats.input_bytes += input_bytes;
+					stats.output_bytes += output_bytes;
+				}
+				else {
+					stats.failed++;
+					fprintf(stderr, "%s: couldn't pack\n", path.c_str());
+				}
+			});
+		}
+		pool.wait();
+	}
+
+	stats.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return stats;
+}
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <stdint.h>
+#include "psg.h"
+#include "ym.h"
+
+namespace batch
+{
+
+struct RenderStats
+{
+	uint32_t files;
+	uint32_t failed;
+	double audio_seconds;
+	double wall_seconds;
+};
+
+// renders every .ym file under input_dir to a wav file in output_dir, one
+// tune per job on a work stealing pool. Subdirectories are flattened into
+// the output file name.
+RenderStats render_directory(const char *input_dir, const char *output_dir, psg::ChipType type, uint32_t sample_rate, uint32_t thread_count);
+
+struct PackStats
+{
+	uint32_t files;
+	uint32_t failed;
+	uint64_t input_bytes;
+	uint64_t output_bytes;
+	double wall_seconds;
+};
+
+// repacks every .ym file under input_dir as a -lh5- archive in output_dir.
+// Each archive is decoded again and compared before it's written.
+PackStats pack_directory(const char *input_dir, const char *output_dir, int level, uint32_t thread_count);
+
+// renders one pass of the tune, without looping
+bool render_tune(const YMTune &tune, const char *wav_filename, psg::ChipType type, uint32_t sample_rate, double &audio_seconds);
+
+}
@@ -0,0 +1,560 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "ym.h"
+#include "analysis.h"
+#include "lzh.h"
+#include "stream.h"
+#include "fs.h"
+#include "loader.h"
+#include "pages.h"
+#include "player.h"
+#include "sink.h"
+#include "trace.h"
+#include "tune_cache.h"
+
+
+// every allocation goes through here so each benchmark can report how
+// many it does per operation
+static std::atomic<uint64_t> allocation_count(0);
+
+void *operator new(size_t size)
+{
+	allocation_count++;
+	void *ptr = malloc(size ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void *operator new[](size_t size)
+{
+	allocation_count++;
+	void *ptr = malloc(size ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+	free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+	free(ptr);
+}
+
+
+struct Sample
+{
+	std::string name;
+	std::string path;			// empty for synthetic tunes
+	std::vector<char> raw;		// unpacked YM file
+	std::vector<char> packed;	// lh5 archive of raw
+	uint32_t frame_count;
+	bool interleaved;
+};
+
+struct Result
+{
+	std::string benchmark;
+	std::string sample;
+	uint64_t iterations;
+	uint64_t bytes;
+	uint32_t frames;
+	double ns_per_op;
+	double allocations_per_op;
+};
+
+struct Options
+{
+	double min_time;
+	double playback_hours;
+	bool json;
+	const char *filter;
+};
+
+static Options options = { 0.25, 10.0, false, nullptr };
+static std::vector<Result> results;
+
+// keeps results alive so the compiler can't drop the measured work
+static volatile uint64_t sink_value;
+
+
+static void put_u32_be(std::vector<char> &out, uint32_t val)
+{
+	out.push_back((char)(val >> 24));
+	out.push_back((char)(val >> 16));
+	out.push_back((char)(val >> 8));
+	out.push_back((char)val);
+}
+
+static void put_u16_be(std::vector<char> &out, uint16_t val)
+{
+	out.push_back((char)(val >> 8));
+	out.push_back((char)val);
+}
+
+// YM6 tune with a slowly changing, tune like register stream
+static Sample make_synthetic(uint32_t frame_count, bool interleaved)
+{
+	Sample sample;
+	char name[64];
+	sprintf(name, "synthetic_%u_%s", frame_count, interleaved ? "interleaved" : "linear");
+	sample.name = name;
+	sample.frame_count = frame_count;
+	sample.interleaved = interleaved;
+
+	std::vector<uint8_t> frames(frame_count * 16);
+	uint32_t seed = frame_count;
+	for (uint32_t i = 0; i < frame_count; ++i) {
+		uint8_t *r = &frames[i * 16];
+		seed = seed * 1664525 + 1013904223;
+		uint32_t period = 100 + (i * 7) % 600;
+		r[0] = period & 0xff;
+		r[1] = (period >> 8) & 0x0f;
+		r[2] = (period * 2) & 0xff;
+		r[3] = ((period * 2) >> 8) & 0x0f;
+		r[4] = (seed >> 24) & 0xff;
+		r[5] = 1;
+		r[6] = i & 0x1f;
+		r[7] = (i % 50) ? 0x38 : 0x30;
+		r[8] = 15;
+		r[9] = 10 + (i % 6);
+		r[10] = 0x10;
+		r[11] = 0x80;
+		r[13] = (i % 16) ? 0xff : 0x0e;
+	}
+
+	std::vector<char> &out = sample.raw;
+	const char *id = "YM6!LeOnArD!";
+	out.insert(out.end(), id, id + 12);
+	put_u32_be(out, frame_count);
+	put_u32_be(out, interleaved ? 1 : 0);
+	put_u16_be(out, 0);
+	put_u32_be(out, 2000000);
+	put_u16_be(out, 50);
+	put_u32_be(out, frame_count / 4);
+	put_u16_be(out, 0);
+	const char strings[] = "Synthetic\0bench\0generated\0";
+	out.insert(out.end(), strings, strings + sizeof(strings) - 1);
+	for (uint32_t i = 0; i < frame_count * 16; ++i) {
+		uint32_t reg = interleaved ? i / frame_count : i % 16;
+		uint32_t frame = interleaved ? i % frame_count : i / 16;
+		out.push_back((char)frames[frame * 16 + reg]);
+	}
+	out.insert(out.end(), "End!", "End!" + 4);
+
+	lzh::pack(sample.raw.data(), (uint32_t)sample.raw.size(), "bench.ym", 0, lzh::DEFAULT_LEVEL, sample.packed);
+	return sample;
+}
+
+static bool load_sample(const std::string &path, Sample &sample)
+{
+	char *data;
+	uint32_t size;
+	if (!fs::read_file(path.c_str(), data, size))
+		return false;
+
+	std::vector<char> original(data, data + size);
+	if (loader::unpack(data, size) != loader::LOAD_OK || size < 4 || !is_ym_file(data)) {
+		pages::release(data);
+		return false;
+	}
+
+	sample.name = fs::file_name(path);
+	sample.path = path;
+	sample.raw.assign(data, data + size);
+	pages::release(data);
+
+	if (original.size() != sample.raw.size() || memcmp(original.data(), sample.raw.data(), original.size()) != 0)
+		sample.packed = original;
+	else
+		lzh::pack(sample.raw.data(), (uint32_t)sample.raw.size(), sample.name.c_str(), 0, lzh::DEFAULT_LEVEL, sample.packed);
+
+	YMTune tune;
+	create_ym_tune(sample.raw.data(), (uint32_t)sample.raw.size(), tune);
+	sample.frame_count = tune.header.frame_count;
+	sample.interleaved = (tune.header.attributes & 1) != 0;
+	if (tune.storage != sample.raw.data())
+		destroy_ym_tune(tune);
+	return true;
+}
+
+
+template <typename F>
+static void run(const char *benchmark, const Sample &sample, uint64_t bytes, uint32_t frames, F op)
+{
+	std::string name = std::string(benchmark) + "/" + sample.name;
+	if (options.filter && !strstr(name.c_str(), options.filter))
+		return;
+
+	op();
+
+	uint64_t iterations = 0;
+	uint64_t batch = 1;
+	uint64_t allocations = allocation_count;
+	auto start = std::chrono::steady_clock::now();
+	double elapsed = 0.0;
+	while (elapsed < options.min_time || iterations < 3) {
+		for (uint64_t i = 0; i < batch; ++i)
+			op();
+		iterations += batch;
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (elapsed < options.min_time / 10)
+			batch *= 2;
+	}
+	allocations = allocation_count - allocations;
+
+	Result result;
+	result.benchmark = benchmark;
+	result.sample = sample.name;
+	result.iterations = iterations;
+	result.bytes = bytes;
+	result.frames = frames;
+	result.ns_per_op = elapsed * 1e9 / iterations;
+	result.allocations_per_op = (double)allocations / iterations;
+	results.push_back(result);
+
+	if (!options.json) {
+		double mb_per_s = bytes / (result.ns_per_op * 1e-9) / (1024.0 * 1024.0);
+		printf("%-24s %-36s %12.0f ns", benchmark, sample.name.c_str(), result.ns_per_op);
+		if (bytes > 0)
+			printf(" %10.1f MB/s", mb_per_s);
+		else
+			printf("                ");
+		if (frames > 0)
+			printf(" %8.2f ns/frame", result.ns_per_op / frames);
+		else
+			printf("                 ");
+		printf(" %6.1f allocs\n", result.allocations_per_op);
+	}
+}
+
+static void bench_sample(const Sample &sample)
+{
+	std::vector<char> packed = sample.packed;
+	std::vector<char> raw = sample.raw;
+	uint32_t raw_size = (uint32_t)raw.size();
+
+	run("lzh::read_header", sample, 0, 0, [&] {
+		lzh::LZHeader header;
+		sink_value += lzh::read_header(packed.data(), (uint32_t)packed.size(), header);
+		lzh::free_header(header);
+	});
+
+	lzh::LZHeader header;
+	if (lzh::read_header(packed.data(), (uint32_t)packed.size(), header)) {
+		std::vector<char> decompressed(header.decompressed_size);
+		run("lzh::decompress", sample, header.decompressed_size, sample.frame_count, [&] {
+			lzh::decompress(header.compressed_data, header.compressed_size, decompressed.data(), header.decompressed_size);
+			sink_value += decompressed[0];
+		});
+	}
+	lzh::free_header(header);
+
+	const uint32_t checks = 1000;
+	run("is_ym_file", sample, 4 * checks, 0, [&] {
+		for (uint32_t i = 0; i < checks; ++i)
+			sink_value += is_ym_file(raw.data());
+	});
+
+	// what a tune cache lookup costs on top of reading the file
+	run("tune_cache::hash_bytes", sample, (uint32_t)packed.size(), 0, [&] {
+		sink_value += tune_cache::hash_bytes(packed.data(), packed.size());
+	});
+
+	run("create_ym_tune", sample, raw_size, sample.frame_count, [&] {
+		YMTune tune;
+		create_ym_tune(raw.data(), raw_size, tune);
+		sink_value += tune.header.frame_count;
+		destroy_ym_tune(tune);
+	});
+
+	{
+		YMTune tune;
+		create_ym_tune(raw.data(), raw_size, tune);
+		run("analysis::analyze", sample, tune.header.frame_count * 16, tune.header.frame_count, [&] {
+			analysis::TuneStats stats;
+			analysis::analyze(tune, stats);
+			sink_value += stats.changed_bytes;
+		});
+
+		// one pass of the tune in chunks, as unpaced playback sends it
+		player::VirtualClock clock;
+		sink::Sink out;
+		sink::open_null(out);
+		player::Player player;
+		player::init(player, &clock, &out);
+		player::play(player, tune);
+		run("player::send_frames", sample, tune.header.frame_count * 16, tune.header.frame_count, [&] {
+			for (uint32_t sent = 0; sent < tune.header.frame_count;)
+				sent += player::send_frames(player, transmit::CHUNK_FRAMES);
+			sink_value += player.current_frame;
+		});
+		sink::close(out);
+		destroy_ym_tune(tune);
+	}
+
+	// find the register data through the normal loader
+	YMTune tune;
+	create_ym_tune(raw.data(), raw_size, tune);
+	char *unprocessed = tune.data.unprocessed_regs;
+	// YM2/YM3 sources have 14 registers a frame
+	uint32_t source_registers = tune.data.unprocessed_registers;
+	uint32_t frame_count = tune.header.frame_count;
+	destroy_ym_tune(tune);
+	if (unprocessed) {
+		const char *benchmark = sample.interleaved ? "process_registers/deint" : "process_registers/linear";
+		run(benchmark, sample, frame_count * source_registers, frame_count, [&] {
+			YMData data = {};
+			data.unprocessed_regs = unprocessed;
+			data.unprocessed_registers = source_registers;
+			data.register_stride = 16;
+			process_registers(data, frame_count, sample.interleaved);
+			sink_value += data.registers[0];
+			pages::release(data.registers);
+			pages::release(data.special_registers);
+		});
+	}
+
+	uint32_t words = raw_size / 4;
+	run("Stream::read_type", sample, words * 4, 0, [&] {
+		Stream stream(raw.data(), raw_size);
+		stream.set_endian_swap(true);
+		uint32_t sum = 0;
+		for (uint32_t i = 0; i < words; ++i)
+			sum += stream.read_type<uint32_t>();
+		sink_value += sum;
+	});
+
+	char chunk[64] = {};
+	uint32_t chunks = raw_size / sizeof(chunk);
+	run("Stream::read_bytes", sample, chunks * sizeof(chunk), 0, [&] {
+		Stream stream(raw.data(), raw_size);
+		for (uint32_t i = 0; i < chunks; ++i)
+			stream.read_bytes(chunk, sizeof(chunk));
+		sink_value += chunk[0];
+	});
+}
+
+// a file arriving: read (corpus files) or copied in (synthetic), unpacked,
+// parsed and started, until the first frame has gone to the sink
+static void bench_first_frame(const Sample &sample)
+{
+	player::VirtualClock clock;
+	sink::Sink out;
+	sink::open_null(out);
+	player::Player player;
+	player::init(player, &clock, &out);
+
+	run("playback/first_frame", sample, sample.packed.size(), 0, [&] {
+		YMTune tune = {};
+		if (!sample.path.empty()) {
+			if (loader::load_tune(sample.path.c_str(), tune) != loader::LOAD_OK)
+				return;
+		}
+		else {
+			uint32_t size = (uint32_t)sample.packed.size();
+			char *data = pages::allocate(size);
+			memcpy(data, sample.packed.data(), size);
+			if (loader::unpack(data, size) == loader::LOAD_OK)
+				create_ym_tune(data, size, tune);
+			if (tune.storage != data)
+				pages::release(data);
+		}
+		player::play(player, tune);
+		player::send_frame(player);
+		destroy_ym_tune(tune);
+	});
+
+	sink::close(out);
+}
+
+// plays options.playback_hours of the tune on a virtual clock, with a
+// varying amount of work after each frame, and checks that every frame goes
+// out exactly on its n * frame_period deadline and the loop frame is honoured
+static bool check_playback(const Sample &sample)
+{
+	std::string name = std::string("playback/schedule/") + sample.name;
+	if (options.filter && !strstr(name.c_str(), options.filter))
+		return true;
+
+	YMTune tune;
+	create_ym_tune((char*)sample.raw.data(), (uint32_t)sample.raw.size(), tune);
+	const YMHeader &header = tune.header;
+	if (header.frame_count == 0 || header.frame_rate == 0) {
+		destroy_ym_tune(tune);
+		return true;
+	}
+
+	player::VirtualClock clock;
+	sink::Sink out;
+	sink::open_null(out);
+	player::Player player;
+	player::init(player, &clock, &out);
+
+	// arbitrary start so absolute and relative times can't be confused
+	clock.advance(123457);
+	player::play(player, tune);
+	uint64_t start = clock.now_us();
+
+	uint64_t total = (uint64_t)(options.playback_hours * 3600.0 * header.frame_rate);
+	uint32_t loop_frame = header.loop_frame < header.frame_count ? header.loop_frame : 0;
+	uint64_t period_floor = 1000000 / header.frame_rate;
+	uint64_t errors = 0;
+	uint32_t expected_frame = 0;
+
+	auto wall_start = std::chrono::steady_clock::now();
+	for (uint64_t n = 0; n < total; ++n) {
+		player::wait_next_frame(player);
+		uint64_t due = n * 1000000 / header.frame_rate;
+		if (player.current_frame != expected_frame || clock.now_us() - start != due)
+			errors++;
+
+		player::send_frame(player);
+		if (player.last_emit_us - start != due || player.stream_time_us != due)
+			errors++;
+
+		// up to just under a frame period of work, never enough to be late
+		clock.advance((n * 7919) % period_floor);
+
+		expected_frame++;
+		if (expected_frame == header.frame_count)
+			expected_frame = loop_frame;
+	}
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+
+	sink::close(out);
+	destroy_ym_tune(tune);
+
+	Result result;
+	result.benchmark = "playback/schedule";
+	result.sample = sample.name;
+	result.iterations = total;
+	result.bytes = 0;
+	result.frames = 1;
+	result.ns_per_op = total ? wall * 1e9 / total : 0.0;
+	result.allocations_per_op = 0.0;
+	results.push_back(result);
+
+	if (!options.json) {
+		printf("%-24s %-36s %.1f h in %.3f s (%.0fx), %llu frames, %s\n", "playback/schedule", sample.name.c_str(),
+			options.playback_hours, wall, wall > 0.0 ? options.playback_hours * 3600.0 / wall : 0.0,
+			(unsigned long long)total, errors ? "FAILED" : "exact");
+	}
+	if (errors)
+		fprintf(stderr, "%s: %llu frames off schedule or out of order\n", sample.name.c_str(), (unsigned long long)errors);
+	return errors == 0;
+}
+
+static void print_json_string(const std::string &str)
+{
+	putchar('"');
+	for (size_t i = 0; i < str.size(); ++i) {
+		char c = str[i];
+		if (c == '"' || c == '\\')
+			printf("\\%c", c);
+		else if ((unsigned char)c < 0x20)
+			printf("\\u%04x", c);
+		else
+			putchar(c);
+	}
+	putchar('"');
+}
+
+static void print_json()
+{
+	printf("{\n  \"results\": [\n");
+	for (size_t i = 0; i < results.size(); ++i) {
+		const Result &r = results[i];
+		double mb_per_s = r.bytes / (r.ns_per_op * 1e-9) / (1024.0 * 1024.0);
+		printf("    {\"benchmark\": ");
+		print_json_string(r.benchmark);
+		printf(", \"sample\": ");
+		print_json_string(r.sample);
+		printf(", \"iterations\": %llu, \"bytes\": %llu, \"frames\": %u, \"ns_per_op\": %.1f, \"mb_per_s\": %.2f, \"ns_per_frame\": %.3f, \"allocations_per_op\": %.2f}%s\n",
+			(unsigned long long)r.iterations, (unsigned long long)r.bytes, r.frames, r.ns_per_op, mb_per_s,
+			r.frames ? r.ns_per_op / r.frames : 0.0, r.allocations_per_op, i + 1 < results.size() ? "," : "");
+	}
+	printf("  ]\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<std::string> corpus_dirs;
+	const char *trace_filename = nullptr;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-corpus") == 0 && i + 1 < argc)
+			corpus_dirs.push_back(argv[++i]);
+		else if (strcmp(argv[i], "-time") == 0 && i + 1 < argc)
+			options.min_time = atof(argv[++i]);
+		else if (strcmp(argv[i], "-filter") == 0 && i + 1 < argc)
+			options.filter = argv[++i];
+		else if (strcmp(argv[i], "-hours") == 0 && i + 1 < argc)
+			options.playback_hours = atof(argv[++i]);
+		else if (strcmp(argv[i], "-json") == 0)
+			options.json = true;
+		else if (strcmp(argv[i], "-trace") == 0 && i + 1 < argc)
+			trace_filename = argv[++i];
+		else {
+			printf("usage: ymBench [-corpus <dir>]... [-time <seconds>] [-filter <name>] [-hours <playback hours>] [-json] [-trace <file>]\n");
+			return 1;
+		}
+	}
+
+	// timings then include the cost of the enabled trace points
+	if (trace_filename)
+		trace::set_enabled(true);
+
+	std::vector<Sample> samples;
+	const uint32_t sizes[] = { 500, 5000, 50000 };
+	for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		samples.push_back(make_synthetic(sizes[i], true));
+		samples.push_back(make_synthetic(sizes[i], false));
+	}
+
+	for (size_t d = 0; d < corpus_dirs.size(); ++d) {
+		std::vector<std::string> files;
+		fs::list_files(corpus_dirs[d].c_str(), ".ym", files);
+		for (size_t i = 0; i < files.size(); ++i) {
+			Sample sample;
+			if (load_sample(files[i], sample))
+				samples.push_back(sample);
+			else
+				fprintf(stderr, "skipping %s\n", files[i].c_str());
+		}
+	}
+
+	bool schedule_ok = true;
+	for (size_t i = 0; i < samples.size(); ++i) {
+		bench_sample(samples[i]);
+		bench_first_frame(samples[i]);
+		schedule_ok = check_playback(samples[i]) && schedule_ok;
+	}
+
+	if (options.json)
+		print_json();
+	if (trace_filename && !trace::write_json(trace_filename))
+		fprintf(stderr, "couldn't write trace %s\n", trace_filename);
+	return schedule_ok ? 0 : 1;
+}
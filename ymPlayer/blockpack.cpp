@@ -0,0 +1,159 @@
+#include <string.h>
+#include "blockpack.h"
+
+namespace blockpack
+{
+
+static const uint32_t HASH_BITS = 14;
+static const uint32_t MAX_OFFSET = 65535;
+// the last bytes are always literals so the decoder never matches past the end
+static const uint32_t END_LITERALS = 5;
+
+static inline uint32_t read32(const char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static inline uint32_t hash(uint32_t v)
+{
+	return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+static inline uint8_t *write_length(uint8_t *op, uint32_t length)
+{
+	while (length >= 255) {
+		*op++ = 255;
+		length -= 255;
+	}
+	*op++ = (uint8_t)length;
+	return op;
+}
+
+static uint8_t *write_sequence(uint8_t *op, const char *literals, uint32_t literal_count, uint32_t offset, uint32_t match_length)
+{
+	uint8_t *token = op++;
+	*token = (uint8_t)((literal_count >= 15 ? 15 : literal_count) << 4);
+	if (literal_count >= 15)
+		op = write_length(op, literal_count - 15);
+	memcpy(op, literals, literal_count);
+	op += literal_count;
+
+	if (match_length > 0) {
+		*op++ = offset & 0xff;
+		*op++ = (offset >> 8) & 0xff;
+		uint32_t length = match_length - MIN_MATCH;
+		*token |= (uint8_t)(length >= 15 ? 15 : length);
+		if (length >= 15)
+			op = write_length(op, length - 15);
+	}
+	return op;
+}
+
+uint32_t compress(const char *src, uint32_t size, char *dst)
+{
+	uint32_t table[1 << HASH_BITS];
+	memset(table, 0, sizeof(table));
+
+	uint8_t *op = (uint8_t*)dst;
+	uint32_t anchor = 0;
+	uint32_t pos = 0;
+
+	if (size > MIN_MATCH + END_LITERALS) {
+		uint32_t limit = size - MIN_MATCH - END_LITERALS;
+		while (pos < limit) {
+			uint32_t sequence = read32(src + pos);
+			uint32_t h = hash(sequence);
+			uint32_t candidate = table[h];
+			table[h] = pos;
+
+			if (candidate >= pos || pos - candidate > MAX_OFFSET || read32(src + candidate) != sequence) {
+				pos++;
+				continue;
+			}
+
+			uint32_t length = MIN_MATCH;
+			uint32_t max_length = size - END_LITERALS - pos;
+			while (length < max_length && src[candidate + length] == src[pos + length])
+				length++;
+
+			op = write_sequence(op, src + anchor, pos - anchor, pos - candidate, length);
+			pos += length;
+			anchor = pos;
+		}
+	}
+
+	op = write_sequence(op, src + anchor, size - anchor, 0, 0);
+	return (uint32_t)(op - (uint8_t*)dst);
+}
+
+static inline bool read_length(const uint8_t *&ip, const uint8_t *end, uint32_t &length)
+{
+	uint8_t b;
+	do {
+		if (ip >= end)
+			return false;
+		b = *ip++;
+		length += b;
+	} while (b == 255);
+	return true;
+}
+
+bool decompress(const char *src, uint32_t src_size, char *dst, uint32_t dst_size)
+{
+	const uint8_t *ip = (const uint8_t*)src;
+	const uint8_t *end = ip + src_size;
+	uint8_t *op = (uint8_t*)dst;
+	uint8_t *op_end = op + dst_size;
+
+	while (ip < end) {
+		uint8_t token = *ip++;
+
+		uint32_t literal_count = token >> 4;
+		if (literal_count == 15 && !read_length(ip, end, literal_count))
+			return false;
+		if (literal_count > (uint32_t)(end - ip) || literal_count > (uint32_t)(op_end - op))
+			return false;
+		memcpy(op, ip, literal_count);
+		ip += literal_count;
+		op += literal_count;
+
+		if (ip == end)
+			break;
+
+		if (end - ip < 2)
+			return false;
+		uint32_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		uint32_t match_length = token & 0x0f;
+		if (match_length == 15 && !read_length(ip, end, match_length))
+			return false;
+		match_length += MIN_MATCH;
+
+		if (offset == 0 || offset > (uint32_t)(op - (uint8_t*)dst) || match_length > (uint32_t)(op_end - op))
+			return false;
+
+		const uint8_t *match = op - offset;
+		if (offset >= 8) {
+			// non overlapping 8 byte steps, the tail is copied bytewise
+			uint8_t *copy_end = op + match_length;
+			while (op + 8 <= copy_end) {
+				memcpy(op, match, 8);
+				op += 8;
+				match += 8;
+			}
+			while (op < copy_end)
+				*op++ = *match++;
+		}
+		else {
+			for (uint32_t i = 0; i < match_length; ++i)
+				op[i] = match[i];
+			op += match_length;
+		}
+	}
+
+	return op == op_end;
+}
+
+}
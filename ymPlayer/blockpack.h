@@ -0,0 +1,27 @@
+#pragma once
+#include <stdint.h>
+
+// Byte oriented LZ77 block codec tuned for decode speed. A block is a run of
+// sequences: token (literal count << 4 | match length - 4), literal count
+// extension, literals, 16 bit little endian offset, match length
+// extension. Counts of 15 continue in following bytes, 255 at a time. The
+// last sequence has literals only.
+namespace blockpack
+{
+
+static const uint32_t MIN_MATCH = 4;
+
+// worst case output size for size input bytes
+inline uint32_t compress_bound(uint32_t size)
+{
+	return size + size / 255 + 16;
+}
+
+// returns the compressed size, dst must hold compress_bound(size) bytes
+uint32_t compress(const char *src, uint32_t size, char *dst);
+
+// returns false on corrupt input or if the output doesn't come out at
+// exactly dst_size bytes
+bool decompress(const char *src, uint32_t src_size, char *dst, uint32_t dst_size);
+
+}
@@ -0,0 +1,633 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "control.h"
+#include "loader.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+namespace control
+{
+
+struct Server::Client
+{
+	int fd;
+	std::string input;
+	std::string output;
+	bool closing;
+};
+
+std::string json_string(const char *str)
+{
+	std::string out = "\"";
+	for (; *str; ++str) {
+		unsigned char c = (unsigned char)*str;
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += (char)c;
+		}
+		else if (c == '\n') {
+			out += "\\n";
+		}
+		else if (c < 0x20) {
+			char escaped[8];
+			sprintf(escaped, "\\u%04x", c);
+			out += escaped;
+		}
+		else {
+			out += (char)c;
+		}
+	}
+	out += '"';
+	return out;
+}
+
+// the fields a request can carry, anything else is ignored
+struct Request
+{
+	std::string cmd;
+	std::string file;
+	bool has_frame;
+	double frame;
+	bool has_seconds;
+	double seconds;
+};
+
+static void skip_space(const char *&p)
+{
+	while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+		++p;
+}
+
+static bool parse_string(const char *&p, std::string &out)
+{
+	if (*p != '"')
+		return false;
+	++p;
+	out.clear();
+	while (*p && *p != '"') {
+		if (*p != '\\') {
+			out += *p++;
+			continue;
+		}
+		++p;
+		switch (*p) {
+			case '"': case '\\': case '/': out += *p; break;
+			case 'n': out += '\n'; break;
+			case 't': out += '\t'; break;
+			case 'r': out += '\r'; break;
+			case 'b': out += '\b'; break;
+			case 'f': out += '\f'; break;
+			case 'u': {
+				// only the basic multilingual plane, written as utf-8
+				char hex[5] = {};
+				for (int i = 0; i < 4; ++i) {
+					if (!isxdigit((unsigned char)p[1 + i]))
+						return false;
+					hex[i] = p[1 + i];
+				}
+				uint32_t code = strtoul(hex, nullptr, 16);
+				if (code < 0x80) {
+					out += (char)code;
+				}
+				else if (code < 0x800) {
+					out += (char)(0xc0 | (code >> 6));
+					out += (char)(0x80 | (code & 0x3f));
+				}
+				else {
+					out += (char)(0xe0 | (code >> 12));
+					out += (char)(0x80 | ((code >> 6) & 0x3f));
+					out += (char)(0x80 | (code & 0x3f));
+				}
+				p += 4;
+				break;
+			}
+			default: return false;
+		}
+		++p;
+	}
+	if (*p != '"')
+		return false;
+	++p;
+	return true;
+}
+
+// flat objects only, which is all the protocol uses
+static bool parse_request(const std::string &line, Request &request)
+{
+	request.has_frame = false;
+	request.has_seconds = false;
+
+	const char *p = line.c_str();
+	skip_space(p);
+	if (*p++ != '{')
+		return false;
+	skip_space(p);
+	if (*p == '}')
+		return true;
+
+	for (;;) {
+		std::string key;
+		skip_space(p);
+		if (!parse_string(p, key))
+			return false;
+		skip_space(p);
+		if (*p++ != ':')
+			return false;
+		skip_space(p);
+
+		if (*p == '"') {
+			std::string value;
+			if (!parse_string(p, value))
+				return false;
+			if (key == "cmd")
+				request.cmd = value;
+			else if (key == "file")
+				request.file = value;
+		}
+		else if (strncmp(p, "true", 4) == 0 || strncmp(p, "null", 4) == 0) {
+			p += 4;
+		}
+		else if (strncmp(p, "false", 5) == 0) {
+			p += 5;
+		}
+		else {
+			char *end;
+			double value = strtod(p, &end);
+			if (end == p)
+				return false;
+			p = end;
+			if (key == "frame") {
+				request.has_frame = true;
+				request.frame = value;
+			}
+			else if (key == "seconds") {
+				request.has_seconds = true;
+				request.seconds = value;
+			}
+		}
+
+		skip_space(p);
+		if (*p == ',') {
+			++p;
+			continue;
+		}
+		if (*p != '}')
+			return false;
+		++p;
+		skip_space(p);
+		return *p == 0;
+	}
+}
+
+static std::string error_response(const char *message)
+{
+	return std::string("{\"ok\":false,\"error\":") + json_string(message) + "}";
+}
+
+Server::Server(tune_cache::Cache &cache) : _current(nullptr), _queued(0), _current_loops(0), _cache(cache),
+	_listen_fd(-1), _epoll_fd(-1), _wake_fd(-1), _quit(false),
+	_commands_handled(0), _command_errors(0), _clients_accepted(0), _loads(0), _load_time_us(0), _max_load_time_us(0)
+{
+	memset(&_status, 0, sizeof(Status));
+}
+
+Server::~Server()
+{
+	stop();
+
+	Command command;
+	while (_commands.pop(command)) {
+		if (command.entry)
+			retire(command.entry);
+	}
+	for (uint32_t i = 0; i < _queued; ++i)
+		retire(_queue[i]);
+	if (_current)
+		retire(_current);
+	destroy_retired();
+}
+
+void Server::retire(Entry *entry)
+{
+	// the server drains the ring every 100 ms, if it ever falls that far
+	// behind the output thread drops the entry itself. The cache keeps its
+	// own reference so that never frees the tune here.
+	if (!_retired.push(entry))
+		delete entry;
+}
+
+void Server::destroy_retired()
+{
+	Entry *entry;
+	while (_retired.pop(entry))
+		delete entry;
+}
+
+void Server::publish(const player::Player &player)
+{
+	if (!_status_mutex.try_lock())
+		return;
+
+	_status.is_playing = player.is_playing;
+	if (_current)
+		memcpy(_status.path, _current->path, MAX_PATH_LENGTH);
+	else
+		_status.path[0] = 0;
+	_status.current_frame = player.current_frame;
+	_status.frame_count = player.tune.header.frame_count;
+	_status.loop_frame = player.tune.header.loop_frame;
+	_status.frame_rate = player.tune.header.frame_rate;
+	_status.queued = _queued;
+	_status.loops = player.loops;
+	_status.frames_sent = player.frames_sent;
+	_status.bytes_sent = player.bytes_sent;
+	_status.late_frames = player.late_frames;
+	_status.max_late_us = player.max_late_us;
+	_status_mutex.unlock();
+}
+
+void Server::update(player::Player &player)
+{
+	Command command;
+	while (_commands.pop(command)) {
+		switch (command.type) {
+			case COMMAND_PLAY:
+				if (_current)
+					retire(_current);
+				_current = command.entry;
+				player::play(player, *_current->tune);
+				break;
+			case COMMAND_RESUME:
+				if (_current && !player.is_playing)
+					player::resume(player);
+				break;
+			case COMMAND_STOP:
+				if (player.is_playing)
+					player::stop(player);
+				break;
+			case COMMAND_QUEUE:
+				if (!_current) {
+					_current = command.entry;
+					player::play(player, *_current->tune);
+				}
+				else if (_queued < MAX_QUEUED_TUNES) {
+					_queue[_queued++] = command.entry;
+				}
+				else {
+					retire(command.entry);
+				}
+				break;
+			case COMMAND_SEEK:
+				player::seek(player, command.frame);
+				break;
+		}
+		_current_loops = player.loops;
+	}
+
+	// a tune that has reached its end once gives way to the next in line
+	if (_queued > 0 && player.is_playing && player.loops != _current_loops) {
+		retire(_current);
+		_current = _queue[0];
+		memmove(_queue, _queue + 1, (_queued - 1) * sizeof(Entry*));
+		_queued--;
+		player::play(player, *_current->tune);
+		_current_loops = player.loops;
+	}
+
+	publish(player);
+}
+
+void Server::play(player::Player &player, const char *path, const tune_cache::Handle &tune)
+{
+	Entry *entry = new Entry;
+	entry->tune = tune;
+	strncpy(entry->path, path, MAX_PATH_LENGTH - 1);
+	entry->path[MAX_PATH_LENGTH - 1] = 0;
+
+	if (_current)
+		retire(_current);
+	_current = entry;
+	player::play(player, *_current->tune);
+	_current_loops = player.loops;
+}
+
+std::string Server::handle_command(const std::string &line)
+{
+	Request request;
+	if (!parse_request(line, request))
+		return error_response("invalid json");
+
+	Status status;
+	{
+		std::lock_guard<std::mutex> lock(_status_mutex);
+		status = _status;
+	}
+
+	char buffer[512];
+	if (request.cmd == "play" || request.cmd == "queue") {
+		bool queue = request.cmd == "queue";
+		if (request.file.empty()) {
+			if (queue)
+				return error_response("queue needs a file");
+			Command command = { COMMAND_RESUME, nullptr, 0 };
+			if (!_commands.push(command))
+				return error_response("player busy");
+			return "{\"ok\":true}";
+		}
+		if (request.file.size() >= MAX_PATH_LENGTH)
+			return error_response("path too long");
+		if (queue && status.queued >= MAX_QUEUED_TUNES)
+			return error_response("queue full");
+
+		auto start = std::chrono::steady_clock::now();
+		Entry *entry = new Entry;
+		bool hit;
+		loader::LoadResult result = _cache.load(request.file.c_str(), entry->tune, &hit);
+		if (result != loader::LOAD_OK) {
+			delete entry;
+			return error_response(loader::result_string(result));
+		}
+		strcpy(entry->path, request.file.c_str());
+		uint64_t load_us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		_loads++;
+		_load_time_us += load_us;
+		if (load_us > _max_load_time_us)
+			_max_load_time_us = load_us;
+
+		Command command = { queue ? COMMAND_QUEUE : COMMAND_PLAY, entry, 0 };
+		if (!_commands.push(command)) {
+			delete entry;
+			return error_response("player busy");
+		}
+
+		const YMTune &tune = *entry->tune;
+		std::string response = "{\"ok\":true,\"name\":" + json_string(tune.song_info.name ? tune.song_info.name : "") +
+			",\"author\":" + json_string(tune.song_info.author ? tune.song_info.author : "");
+		sprintf(buffer, ",\"frames\":%u,\"frame_rate\":%u,\"load_us\":%llu,\"cached\":%s}", tune.header.frame_count,
+			tune.header.frame_rate, (unsigned long long)load_us, hit ? "true" : "false");
+		return response + buffer;
+	}
+	if (request.cmd == "stop") {
+		Command command = { COMMAND_STOP, nullptr, 0 };
+		if (!_commands.push(command))
+			return error_response("player busy");
+		return "{\"ok\":true}";
+	}
+	if (request.cmd == "seek") {
+		double frame;
+		if (request.has_frame)
+			frame = request.frame;
+		else if (request.has_seconds)
+			frame = request.seconds * status.frame_rate;
+		else
+			return error_response("seek needs frame or seconds");
+		if (status.frame_count == 0)
+			return error_response("nothing loaded");
+		if (frame < 0 || frame >= status.frame_count)
+			return error_response("position out of range");
+
+		Command command = { COMMAND_SEEK, nullptr, (uint32_t)frame };
+		if (!_commands.push(command))
+			return error_response("player busy");
+		return "{\"ok\":true}";
+	}
+	if (request.cmd == "status") {
+		std::string response = std::string("{\"ok\":true,\"state\":\"") + (status.is_playing ? "playing" : "stopped") +
+			"\",\"file\":" + json_string(status.path);
+		sprintf(buffer, ",\"frame\":%u,\"frames\":%u,\"loop_frame\":%u,\"frame_rate\":%u,\"position\":%.2f,\"queued\":%u,\"loops\":%u}",
+			status.current_frame, status.frame_count, status.loop_frame, status.frame_rate,
+			status.frame_rate ? (double)status.current_frame / status.frame_rate : 0.0, status.queued, status.loops);
+		return response + buffer;
+	}
+	if (request.cmd == "stats") {
+		sprintf(buffer, "{\"ok\":true,\"frames_sent\":%llu,\"bytes_sent\":%llu,\"late_frames\":%llu,\"max_late_us\":%llu,"
+			"\"commands\":%llu,\"command_errors\":%llu,\"clients\":%llu,\"loads\":%llu,\"avg_load_us\":%llu,\"max_load_us\":%llu}",
+			(unsigned long long)status.frames_sent, (unsigned long long)status.bytes_sent,
+			(unsigned long long)status.late_frames, (unsigned long long)status.max_late_us,
+			(unsigned long long)_commands_handled, (unsigned long long)_command_errors, (unsigned long long)_clients_accepted,
+			(unsigned long long)_loads, (unsigned long long)(_loads ? _load_time_us / _loads : 0), (unsigned long long)_max_load_time_us);
+		std::string response(buffer, strlen(buffer) - 1);
+
+		tune_cache::Stats cache = _cache.stats();
+		sprintf(buffer, ",\"cache_hits\":%llu,\"cache_misses\":%llu,\"cache_evictions\":%llu,\"cache_entries\":%u,"
+			"\"cache_in_use\":%u,\"cache_bytes\":%llu,\"cache_budget\":%llu}",
+			(unsigned long long)cache.hits, (unsigned long long)cache.misses, (unsigned long long)cache.evictions,
+			cache.entries, cache.in_use, (unsigned long long)cache.bytes, (unsigned long long)cache.budget);
+		return response + buffer;
+	}
+	return error_response("unknown command");
+}
+
+#ifdef __linux__
+
+bool Server::start(const char *socket_path)
+{
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(address.sun_path))
+		return false;
+	strcpy(address.sun_path, socket_path);
+
+	_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (_listen_fd < 0)
+		return false;
+
+	unlink(socket_path);
+	if (bind(_listen_fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(_listen_fd, 16) != 0) {
+		::close(_listen_fd);
+		_listen_fd = -1;
+		return false;
+	}
+	_socket_path = socket_path;
+
+	_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	epoll_event event;
+	event.events = EPOLLIN;
+	event.data.ptr = nullptr;
+	event.data.fd = _listen_fd;
+	epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _listen_fd, &event);
+	event.data.fd = _wake_fd;
+	epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _wake_fd, &event);
+
+	_quit = false;
+	_thread = std::thread(&Server::thread_main, this);
+	return true;
+}
+
+void Server::stop()
+{
+	if (!_thread.joinable())
+		return;
+
+	_quit = true;
+	uint64_t one = 1;
+	ssize_t written = write(_wake_fd, &one, sizeof(one));
+	(void)written;
+	_thread.join();
+
+	::close(_listen_fd);
+	::close(_wake_fd);
+	::close(_epoll_fd);
+	unlink(_socket_path.c_str());
+	_listen_fd = _wake_fd = _epoll_fd = -1;
+}
+
+static void set_events(int epoll_fd, int fd, bool want_read, bool want_write)
+{
+	epoll_event event;
+	event.events = (want_read ? (uint32_t)(EPOLLIN | EPOLLRDHUP) : 0) | (want_write ? (uint32_t)EPOLLOUT : 0);
+	event.data.fd = fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+}
+
+// false when the connection should be closed
+static bool flush_output(int fd, std::string &output)
+{
+	while (!output.empty()) {
+		ssize_t written = send(fd, output.data(), output.size(), MSG_NOSIGNAL);
+		if (written < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		output.erase(0, (size_t)written);
+	}
+	return true;
+}
+
+void Server::handle_line(Client &client, const std::string &line)
+{
+	std::string response = handle_command(line);
+	_commands_handled++;
+	if (response.compare(0, 11, "{\"ok\":false") == 0)
+		_command_errors++;
+	client.output += response;
+	client.output += '\n';
+}
+
+void Server::thread_main()
+{
+	std::vector<Client*> clients;
+	auto find_client = [&](int fd) -> size_t {
+		for (size_t i = 0; i < clients.size(); ++i) {
+			if (clients[i]->fd == fd)
+				return i;
+		}
+		return clients.size();
+	};
+	auto close_client = [&](size_t index) {
+		epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, clients[index]->fd, nullptr);
+		::close(clients[index]->fd);
+		delete clients[index];
+		clients.erase(clients.begin() + index);
+	};
+
+	epoll_event events[16];
+	while (!_quit) {
+		int count = epoll_wait(_epoll_fd, events, 16, 100);
+		destroy_retired();
+
+		for (int i = 0; i < count; ++i) {
+			int fd = events[i].data.fd;
+			if (fd == _wake_fd)
+				continue;
+
+			if (fd == _listen_fd) {
+				for (;;) {
+					int client_fd = accept4(_listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+					if (client_fd < 0)
+						break;
+					Client *client = new Client;
+					client->fd = client_fd;
+					client->closing = false;
+					clients.push_back(client);
+					_clients_accepted++;
+
+					epoll_event event;
+					event.events = EPOLLIN | EPOLLRDHUP;
+					event.data.fd = client_fd;
+					epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, client_fd, &event);
+				}
+				continue;
+			}
+
+			size_t index = find_client(fd);
+			if (index == clients.size())
+				continue;
+			Client &client = *clients[index];
+			bool keep = !client.closing;
+
+			if (keep && (events[i].events & EPOLLIN)) {
+				char buffer[4096];
+				for (;;) {
+					ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+					if (received > 0) {
+						client.input.append(buffer, (size_t)received);
+						continue;
+					}
+					if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+						keep = false;
+					break;
+				}
+
+				size_t newline;
+				while ((newline = client.input.find('\n')) != std::string::npos) {
+					std::string line = client.input.substr(0, newline);
+					client.input.erase(0, newline + 1);
+					if (!line.empty() && line[line.size() - 1] == '\r')
+						line.erase(line.size() - 1);
+					if (!line.empty())
+						handle_line(client, line);
+				}
+				if (client.input.size() > MAX_LINE) {
+					client.output += error_response("line too long") + "\n";
+					client.input.clear();
+					keep = false;
+				}
+			}
+			if (events[i].events & (EPOLLHUP | EPOLLERR))
+				keep = false;
+
+			// answer whatever was complete even if the peer has half closed,
+			// a closing client only waits for its output to drain
+			bool flushed = flush_output(fd, client.output);
+			if (!flushed || (!keep && client.output.empty()) || (events[i].events & (EPOLLHUP | EPOLLERR))) {
+				close_client(index);
+				continue;
+			}
+			client.closing = !keep;
+			set_events(_epoll_fd, fd, keep, !client.output.empty());
+		}
+	}
+
+	while (!clients.empty())
+		close_client(clients.size() - 1);
+	destroy_retired();
+}
+
+#else
+
+// no epoll, the control socket is only available on linux
+bool Server::start(const char *)
+{
+	return false;
+}
+
+void Server::stop()
+{
+}
+
+#endif
+
+}
@@ -0,0 +1,174 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "player.h"
+#include "tune_cache.h"
+#include "ym.h"
+
+// Control socket: a unix domain socket taking one JSON object per line,
+//   {"cmd":"play","file":"/music/tune.ym"}   load and play now
+//   {"cmd":"play"}                           resume
+//   {"cmd":"stop"}
+//   {"cmd":"queue","file":"/music/next.ym"}  play after the current tune
+//   {"cmd":"seek","frame":1200} or {"cmd":"seek","seconds":24.5}
+//   {"cmd":"status"}, {"cmd":"stats"}
+// and answering each with one line, {"ok":true,...} or {"ok":false,"error":...}.
+//
+// Sockets and tune loading are handled on the server's own thread, tunes
+// come from a tune_cache so playing or queueing a file again doesn't decode
+// it again. The output thread only calls update() once per frame, which
+// never blocks: commands come in and finished tunes go back through lock
+// free rings, and the status snapshot is published with try_lock.
+namespace control
+{
+
+static const char *const DEFAULT_SOCKET_PATH = "/tmp/ymplayer.sock";
+static const uint32_t RING_SIZE = 64;
+static const uint32_t MAX_QUEUED_TUNES = 32;
+static const uint32_t MAX_LINE = 4096;
+static const uint32_t MAX_PATH_LENGTH = 1024;
+
+// a loaded tune and the file it came from
+struct Entry
+{
+	tune_cache::Handle tune;
+	char path[MAX_PATH_LENGTH];
+};
+
+enum CommandType
+{
+	COMMAND_PLAY,
+	COMMAND_RESUME,
+	COMMAND_STOP,
+	COMMAND_QUEUE,
+	COMMAND_SEEK,
+};
+
+struct Command
+{
+	CommandType type;
+	Entry *entry;
+	uint32_t frame;
+};
+
+// written by the output thread, read by the server
+struct Status
+{
+	bool is_playing;
+	char path[MAX_PATH_LENGTH];
+	uint32_t current_frame;
+	uint32_t frame_count;
+	uint32_t loop_frame;
+	uint16_t frame_rate;
+	uint32_t queued;
+	uint32_t loops;
+	uint64_t frames_sent;
+	uint64_t bytes_sent;
+	uint64_t late_frames;
+	uint64_t max_late_us;
+};
+
+// single producer, single consumer
+template <typename T, uint32_t N>
+class Ring
+{
+public:
+	Ring() : _head(0), _tail(0) {}
+
+	bool push(const T &item) {
+		uint32_t head = _head.load(std::memory_order_relaxed);
+		if (head - _tail.load(std::memory_order_acquire) == N)
+			return false;
+		_items[head % N] = item;
+		_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	// exact on the consumer side, a lower bound on the producer side
+	uint32_t size() const {
+		return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_relaxed);
+	}
+
+	bool pop(T &item) {
+		uint32_t tail = _tail.load(std::memory_order_relaxed);
+		if (tail == _head.load(std::memory_order_acquire))
+			return false;
+		item = _items[tail % N];
+		_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	T _items[N];
+	std::atomic<uint32_t> _head;
+	std::atomic<uint32_t> _tail;
+};
+
+class Server
+{
+public:
+	// tunes are loaded through cache, which has to outlive the server
+	explicit Server(tune_cache::Cache &cache);
+	~Server();
+
+	// binds socket_path (replacing a stale socket) and starts the thread
+	bool start(const char *socket_path);
+	void stop();
+
+	// output thread, once per frame: applies pending commands to player,
+	// moves on to the next queued tune when the current one has played
+	// through, and publishes the status
+	void update(player::Player &player);
+
+	// output thread, plays a tune started outside the socket (command line,
+	// dropped file) as the current tune, so a queued tune waits for it
+	void play(player::Player &player, const char *path, const tune_cache::Handle &tune);
+
+	// tunes handed over by commands, owned by the output side until retired
+	Entry *current() const { return _current; }
+
+private:
+	struct Client;
+
+	void thread_main();
+	void handle_line(Client &client, const std::string &line);
+	std::string handle_command(const std::string &line);
+	void retire(Entry *entry);
+	void destroy_retired();
+	void publish(const player::Player &player);
+
+	// output side
+	Entry *_current;
+	Entry *_queue[MAX_QUEUED_TUNES];
+	uint32_t _queued;
+	uint32_t _current_loops;
+
+	Ring<Command, RING_SIZE> _commands;
+	Ring<Entry*, RING_SIZE * 2> _retired;
+
+	std::mutex _status_mutex;
+	Status _status;
+
+	tune_cache::Cache &_cache;
+	std::string _socket_path;
+	std::thread _thread;
+	int _listen_fd;
+	int _epoll_fd;
+	int _wake_fd;
+	std::atomic<bool> _quit;
+
+	// server thread stats
+	uint64_t _commands_handled;
+	uint64_t _command_errors;
+	uint64_t _clients_accepted;
+	uint64_t _loads;
+	uint64_t _load_time_us;
+	uint64_t _max_load_time_us;
+};
+
+std::string json_string(const char *str);
+
+}
@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include "dedup.h"
+#include "fs.h"
+#include "loader.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include "tune_cache.h"
+
+namespace dedup
+{
+
+static const uint64_t FNV_OFFSET = 0xcbf29ce484222325ull;
+static const uint64_t FNV_PRIME = 0x100000001b3ull;
+// odd, so powers of it never collapse to zero mod 2^64
+static const uint64_t ROLL_BASE = 0x9e3779b97f4a7c15ull;
+
+static uint64_t frame_hash(const uint8_t *regs, uint32_t stride)
+{
+	uint64_t h = FNV_OFFSET;
+	for (uint32_t i = 0; i < stride; ++i)
+		h = (h ^ regs[i]) * FNV_PRIME;
+	return h;
+}
+
+// spreads the rolling hash over all bits so the smallest values are a fair sample
+static uint64_t mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+// keeps the smallest hash of every window of w, once per position
+static void winnow(const std::vector<uint64_t> &grams, uint32_t w, std::vector<uint64_t> &picked)
+{
+	size_t count = grams.size();
+	if (count == 0)
+		return;
+	if (count < w)
+		w = (uint32_t)count;
+
+	size_t min_pos = 0;
+	bool have_min = false;
+	for (size_t start = 0; start + w <= count; ++start) {
+		size_t last = start + w - 1;
+		if (!have_min || min_pos < start) {
+			min_pos = start;
+			for (size_t i = start + 1; i <= last; ++i) {
+				if (grams[i] <= grams[min_pos])
+					min_pos = i;
+			}
+			have_min = true;
+			picked.push_back(grams[min_pos]);
+		}
+		else if (grams[last] <= grams[min_pos]) {
+			min_pos = last;
+			picked.push_back(grams[min_pos]);
+		}
+	}
+}
+
+void make_signature(const YMTune &tune, uint32_t gram_frames, Signature &signature)
+{
+	TRACE_SCOPE("dedup::make_signature");
+	const uint8_t *regs = (const uint8_t*)tune.data.registers;
+	uint32_t stride = tune.data.register_stride;
+	uint32_t frame_count = tune.header.frame_count;
+
+	signature.register_hash = tune_cache::hash_bytes(regs, (size_t)frame_count * stride);
+	signature.frame_count = frame_count;
+	signature.fingerprints.clear();
+	signature.threshold = UINT64_MAX;
+
+	std::vector<uint64_t> frames;
+	frames.reserve(frame_count);
+	for (uint32_t i = 0; i < frame_count; ++i) {
+		const uint8_t *frame = regs + (size_t)i * stride;
+		if (i > 0 && memcmp(frame, frame - stride, stride) == 0)
+			continue;
+		frames.push_back(frame_hash(frame, stride));
+	}
+	signature.distinct_frames = (uint32_t)frames.size();
+	if (gram_frames == 0 || frames.size() < gram_frames)
+		return;
+
+	// h = sum of frames[i + k] * ROLL_BASE^(gram_frames - 1 - k)
+	uint64_t top_power = 1;
+	for (uint32_t i = 1; i < gram_frames; ++i)
+		top_power *= ROLL_BASE;
+
+	std::vector<uint64_t> grams;
+	grams.reserve(frames.size() - gram_frames + 1);
+	uint64_t h = 0;
+	for (size_t i = 0; i < frames.size(); ++i) {
+		if (i >= gram_frames)
+			h -= frames[i - gram_frames] * top_power;
+		h = h * ROLL_BASE + frames[i];
+		if (i + 1 >= gram_frames)
+			grams.push_back(mix(h));
+	}
+
+	std::vector<uint64_t> &fingerprints = signature.fingerprints;
+	winnow(grams, WINNOW_WINDOW, fingerprints);
+	std::sort(fingerprints.begin(), fingerprints.end());
+	fingerprints.erase(std::unique(fingerprints.begin(), fingerprints.end()), fingerprints.end());
+	if (fingerprints.size() > MAX_FINGERPRINTS) {
+		fingerprints.resize(MAX_FINGERPRINTS);
+		signature.threshold = fingerprints.back();
+	}
+	fingerprints.shrink_to_fit();
+}
+
+double similarity(const Signature &a, const Signature &b)
+{
+	uint64_t threshold = std::min(a.threshold, b.threshold);
+	auto a_end = std::upper_bound(a.fingerprints.begin(), a.fingerprints.end(), threshold);
+	auto b_end = std::upper_bound(b.fingerprints.begin(), b.fingerprints.end(), threshold);
+	size_t smaller = std::min(a_end - a.fingerprints.begin(), b_end - b.fingerprints.begin());
+	if (smaller == 0)
+		return 0.0;
+
+	size_t shared = 0;
+	for (auto i = a.fingerprints.begin(), j = b.fingerprints.begin(); i != a_end && j != b_end;) {
+		if (*i < *j) {
+			++i;
+		}
+		else if (*j < *i) {
+			++j;
+		}
+		else {
+			shared++;
+			++i;
+			++j;
+		}
+	}
+	if (shared < MIN_SHARED && shared < smaller)
+		return 0.0;
+	return (double)shared / smaller;
+}
+
+struct UnionFind
+{
+	std::vector<uint32_t> parent;
+	// lowest similarity link inside each set, at its root
+	std::vector<double> similarity;
+
+	explicit UnionFind(size_t count) : parent(count), similarity(count, 1.0) {
+		for (size_t i = 0; i < count; ++i)
+			parent[i] = (uint32_t)i;
+	}
+
+	uint32_t find(uint32_t i) {
+		while (parent[i] != i) {
+			parent[i] = parent[parent[i]];
+			i = parent[i];
+		}
+		return i;
+	}
+
+	void join(uint32_t a, uint32_t b, double link) {
+		a = find(a);
+		b = find(b);
+		double lowest = std::min(link, std::min(similarity[a], similarity[b]));
+		if (a != b)
+			parent[b] = a;
+		similarity[a] = lowest;
+	}
+};
+
+static void cluster(const std::vector<Signature> &signatures, const Options &options, Report &report)
+{
+	size_t count = signatures.size();
+	UnionFind sets(count);
+
+	// same registers and length
+	std::unordered_map<uint64_t, uint32_t> exact;
+	for (uint32_t i = 0; i < count; ++i) {
+		if (!report.files[i].ok)
+			continue;
+		uint64_t key = signatures[i].register_hash ^ ((uint64_t)signatures[i].frame_count * ROLL_BASE);
+		auto inserted = exact.insert(std::make_pair(key, i));
+		if (!inserted.second)
+			sets.join(inserted.first->second, i, 1.0);
+	}
+
+	// tunes sharing a fingerprint are candidates, compared in full once.
+	// One flat sorted array, a map of vectors costs ten times the memory.
+	std::vector<std::pair<uint64_t, uint32_t>> postings;
+	size_t total = 0;
+	for (uint32_t i = 0; i < count; ++i)
+		total += signatures[i].fingerprints.size();
+	postings.reserve(total);
+	for (uint32_t i = 0; i < count; ++i) {
+		for (uint64_t fingerprint : signatures[i].fingerprints)
+			postings.push_back(std::make_pair(fingerprint, i));
+	}
+	std::sort(postings.begin(), postings.end());
+
+	std::unordered_set<uint64_t> compared;
+	for (size_t run = 0, end; run < postings.size(); run = end) {
+		for (end = run + 1; end < postings.size() && postings[end].first == postings[run].first; ++end)
+			;
+		if (end - run < 2 || end - run > MAX_POSTINGS)
+			continue;
+		for (size_t a = run; a < end; ++a) {
+			for (size_t b = a + 1; b < end; ++b) {
+				uint32_t first = postings[a].second;
+				uint32_t second = postings[b].second;
+				if (sets.find(first) == sets.find(second))
+					continue;
+				if (!compared.insert(((uint64_t)first << 32) | second).second)
+					continue;
+				double value = similarity(signatures[first], signatures[second]);
+				if (value >= options.min_similarity)
+					sets.join(first, second, value);
+			}
+		}
+	}
+	report.stats.candidate_pairs = compared.size();
+
+	std::unordered_map<uint32_t, uint32_t> cluster_of_root;
+	for (uint32_t i = 0; i < count; ++i) {
+		if (!report.files[i].ok)
+			continue;
+		uint32_t root = sets.find(i);
+		auto found = cluster_of_root.find(root);
+		if (found == cluster_of_root.end()) {
+			found = cluster_of_root.insert(std::make_pair(root, (uint32_t)report.clusters.size())).first;
+			Cluster cluster;
+			cluster.exact = true;
+			cluster.similarity = sets.similarity[root];
+			report.clusters.push_back(cluster);
+		}
+		report.clusters[found->second].files.push_back(i);
+	}
+
+	std::vector<Cluster> clusters;
+	for (Cluster &cluster : report.clusters) {
+		if (cluster.files.size() < 2)
+			continue;
+		std::sort(cluster.files.begin(), cluster.files.end(), [&](uint32_t a, uint32_t b) {
+			if (signatures[a].register_hash != signatures[b].register_hash)
+				return signatures[a].register_hash < signatures[b].register_hash;
+			return report.files[a].path < report.files[b].path;
+		});
+		for (uint32_t file : cluster.files) {
+			if (signatures[file].register_hash != signatures[cluster.files[0]].register_hash)
+				cluster.exact = false;
+		}
+		if (cluster.exact)
+			cluster.similarity = 1.0;
+		report.stats.duplicate_files += (uint32_t)cluster.files.size() - 1;
+		clusters.push_back(cluster);
+	}
+	std::sort(clusters.begin(), clusters.end(), [&](const Cluster &a, const Cluster &b) {
+		if (a.files.size() != b.files.size())
+			return a.files.size() > b.files.size();
+		return report.files[a.files[0]].path < report.files[b.files[0]].path;
+	});
+	report.clusters.swap(clusters);
+}
+
+void scan_directory(const char *dir, const Options &options, Report &report)
+{
+	auto start = std::chrono::steady_clock::now();
+	report.clusters.clear();
+	memset(&report.stats, 0, sizeof(ScanStats));
+
+	std::vector<std::string> paths;
+	fs::list_files(dir, ".ym", paths);
+	std::sort(paths.begin(), paths.end());
+
+	// only the signatures stay, every tune is freed by the job that decoded it
+	report.files.assign(paths.size(), FileResult());
+	std::vector<Signature> signatures(paths.size());
+
+	std::mutex stats_mutex;
+	{
+		ThreadPool pool(options.thread_count);
+		for (size_t i = 0; i < paths.size(); ++i) {
+			report.files[i].path = paths[i];
+			pool.submit([&, i] {
+				auto decode_start = std::chrono::steady_clock::now();
+				FileResult &file = report.files[i];
+				file.ok = false;
+
+				YMTune tune;
+				loader::LoadResult result = loader::load_tune(file.path.c_str(), tune);
+				if (result == loader::LOAD_OK) {
+					if (tune.header.frame_count > 0 && tune.data.registers) {
+						make_signature(tune, options.gram_frames, signatures[i]);
+						file.ok = true;
+						file.frame_count = signatures[i].frame_count;
+						file.register_hash = signatures[i].register_hash;
+					}
+					destroy_ym_tune(tune);
+				}
+				double decode_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - decode_start).count();
+
+				std::lock_guard<std::mutex> lock(stats_mutex);
+				report.stats.files++;
+				report.stats.decode_seconds += decode_seconds;
+				if (file.ok) {
+					report.stats.frames += file.frame_count;
+				}
+				else {
+					report.stats.failed++;
+					fprintf(stderr, "%s: %s\n", file.path.c_str(), result == loader::LOAD_OK ? "no register data" : loader::result_string(result));
+				}
+			});
+		}
+		pool.wait();
+	}
+
+	{
+		TRACE_SCOPE("dedup::cluster");
+		cluster(signatures, options, report);
+	}
+	report.stats.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
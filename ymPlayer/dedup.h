@@ -0,0 +1,92 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "ym.h"
+
+// Duplicate tune detection over processed register data, so copies under
+// other names, packing or header strings are found. Exact copies have the
+// same register stream. Near copies share register sequences: every tune
+// is reduced to winnowed rolling hashes over runs of gram_frames distinct
+// frames (repeated frames are collapsed first, so retimed copies that hold
+// frames longer still line up), of which the smallest MAX_FINGERPRINTS are
+// kept. Tunes whose fingerprints overlap enough end up in one cluster.
+namespace dedup
+{
+
+static const uint32_t DEFAULT_GRAM_FRAMES = 32;
+// one fingerprint per this many grams at least, from winnowing
+static const uint32_t WINNOW_WINDOW = 8;
+static const uint32_t MAX_FINGERPRINTS = 256;
+// fingerprints shared by more tunes than this say nothing, think silence
+static const uint32_t MAX_POSTINGS = 256;
+static const uint32_t MIN_SHARED = 4;
+static const double DEFAULT_SIMILARITY = 0.5;
+
+struct Options
+{
+	uint32_t thread_count;
+	uint32_t gram_frames;
+	// shared fingerprints over those of the smaller tune, so a trimmed copy
+	// still counts as contained in the full one
+	double min_similarity;
+};
+
+struct Signature
+{
+	uint64_t register_hash;
+	uint32_t frame_count;
+	uint32_t distinct_frames;
+	// fingerprints <= threshold were all kept, sorted
+	uint64_t threshold;
+	std::vector<uint64_t> fingerprints;
+};
+
+struct FileResult
+{
+	std::string path;
+	bool ok;
+	uint32_t frame_count;
+	uint64_t register_hash;
+};
+
+struct Cluster
+{
+	// file numbers, identical tunes next to each other
+	std::vector<uint32_t> files;
+	// every member has the same registers
+	bool exact;
+	// lowest similarity of the links that joined the near copies
+	double similarity;
+};
+
+struct ScanStats
+{
+	uint32_t files;
+	uint32_t failed;
+	uint64_t frames;
+	uint32_t duplicate_files;
+	uint64_t candidate_pairs;
+	double decode_seconds;
+	double wall_seconds;
+};
+
+struct Report
+{
+	std::vector<FileResult> files;
+	// largest first
+	std::vector<Cluster> clusters;
+	ScanStats stats;
+};
+
+void make_signature(const YMTune &tune, uint32_t gram_frames, Signature &signature);
+
+// fraction of the smaller tune's fingerprints found in the other one,
+// counted below the threshold both signatures are complete to
+double similarity(const Signature &a, const Signature &b);
+
+// decodes every .ym file under dir on a work stealing pool, keeping only
+// signatures, then clusters them
+void scan_directory(const char *dir, const Options &options, Report &report);
+
+}
@@ -0,0 +1,129 @@
+#include <math.h>
+#include <string.h>
+#include "digidrum.h"
+#include "pages.h"
+#include "psg.h"
+
+namespace digidrum
+{
+
+// MFP timer prescalers, selected by bits 5-7 of the effect's timer register
+static const uint32_t prescalers[8] = { 0, 4, 10, 16, 50, 64, 100, 200 };
+static const uint32_t DIGIDRUM_EFFECT = 1;
+
+// nearest YM2149 fixed volume for every 8 bit amplitude
+static void build_level_table(uint8_t table[256])
+{
+	for (uint32_t amplitude = 0; amplitude < 256; ++amplitude) {
+		float target = amplitude / 255.0f;
+		uint32_t best = 0;
+		float best_error = 2.0f;
+		for (uint32_t level = 0; level < 16; ++level) {
+			float error = fabsf(psg::fixed_volume(psg::CHIP_YM2149, level) - target);
+			if (error < best_error) {
+				best_error = error;
+				best = level;
+			}
+		}
+		table[amplitude] = (uint8_t)best;
+	}
+}
+
+char *read_samples(Stream &input, uint32_t count, uint32_t attributes, uint32_t &pool_size)
+{
+	pool_size = 0;
+	if (count == 0)
+		return nullptr;
+
+	// sizes first, so the pool is one allocation
+	char *start = input.ptr();
+	uint32_t available = input.remaining();
+	uint32_t header_size = (count + 1) * 4;
+	uint32_t total = 0;
+	uint32_t offset = 0;
+	for (uint32_t i = 0; i < count; ++i) {
+		if (available < offset + 4)
+			return nullptr;
+		uint32_t size = read_type_endian_swap<uint32_t>(start + offset);
+		if (size > available - offset - 4)
+			return nullptr;
+		offset += 4 + size;
+		total += size;
+	}
+
+	uint8_t levels[256];
+	if (!(attributes & YM_ATTRIBUTE_DRUM_4BIT))
+		build_level_table(levels);
+	uint8_t sign = (attributes & YM_ATTRIBUTE_DRUM_SIGNED) ? 0x80 : 0;
+
+	char *pool = pages::allocate(header_size + total);
+	uint32_t *offsets = (uint32_t*)pool;
+	uint8_t *dst = (uint8_t*)pool + header_size;
+	offsets[0] = header_size;
+	for (uint32_t i = 0; i < count; ++i) {
+		uint32_t size = input.read_type<uint32_t>();
+		const uint8_t *src = (const uint8_t*)input.ptr();
+		if (attributes & YM_ATTRIBUTE_DRUM_4BIT) {
+			for (uint32_t j = 0; j < size; ++j)
+				dst[j] = src[j] & 0x0f;
+		}
+		else {
+			for (uint32_t j = 0; j < size; ++j)
+				dst[j] = levels[src[j] ^ sign];
+		}
+		input.skip(size);
+		dst += size;
+		offsets[i + 1] = offsets[i] + size;
+	}
+	pool_size = header_size + total;
+	return pool;
+}
+
+bool is_valid_pool(const char *pool, uint32_t pool_size, uint32_t count)
+{
+	uint64_t header_size = ((uint64_t)count + 1) * 4;
+	if (!pool || header_size > pool_size)
+		return false;
+	const uint32_t *offsets = (const uint32_t*)pool;
+	if (offsets[0] != header_size || offsets[count] != pool_size)
+		return false;
+	for (uint32_t i = 0; i < count; ++i) {
+		if (offsets[i + 1] < offsets[i])
+			return false;
+	}
+	return true;
+}
+
+uint32_t get_triggers(const YMTune &tune, uint32_t frame, Trigger triggers[MAX_TRIGGERS])
+{
+	// YM4 and YM5 share the fixed slot layout
+	bool ym5 = memcmp(tune.version, "YM5", 3) == 0 || memcmp(tune.version, "YM4", 3) == 0;
+	bool ym6 = memcmp(tune.version, "YM6", 3) == 0;
+	if (!(ym5 || ym6) || !tune.data.digidrums || frame >= tune.header.frame_count)
+		return 0;
+
+	const uint8_t *regs = (const uint8_t*)tune.data.registers + frame * 16;
+	const uint8_t *special = (const uint8_t*)tune.data.special_registers + frame * 16;
+	// effect, timer prescaler and timer count register of each slot. YM5
+	// only has digidrums in the second slot.
+	static const uint8_t slots[2][3] = { { 1, 6, 14 }, { 3, 8, 15 } };
+	uint32_t count = 0;
+	for (uint32_t s = ym6 ? 0 : 1; s < 2; ++s) {
+		uint8_t effect = special[slots[s][0]];
+		uint32_t voice = (effect >> 4) & 3;
+		if (voice == 0 || (ym6 && (uint32_t)(effect >> 6) != DIGIDRUM_EFFECT))
+			continue;
+		uint32_t prescaler = prescalers[special[slots[s][1]] >> 5];
+		uint32_t timer_count = special[slots[s][2]];
+		if (prescaler == 0 || timer_count == 0)
+			continue;
+
+		Trigger &trigger = triggers[count++];
+		trigger.voice = voice - 1;
+		trigger.sample = regs[8 + voice - 1] & 0x1f;
+		trigger.rate = MFP_CLOCK / (prescaler * timer_count);
+	}
+	return count;
+}
+
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <stdint.h>
+#include "stream.h"
+#include "ym.h"
+
+// Digidrums of YM5 and YM6 tunes. The samples are pooled and converted to
+// 4 bit levels when the tune is loaded, the effect registers of a frame say
+// which one starts on which voice and at what rate.
+namespace digidrum
+{
+
+// the Atari ST MFP timer clock, drums are played from its timer interrupts
+static const uint32_t MFP_CLOCK = 2457600;
+static const uint32_t MAX_TRIGGERS = 2;
+
+struct Trigger
+{
+	// 0-2 for channel A-C
+	uint32_t voice;
+	uint32_t sample;
+	// levels a second
+	uint32_t rate;
+};
+
+// reads count samples (a big endian uint32 size, then the bytes) at input
+// into a pool as described at YMData::digidrums. Returns nullptr when the
+// samples run past the end of input.
+char *read_samples(Stream &input, uint32_t count, uint32_t attributes, uint32_t &pool_size);
+
+// checks the offset table of a pool against its size
+bool is_valid_pool(const char *pool, uint32_t pool_size, uint32_t count);
+
+// digidrums started by frame, returns how many
+uint32_t get_triggers(const YMTune &tune, uint32_t frame, Trigger triggers[MAX_TRIGGERS]);
+
+}
@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "fs.h"
+#include "pages.h"
+#include "trace.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace fs
+{
+
+bool read_file(const char *filename, char *&data, uint32_t &size)
+{
+	TRACE_SCOPE("fs::read_file");
+	FILE *file = fopen(filename, "rb");
+	if (!file)
+		return false;
+
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if (length < 0) {
+		fclose(file);
+		return false;
+	}
+
+	size = (uint32_t)length;
+	data = pages::allocate(size);
+	size_t read = fread(data, 1, size, file);
+	fclose(file);
+
+	if (read != size) {
+		pages::release(data);
+		data = nullptr;
+		return false;
+	}
+	return true;
+}
+
+bool stat_file(const char *filename, FileInfo &info)
+{
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesExA(filename, GetFileExInfoStandard, &attributes))
+		return false;
+	info.size = ((uint64_t)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+	info.mtime = ((uint64_t)attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+#else
+	struct stat st;
+	if (stat(filename, &st) != 0)
+		return false;
+	info.size = (uint64_t)st.st_size;
+	info.mtime = (uint64_t)st.st_mtime;
+#endif
+	return true;
+}
+
+bool make_directory(const char *dir)
+{
+#ifdef _WIN32
+	if (CreateDirectoryA(dir, nullptr))
+		return true;
+	DWORD attributes = GetFileAttributesA(dir);
+	return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+	if (mkdir(dir, 0777) == 0)
+		return true;
+	struct stat st;
+	return stat(dir, &st) == 0 && S_ISDIR(st.st_mode);
+#endif
+}
+
+bool map_file(const char *filename, MappedFile &file)
+{
+	memset(&file, 0, sizeof(MappedFile));
+#ifdef _WIN32
+	HANDLE handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(handle, &size);
+	if (size.QuadPart == 0) {
+		CloseHandle(handle);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	void *view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!view) {
+		if (mapping)
+			CloseHandle(mapping);
+		CloseHandle(handle);
+		return false;
+	}
+
+	file.handle = handle;
+	file.mapping = mapping;
+	file.data = (char*)view;
+	file.size = (uint64_t)size.QuadPart;
+#else
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+
+	void *view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (view == MAP_FAILED)
+		return false;
+
+	file.data = (char*)view;
+	file.size = (uint64_t)st.st_size;
+#endif
+	return true;
+}
+
+void unmap_file(MappedFile &file)
+{
+	if (!file.data)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(file.data);
+	CloseHandle(file.mapping);
+	CloseHandle(file.handle);
+#else
+	munmap(file.data, (size_t)file.size);
+#endif
+	memset(&file, 0, sizeof(MappedFile));
+}
+
+static bool has_extension(const char *name, const char *extension)
+{
+	if (!extension)
+		return true;
+
+	size_t name_length = strlen(name);
+	size_t ext_length = strlen(extension);
+	if (name_length < ext_length)
+		return false;
+
+	const char *tail = name + name_length - ext_length;
+	for (size_t i = 0; i < ext_length; ++i) {
+		if (tolower((unsigned char)tail[i]) != tolower((unsigned char)extension[i]))
+			return false;
+	}
+	return true;
+}
+
+void list_files(const char *dir, const char *extension, std::vector<std::string> &files)
+{
+#ifdef _WIN32
+	std::string pattern = join_path(dir, "*");
+	WIN32_FIND_DATAA find_data;
+	HANDLE find = FindFirstFileA(pattern.c_str(), &find_data);
+	if (find == INVALID_HANDLE_VALUE)
+		return;
+
+	do {
+		const char *name = find_data.cFileName;
+		if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+			continue;
+
+		std::string path = join_path(dir, name);
+		if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			list_files(path.c_str(), extension, files);
+		else if (has_extension(name, extension))
+			files.push_back(path);
+	} while (FindNextFileA(find, &find_data));
+
+	FindClose(find);
+#else
+	DIR *d = opendir(dir);
+	if (!d)
+		return;
+
+	while (struct dirent *entry = readdir(d)) {
+		const char *name = entry->d_name;
+		if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+			continue;
+
+		std::string path = join_path(dir, name);
+		struct stat st;
+		if (stat(path.c_str(), &st) != 0)
+			continue;
+
+		if (S_ISDIR(st.st_mode))
+			list_files(path.c_str(), extension, files);
+		else if (S_ISREG(st.st_mode) && has_extension(name, extension))
+			files.push_back(path);
+	}
+
+	closedir(d);
+#endif
+}
+
+std::string join_path(const std::string &dir, const std::string &name)
+{
+	if (dir.empty())
+		return name;
+
+	char last = dir[dir.size() - 1];
+	if (last == '/' || last == '\\')
+		return dir + name;
+	return dir + "/" + name;
+}
+
+std::string file_name(const std::string &path)
+{
+	size_t separator = path.find_last_of("/\\");
+	if (separator == std::string::npos)
+		return path;
+	return path.substr(separator + 1);
+}
+
+std::string replace_extension(const std::string &path, const char *extension)
+{
+	size_t separator = path.find_last_of("/\\");
+	size_t dot = path.find_last_of('.');
+	if (dot == std::string::npos || (separator != std::string::npos && dot < separator))
+		return path + extension;
+	return path.substr(0, dot) + extension;
+}
+
+}
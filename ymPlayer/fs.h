@@ -0,0 +1,41 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace fs
+{
+
+struct FileInfo
+{
+	uint64_t size;
+	uint64_t mtime;
+};
+
+// read only view of a whole file
+struct MappedFile
+{
+	void *handle;
+	void *mapping;
+	char *data;
+	uint64_t size;
+};
+
+// reads the whole file into a buffer from pages::allocate
+bool read_file(const char *filename, char *&data, uint32_t &size);
+bool stat_file(const char *filename, FileInfo &info);
+// creates dir unless it already exists, its parent must exist
+bool make_directory(const char *dir);
+
+bool map_file(const char *filename, MappedFile &file);
+void unmap_file(MappedFile &file);
+
+// recursively collects files under dir whose name ends with extension
+// (case insensitive), extension may be null to collect everything
+void list_files(const char *dir, const char *extension, std::vector<std::string> &files);
+
+std::string join_path(const std::string &dir, const std::string &name);
+std::string file_name(const std::string &path);
+std::string replace_extension(const std::string &path, const char *extension);
+
+}
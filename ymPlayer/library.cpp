@@ -0,0 +1,387 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include "library.h"
+#include "analysis.h"
+#include "loader.h"
+#include "lzh.h"
+#include "pages.h"
+#include "thread_pool.h"
+#include "ym.h"
+
+namespace library
+{
+
+static const uint32_t FIRST_PREFIX_SIZE = 4096;
+
+struct Record
+{
+	std::string path;
+	std::string name;
+	std::string author;
+	std::string description;
+	IndexEntry entry;
+	bool valid;
+	analysis::TuneStats stats;
+	bool analyzed;
+	double analyze_seconds;
+};
+
+static void fill_record(Record &record, const YMInfo &info)
+{
+	IndexEntry &entry = record.entry;
+	memcpy(entry.version, info.version, 4);
+	entry.attributes = info.header.attributes;
+	entry.frame_count = info.header.frame_count;
+	entry.loop_frame = info.header.loop_frame;
+	entry.clock = info.header.clock;
+	entry.frame_rate = info.header.frame_rate;
+	entry.digidrum_count = info.header.digidrum_count;
+	record.name = info.name;
+	record.author = info.author;
+	record.description = info.description;
+}
+
+// decodes the packed stream only until the header and strings are complete
+static bool parse_packed(char *data, uint32_t size, Record &record)
+{
+	lzh::LZHeader header;
+	if (!lzh::read_header(data, size, header)) {
+		lzh::free_header(header);
+		return false;
+	}
+
+	uint32_t total = header.decompressed_size;
+	uint32_t capacity = total < FIRST_PREFIX_SIZE ? total : FIRST_PREFIX_SIZE;
+	char *prefix = new char[capacity];
+	lzh::LZHContext *context = lzh::begin_decompress(header.compressed_data, header.compressed_size, total);
+	uint32_t decoded = lzh::decompress_next(context, prefix, capacity);
+
+	bool ok = false;
+	for (;;) {
+		YMInfo info;
+		YMInfoResult result = read_ym_info(prefix, decoded, total, info);
+		if (result == YM_INFO_OK) {
+			fill_record(record, info);
+			ok = true;
+			break;
+		}
+		if (result == YM_INFO_INVALID || decoded == total)
+			break;
+
+		uint32_t grown = capacity * 2 < total ? capacity * 2 : total;
+		char *larger = new char[grown];
+		memcpy(larger, prefix, decoded);
+		delete [] prefix;
+		prefix = larger;
+		capacity = grown;
+		decoded += lzh::decompress_next(context, prefix + decoded, capacity - decoded);
+	}
+
+	lzh::end_decompress(context);
+	delete [] prefix;
+	lzh::free_header(header);
+	return ok;
+}
+
+static bool parse_file(Record &record)
+{
+	char *data;
+	uint32_t size;
+	if (!fs::read_file(record.path.c_str(), data, size))
+		return false;
+
+	bool ok = false;
+	if (size >= 4 && is_ym_file(data)) {
+		YMInfo info;
+		if (read_ym_info(data, size, size, info) == YM_INFO_OK) {
+			fill_record(record, info);
+			ok = true;
+		}
+	}
+	else {
+		ok = parse_packed(data, size, record);
+	}
+
+	pages::release(data);
+	return ok;
+}
+
+// decodes the whole tune for the statistics, a new entry is filled from
+// the same unpacked data
+static bool parse_and_analyze(Record &record, bool fill)
+{
+	char *data;
+	uint32_t size;
+	if (!fs::read_file(record.path.c_str(), data, size))
+		return false;
+	if (loader::unpack(data, size) != loader::LOAD_OK || size < 4 || !is_ym_file(data)) {
+		pages::release(data);
+		return false;
+	}
+
+	if (fill) {
+		YMInfo info;
+		if (read_ym_info(data, size, size, info) != YM_INFO_OK) {
+			pages::release(data);
+			return false;
+		}
+		fill_record(record, info);
+	}
+
+	YMTune tune;
+	if (loader::create_tune(data, size, tune) != loader::LOAD_OK)
+		return true;
+	auto start = std::chrono::steady_clock::now();
+	analysis::analyze(tune, record.stats);
+	record.analyze_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	record.analyzed = true;
+	destroy_ym_tune(tune);
+	return true;
+}
+
+static bool write_stats(const char *filename, const std::vector<Record*> &records)
+{
+	FILE *file = fopen(filename, "w");
+	if (!file)
+		return false;
+	analysis::write_csv_header(file);
+	for (size_t i = 0; i < records.size(); ++i) {
+		if (records[i]->analyzed)
+			analysis::write_csv_row(file, records[i]->path.c_str(), records[i]->stats);
+	}
+	bool ok = ferror(file) == 0;
+	fclose(file);
+	return ok;
+}
+
+static int compare_no_case(const char *a, const char *b)
+{
+	for (;; ++a, ++b) {
+		int ca = tolower((unsigned char)*a);
+		int cb = tolower((unsigned char)*b);
+		if (ca != cb || ca == 0)
+			return ca - cb;
+	}
+}
+
+static bool contains_no_case(const char *text, const char *term, size_t term_length)
+{
+	if (term_length == 0)
+		return true;
+
+	int first = tolower((unsigned char)term[0]);
+	for (; *text; ++text) {
+		if (tolower((unsigned char)*text) != first)
+			continue;
+		size_t i = 1;
+		while (i < term_length && text[i] && tolower((unsigned char)text[i]) == tolower((unsigned char)term[i]))
+			++i;
+		if (i == term_length)
+			return true;
+	}
+	return false;
+}
+
+static bool write_index(const char *filename, std::vector<Record*> &records)
+{
+	std::sort(records.begin(), records.end(), [](const Record *a, const Record *b) {
+		return a->path < b->path;
+	});
+
+	// string table, identical strings (mostly authors) are stored once
+	std::string strings;
+	std::unordered_map<std::string, uint32_t> string_offsets;
+	auto add_string = [&](const std::string &str) -> uint32_t {
+		auto it = string_offsets.find(str);
+		if (it != string_offsets.end())
+			return it->second;
+		uint32_t offset = (uint32_t)strings.size();
+		strings.append(str.c_str(), str.size() + 1);
+		string_offsets[str] = offset;
+		return offset;
+	};
+
+	uint32_t count = (uint32_t)records.size();
+	std::vector<IndexEntry> entries(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		Record &record = *records[i];
+		entries[i] = record.entry;
+		entries[i].path = add_string(record.path);
+		entries[i].name = add_string(record.name);
+		entries[i].author = add_string(record.author);
+		entries[i].description = add_string(record.description);
+	}
+
+	std::vector<uint32_t> name_order(count);
+	for (uint32_t i = 0; i < count; ++i)
+		name_order[i] = i;
+	std::sort(name_order.begin(), name_order.end(), [&](uint32_t a, uint32_t b) {
+		return compare_no_case(records[a]->name.c_str(), records[b]->name.c_str()) < 0;
+	});
+
+	IndexHeader header = {};
+	memcpy(header.magic, "YMIX", 4);
+	header.version = INDEX_VERSION;
+	header.entry_count = count;
+	header.entries_offset = sizeof(IndexHeader);
+	header.name_order_offset = header.entries_offset + count * sizeof(IndexEntry);
+	header.strings_offset = header.name_order_offset + count * sizeof(uint32_t);
+	header.strings_size = (uint32_t)strings.size();
+
+	FILE *file = fopen(filename, "wb");
+	if (!file)
+		return false;
+	fwrite(&header, sizeof(IndexHeader), 1, file);
+	if (count > 0) {
+		fwrite(entries.data(), sizeof(IndexEntry), count, file);
+		fwrite(name_order.data(), sizeof(uint32_t), count, file);
+	}
+	fwrite(strings.data(), 1, strings.size(), file);
+	bool ok = ferror(file) == 0;
+	fclose(file);
+	return ok;
+}
+
+bool build(const char *dir, const char *index_filename, uint32_t thread_count, BuildStats &stats, const char *stats_filename)
+{
+	memset(&stats, 0, sizeof(BuildStats));
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::string> files;
+	fs::list_files(dir, ".ym", files);
+
+	Index previous;
+	bool have_previous = open(previous, index_filename);
+
+	std::vector<Record*> records;
+	records.reserve(files.size());
+	{
+		ThreadPool pool(thread_count);
+		for (size_t i = 0; i < files.size(); ++i) {
+			Record *record = new Record;
+			record->path = files[i];
+			record->valid = false;
+			record->analyzed = false;
+			record->analyze_seconds = 0.0;
+			memset(&record->entry, 0, sizeof(IndexEntry));
+			records.push_back(record);
+
+			fs::FileInfo info;
+			if (!fs::stat_file(files[i].c_str(), info))
+				continue;
+			record->entry.file_size = info.size;
+			record->entry.mtime = info.mtime;
+
+			const IndexEntry *old = have_previous ? find_path(previous, files[i].c_str()) : nullptr;
+			if (old && old->file_size == info.size && old->mtime == info.mtime) {
+				record->entry = *old;
+				record->name = get_string(previous, old->name);
+				record->author = get_string(previous, old->author);
+				record->description = get_string(previous, old->description);
+				record->valid = true;
+				stats.reused++;
+				if (stats_filename) {
+					pool.submit([record] {
+						parse_and_analyze(*record, false);
+					});
+				}
+				continue;
+			}
+
+			pool.submit([record, stats_filename] {
+				record->valid = stats_filename ? parse_and_analyze(*record, true) : parse_file(*record);
+			});
+		}
+		pool.wait();
+	}
+
+	if (have_previous)
+		close(previous);
+
+	std::vector<Record*> valid;
+	for (size_t i = 0; i < records.size(); ++i) {
+		if (records[i]->valid)
+			valid.push_back(records[i]);
+		else
+			stats.failed++;
+	}
+
+	bool ok = write_index(index_filename, valid);
+	if (stats_filename)
+		ok = write_stats(stats_filename, valid) && ok;
+	for (size_t i = 0; i < valid.size(); ++i) {
+		if (valid[i]->analyzed) {
+			stats.analyzed++;
+			stats.analyze_seconds += valid[i]->analyze_seconds;
+		}
+	}
+
+	for (size_t i = 0; i < records.size(); ++i)
+		delete records[i];
+
+	stats.files = (uint32_t)files.size();
+	stats.parsed = stats.files - stats.reused - stats.failed;
+	stats.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return ok;
+}
+
+bool open(Index &index, const char *filename)
+{
+	memset(&index, 0, sizeof(Index));
+	if (!fs::map_file(filename, index.file))
+		return false;
+
+	const char *data = index.file.data;
+	uint64_t size = index.file.size;
+	const IndexHeader *header = (const IndexHeader*)data;
+	if (size < sizeof(IndexHeader) || memcmp(header->magic, "YMIX", 4) != 0 || header->version != INDEX_VERSION ||
+		(uint64_t)header->strings_offset + header->strings_size > size) {
+		fs::unmap_file(index.file);
+		return false;
+	}
+
+	index.header = header;
+	index.entries = (const IndexEntry*)(data + header->entries_offset);
+	index.name_order = (const uint32_t*)(data + header->name_order_offset);
+	index.strings = data + header->strings_offset;
+	return true;
+}
+
+void close(Index &index)
+{
+	fs::unmap_file(index.file);
+	memset(&index, 0, sizeof(Index));
+}
+
+const IndexEntry *find_path(const Index &index, const char *path)
+{
+	const IndexEntry *first = index.entries;
+	const IndexEntry *last = index.entries + index.header->entry_count;
+	const IndexEntry *it = std::lower_bound(first, last, path, [&](const IndexEntry &entry, const char *key) {
+		return strcmp(get_string(index, entry.path), key) < 0;
+	});
+	if (it != last && strcmp(get_string(index, it->path), path) == 0)
+		return it;
+	return nullptr;
+}
+
+void search(const Index &index, const char *term, std::vector<uint32_t> &results)
+{
+	size_t term_length = strlen(term);
+	for (uint32_t i = 0; i < index.header->entry_count; ++i) {
+		uint32_t n = index.name_order[i];
+		const IndexEntry &entry = index.entries[n];
+		if (contains_no_case(get_string(index, entry.name), term, term_length) ||
+			contains_no_case(get_string(index, entry.author), term, term_length) ||
+			contains_no_case(get_string(index, entry.path), term, term_length)) {
+			results.push_back(n);
+		}
+	}
+}
+
+}
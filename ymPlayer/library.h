@@ -0,0 +1,86 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "fs.h"
+
+namespace library
+{
+
+// index file layout, native little endian so it can be used straight from
+// a mapping: IndexHeader, entries sorted by path, entry numbers sorted by
+// name (case insensitive), string table. String fields are offsets into
+// the string table.
+static const uint32_t INDEX_VERSION = 1;
+
+struct IndexHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t entry_count;
+	uint32_t entries_offset;
+	uint32_t name_order_offset;
+	uint32_t strings_offset;
+	uint32_t strings_size;
+	uint32_t reserved;
+};
+
+struct IndexEntry
+{
+	uint32_t path;
+	uint32_t name;
+	uint32_t author;
+	uint32_t description;
+	uint64_t file_size;
+	uint64_t mtime;
+	char version[4];
+	uint32_t attributes;
+	uint32_t frame_count;
+	uint32_t loop_frame;
+	uint32_t clock;
+	uint16_t frame_rate;
+	uint16_t digidrum_count;
+};
+
+struct Index
+{
+	fs::MappedFile file;
+	const IndexHeader *header;
+	const IndexEntry *entries;
+	const uint32_t *name_order;
+	const char *strings;
+};
+
+struct BuildStats
+{
+	uint32_t files;
+	uint32_t reused;
+	uint32_t parsed;
+	uint32_t failed;
+	uint32_t analyzed;
+	// time in analysis::analyze(), summed over the workers
+	double analyze_seconds;
+	double wall_seconds;
+};
+
+// indexes every .ym file under dir. Entries of an existing index whose
+// file size and mtime still match are reused, other files are decoded only
+// as far as the song strings. With stats_filename every tune is decoded in
+// full and analysis rows are written there too, from the same decode that
+// fills a new index entry.
+bool build(const char *dir, const char *index_filename, uint32_t thread_count, BuildStats &stats, const char *stats_filename = nullptr);
+
+bool open(Index &index, const char *filename);
+void close(Index &index);
+
+inline const char *get_string(const Index &index, uint32_t offset)
+{
+	return index.strings + offset;
+}
+
+const IndexEntry *find_path(const Index &index, const char *path);
+
+// case insensitive substring search over name, author and path, results
+// are entry numbers in name order
+void search(const Index &index, const char *term, std::vector<uint32_t> &results);
+
+}
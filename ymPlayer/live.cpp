@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "live.h"
+#include "control.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+namespace live
+{
+
+// how often a buffer waiting to fill up looks again
+static const uint64_t PRIME_POLL_US = 500;
+
+uint64_t monotonic_us()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#ifndef _WIN32
+
+struct Frame
+{
+	uint8_t regs[16];
+	uint64_t arrival_us;
+	uint64_t source_us;
+};
+
+struct Input
+{
+	int fd;
+	int listen_fd;
+	std::string socket_path;
+	const Options *options;
+	player::Clock *clock;
+
+	control::Ring<Frame, RING_SIZE> ring;
+	std::atomic<bool> done;
+	std::atomic<bool> stop;
+
+	// reader thread only, read after it has been joined
+	uint64_t frames_received;
+	uint64_t frames_dropped;
+	uint64_t bad_records;
+	uint64_t last_arrival_us;
+	double jitter_us;
+};
+
+static uint32_t popcount16(uint16_t mask)
+{
+	uint32_t count = 0;
+	for (; mask; mask &= mask - 1)
+		count++;
+	return count;
+}
+
+static uint64_t get_u64(const uint8_t *src)
+{
+	uint64_t val = 0;
+	for (int i = 7; i >= 0; --i)
+		val = (val << 8) | src[i];
+	return val;
+}
+
+static void push_frame(Input &input, const uint8_t *regs, uint64_t source_us)
+{
+	Frame frame;
+	memcpy(frame.regs, regs, 16);
+	frame.arrival_us = input.clock->now_us();
+	frame.source_us = source_us;
+
+	if (input.last_arrival_us) {
+		double period = 1000000.0 / input.options->frame_rate;
+		double deviation = (double)(frame.arrival_us - input.last_arrival_us) - period;
+		input.jitter_us += ((deviation < 0 ? -deviation : deviation) - input.jitter_us) / 16.0;
+	}
+	input.last_arrival_us = frame.arrival_us;
+
+	input.frames_received++;
+	if (!input.ring.push(frame))
+		input.frames_dropped++;
+}
+
+// consumes every complete record at the start of data, returns the bytes used
+static size_t parse(Input &input, uint8_t *state, const uint8_t *data, size_t size)
+{
+	size_t pos = 0;
+	if (input.options->format == FORMAT_RAW) {
+		for (; size - pos >= 16; pos += 16) {
+			memcpy(state, data + pos, 16);
+			push_frame(input, state, 0);
+		}
+		return pos;
+	}
+
+	while (pos < size) {
+		uint8_t type = data[pos];
+		if (type & ~(RECORD_DELTA | RECORD_TIMESTAMP)) {
+			// not a record start, skip ahead a byte at a time
+			input.bad_records++;
+			pos++;
+			continue;
+		}
+
+		size_t header = 1 + ((type & RECORD_TIMESTAMP) ? 8 : 0);
+		size_t length = header + 16;
+		uint16_t mask = 0;
+		if (type & RECORD_DELTA) {
+			if (size - pos < header + 2)
+				break;
+			mask = (uint16_t)(data[pos + header] | (data[pos + header + 1] << 8));
+			length = header + 2 + popcount16(mask);
+		}
+		if (size - pos < length)
+			break;
+
+		const uint8_t *record = data + pos;
+		uint64_t source_us = (type & RECORD_TIMESTAMP) ? get_u64(record + 1) : 0;
+		if (type & RECORD_DELTA) {
+			const uint8_t *values = record + header + 2;
+			for (uint32_t r = 0; r < 16; ++r) {
+				if (mask & (1 << r))
+					state[r] = *values++;
+			}
+		}
+		else {
+			memcpy(state, record + header, 16);
+		}
+		push_frame(input, state, source_us);
+		pos += length;
+	}
+	return pos;
+}
+
+// waits up to 100 ms for fd to become readable, so stop is noticed
+static bool wait_readable(int fd)
+{
+	pollfd p;
+	p.fd = fd;
+	p.events = POLLIN;
+	return poll(&p, 1, 100) > 0;
+}
+
+static void reader_main(Input &input)
+{
+	std::vector<uint8_t> pending;
+	uint8_t state[16] = {};
+	uint8_t buffer[4096];
+
+	while (!input.stop) {
+		if (input.fd < 0) {
+			// unix socket, wait for the next producer
+			if (!wait_readable(input.listen_fd))
+				continue;
+			input.fd = accept(input.listen_fd, nullptr, nullptr);
+			if (input.fd < 0)
+				continue;
+			pending.clear();
+			memset(state, 0, sizeof(state));
+			input.last_arrival_us = 0;
+		}
+
+		if (!wait_readable(input.fd))
+			continue;
+		ssize_t received = read(input.fd, buffer, sizeof(buffer));
+		if (received < 0 && errno == EINTR)
+			continue;
+		if (received <= 0) {
+			if (input.listen_fd < 0)
+				break;
+			::close(input.fd);
+			input.fd = -1;
+			continue;
+		}
+
+		pending.insert(pending.end(), buffer, buffer + received);
+		size_t used = parse(input, state, pending.data(), pending.size());
+		pending.erase(pending.begin(), pending.begin() + used);
+	}
+	input.done = true;
+}
+
+static bool open_input(Input &input, const char *source)
+{
+	input.fd = -1;
+	input.listen_fd = -1;
+
+	if (strcmp(source, "-") == 0) {
+		input.fd = 0;
+		return true;
+	}
+
+	if (strncmp(source, "unix:", 5) == 0) {
+		const char *path = source + 5;
+		sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (strlen(path) >= sizeof(address.sun_path))
+			return false;
+		strcpy(address.sun_path, path);
+
+		input.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (input.listen_fd < 0)
+			return false;
+		unlink(path);
+		if (bind(input.listen_fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(input.listen_fd, 1) != 0) {
+			::close(input.listen_fd);
+			input.listen_fd = -1;
+			return false;
+		}
+		input.socket_path = path;
+		return true;
+	}
+
+	// a FIFO blocks here until the producer opens it for writing
+	input.fd = open(source, O_RDONLY | O_CLOEXEC);
+	return input.fd >= 0;
+}
+
+static void close_input(Input &input)
+{
+	if (input.fd > 0)
+		::close(input.fd);
+	if (input.listen_fd >= 0) {
+		::close(input.listen_fd);
+		unlink(input.socket_path.c_str());
+	}
+}
+
+bool run(const char *source, const Options &options, sink::Sink &out, player::Clock &clock, const std::atomic<bool> &quit, Stats &stats)
+{
+	memset(&stats, 0, sizeof(Stats));
+	if (options.frame_rate == 0)
+		return false;
+
+	Input input;
+	input.options = &options;
+	input.clock = &clock;
+	input.done = false;
+	input.stop = false;
+	input.frames_received = 0;
+	input.frames_dropped = 0;
+	input.bad_records = 0;
+	input.last_arrival_us = 0;
+	input.jitter_us = 0.0;
+	if (!open_input(input, source))
+		return false;
+
+	std::thread reader(reader_main, std::ref(input));
+
+	uint32_t target = options.initial_depth < 1 ? 1 : (options.initial_depth > MAX_DEPTH ? MAX_DEPTH : options.initial_depth);
+	bool primed = false;
+	uint64_t start_us = 0;
+	uint64_t ticks = 0;
+	// sink time keeps counting across underruns
+	uint64_t stream_base_us = 0;
+	uint32_t window_min = RING_SIZE;
+	uint32_t window_count = 0;
+	uint64_t fill_total = 0;
+	uint64_t buffer_latency_total = 0;
+	uint64_t latency_total = 0;
+
+	while (!quit) {
+		if (!primed) {
+			bool finished = input.done;
+			uint32_t fill = input.ring.size();
+			if (fill == 0 && finished)
+				break;
+			if (fill < target && !finished) {
+				clock.sleep_until(clock.now_us() + PRIME_POLL_US);
+				continue;
+			}
+			primed = true;
+			start_us = clock.now_us();
+			stream_base_us += ticks * 1000000 / options.frame_rate;
+			ticks = 0;
+			window_min = RING_SIZE;
+			window_count = 0;
+		}
+
+		clock.sleep_until(start_us + ticks * 1000000 / options.frame_rate);
+
+		Frame frame;
+		if (!input.ring.pop(frame)) {
+			if (input.done) {
+				// the reader may have pushed its last frames since the pop
+				if (input.ring.size() == 0)
+					break;
+				continue;
+			}
+			// ran dry, buffer deeper from now on
+			stats.underruns++;
+			if (target < MAX_DEPTH)
+				target++;
+			primed = false;
+			continue;
+		}
+
+		sink::send_bytes(out, frame.regs, 16, stream_base_us + ticks * 1000000 / options.frame_rate);
+		uint64_t sent_us = clock.now_us();
+		stats.frames_sent++;
+		ticks++;
+
+		uint64_t buffer_latency = sent_us - frame.arrival_us;
+		buffer_latency_total += buffer_latency;
+		if (buffer_latency > stats.max_buffer_latency_us)
+			stats.max_buffer_latency_us = buffer_latency;
+		if (frame.source_us) {
+			uint64_t now = monotonic_us();
+			uint64_t latency = now > frame.source_us ? now - frame.source_us : 0;
+			latency_total += latency;
+			stats.timestamped_frames++;
+			if (latency > stats.max_latency_us)
+				stats.max_latency_us = latency;
+		}
+
+		uint32_t fill = input.ring.size();
+		fill_total += fill;
+		if (fill > stats.max_fill)
+			stats.max_fill = fill;
+		if (fill < window_min)
+			window_min = fill;
+
+		// a window that never got below one spare frame is latency for
+		// nothing, drop a frame and prime shallower next time
+		if (++window_count == ADAPT_WINDOW) {
+			if (window_min >= 1) {
+				Frame dropped;
+				if (input.ring.pop(dropped))
+					stats.frames_dropped++;
+				if (target > 1)
+					target--;
+			}
+			window_min = RING_SIZE;
+			window_count = 0;
+		}
+	}
+
+	input.stop = true;
+	reader.join();
+	close_input(input);
+
+	stats.frames_received = input.frames_received;
+	stats.frames_dropped += input.frames_dropped;
+	stats.bad_records = input.bad_records;
+	stats.jitter_us = input.jitter_us;
+	stats.target_depth = target;
+	if (stats.frames_sent) {
+		stats.average_fill = (double)fill_total / stats.frames_sent;
+		stats.average_buffer_latency_us = (double)buffer_latency_total / stats.frames_sent;
+	}
+	if (stats.timestamped_frames)
+		stats.average_latency_us = (double)latency_total / stats.timestamped_frames;
+	return true;
+}
+
+#else
+
+bool run(const char *, const Options &, sink::Sink &, player::Clock &, const std::atomic<bool> &, Stats &stats)
+{
+	// only POSIX inputs are implemented
+	memset(&stats, 0, sizeof(Stats));
+	return false;
+}
+
+#endif
+
+}
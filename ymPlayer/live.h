@@ -0,0 +1,72 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include "player.h"
+#include "sink.h"
+
+// Live register input: frames from an emulator or tracker are read from
+// stdin ("-"), a FIFO or file, or a unix socket ("unix:<path>", the player
+// listens and takes one connection at a time), and are sent on at a fixed
+// frame rate through a small adaptive jitter buffer.
+//
+// FORMAT_RAW is nothing but 16 byte register frames. FORMAT_TAGGED records
+// start with a type byte:
+//   bit 0  delta: a uint16 mask of changed registers follows, then one
+//          byte per set bit in register order, instead of all 16 registers
+//   bit 1  a uint64 CLOCK_MONOTONIC timestamp (us) of when the producer
+//          made the frame comes first, for end to end latency
+// All values little endian. Delta frames apply to the previous frame.
+namespace live
+{
+
+static const uint32_t RING_SIZE = 256;
+static const uint32_t MAX_DEPTH = 16;
+// frames in a row that must all leave a spare frame buffered before one is
+// dropped to cut latency
+static const uint32_t ADAPT_WINDOW = 250;
+
+static const uint8_t RECORD_DELTA = 0x01;
+static const uint8_t RECORD_TIMESTAMP = 0x02;
+
+enum InputFormat
+{
+	FORMAT_RAW,
+	FORMAT_TAGGED,
+};
+
+struct Options
+{
+	InputFormat format;
+	uint32_t frame_rate;
+	// frames buffered before playout starts, grows on underruns
+	uint32_t initial_depth;
+};
+
+struct Stats
+{
+	uint64_t frames_received;
+	uint64_t frames_sent;
+	uint64_t frames_dropped;	// thrown away to bring latency down or ring full
+	uint64_t underruns;
+	uint64_t bad_records;
+	uint32_t target_depth;
+	uint32_t max_fill;
+	double average_fill;
+	// arrival to send, and producer timestamp to send when the input has them
+	double average_buffer_latency_us;
+	uint64_t max_buffer_latency_us;
+	uint64_t timestamped_frames;
+	double average_latency_us;
+	uint64_t max_latency_us;
+	// interarrival jitter, smoothed like RFC 3550
+	double jitter_us;
+};
+
+// blocks until the input ends or quit is set. Returns false if the source
+// couldn't be opened.
+bool run(const char *source, const Options &options, sink::Sink &out, player::Clock &clock, const std::atomic<bool> &quit, Stats &stats);
+
+// CLOCK_MONOTONIC in microseconds, the time base of record timestamps
+uint64_t monotonic_us();
+
+}
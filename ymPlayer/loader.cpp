@@ -0,0 +1,73 @@
+#include <string.h>
+#include "loader.h"
+#include "lzh.h"
+#include "fs.h"
+#include "pages.h"
+
+namespace loader
+{
+
+LoadResult unpack(char *&data, uint32_t &size)
+{
+	if (size >= 4 && is_ym_file(data))
+		return LOAD_OK;
+
+	lzh::LZHeader header;
+	if (!lzh::read_header(data, size, header)) {
+		lzh::free_header(header);
+		return LOAD_LZH_HEADER_ERROR;
+	}
+
+	char *decompressed_data = pages::allocate(header.decompressed_size);
+	if (!lzh::decompress(header.compressed_data, header.compressed_size, decompressed_data, header.decompressed_size)) {
+		pages::release(decompressed_data);
+		lzh::free_header(header);
+		return LOAD_LZH_ERROR;
+	}
+
+	pages::release(data);
+	data = decompressed_data;
+	size = header.decompressed_size;
+	lzh::free_header(header);
+	return LOAD_OK;
+}
+
+LoadResult create_tune(char *data, uint32_t size, YMTune &tune)
+{
+	LoadResult result = unpack(data, size);
+	if (result == LOAD_OK && (size < 4 || !is_ym_file(data)))
+		result = LOAD_NOT_YM;
+
+	if (result == LOAD_OK && !create_ym_tune(data, size, tune))
+		result = memcmp(data, "YMC!", 4) == 0 ? LOAD_CACHE_ERROR : LOAD_BAD_TUNE;
+
+	// cache files are used in place and keep the buffer
+	if (result != LOAD_OK || tune.storage != data)
+		pages::release(data);
+	return result;
+}
+
+LoadResult load_tune(const char *filename, YMTune &tune)
+{
+	char *data;
+	uint32_t size;
+	if (!fs::read_file(filename, data, size))
+		return LOAD_FILE_ERROR;
+	return create_tune(data, size, tune);
+}
+
+const char *result_string(LoadResult result)
+{
+	switch (result) {
+		case LOAD_OK: return "ok";
+		case LOAD_FILE_ERROR: return "couldn't read file";
+		case LOAD_LZH_HEADER_ERROR: return "invalid lzh header";
+		case LOAD_LZH_ERROR: return "error while decompressing";
+		case LOAD_NOT_YM: return "not a valid YM format";
+		case LOAD_CACHE_ERROR: return "damaged or outdated YMC cache file";
+		case LOAD_BAD_TUNE: return "truncated or malformed tune";
+	}
+	return "unknown";
+}
+
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <stdint.h>
+#include "ym.h"
+
+namespace loader
+{
+
+enum LoadResult
+{
+	LOAD_OK,
+	LOAD_FILE_ERROR,
+	LOAD_LZH_HEADER_ERROR,
+	LOAD_LZH_ERROR,
+	LOAD_NOT_YM,
+	LOAD_CACHE_ERROR,
+	LOAD_BAD_TUNE,
+};
+
+// replaces data with the decompressed contents when it holds an lzh packed
+// tune, data must come from pages::allocate and is released on replace.
+LoadResult unpack(char *&data, uint32_t &size);
+
+// unpacks and creates the tune from a whole file image, takes over data
+// (from pages::allocate) which is released or kept by the tune as needed
+LoadResult create_tune(char *data, uint32_t size, YMTune &tune);
+
+// reads, unpacks and creates the tune without any output
+LoadResult load_tune(const char *filename, YMTune &tune);
+
+const char *result_string(LoadResult result);
+
+}
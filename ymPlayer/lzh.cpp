@@ -1,5 +1,9 @@
+#include <algorithm>
+#include <functional>
+#include <queue>
 #include "lzh.h"
 #include "stream.h"
+#include "trace.h"
 
 namespace lzh {
 
@@ -10,6 +14,10 @@ bool read_header(char* data, uint32_t size, LZHeader &header) {
 	Stream input(data, size);
 	memset(&header, 0, sizeof(LZHeader));
 
+	// fixed part of a level 0 header, up to and including the filename length
+	if (size < 22)
+		return false;
+
 	header.header_size = input.read_type<uint8_t>();
 	header.header_checksum = input.read_type<uint8_t>();
 	input.read_bytes(header.method, sizeof(header.method));
@@ -18,7 +26,16 @@ bool read_header(char* data, uint32_t size, LZHeader &header) {
 	header.timestamp = input.read_type<uint32_t>();
 	header.file_attrib = input.read_type<uint8_t>();
 	header.level = input.read_type<uint8_t>();
+
+	if (header.header_size == 0 || header.level != 0 || strncmp(header.method, lzh_method, sizeof(header.method)) != 0) {
+		return false;
+	}
+
 	uint8_t filename_length = input.read_type<uint8_t>();
+	if (24ULL + filename_length + header.compressed_size > size) {
+		return false;
+	}
+
 	header.filename = new char[filename_length + 1];
 	memset(header.filename, 0, filename_length+1);
 	input.read_bytes(header.filename, filename_length);
@@ -26,13 +43,17 @@ bool read_header(char* data, uint32_t size, LZHeader &header) {
 	header.compressed_data = new char[header.compressed_size];
 	input.read_bytes(header.compressed_data, header.compressed_size);
 
-	if (header.header_size == 0 || header.level != 0 || strcmp(header.method, lzh_method) != 0) {
-		return false;
-	}
-
 	return true;
 }
 
+void free_header(LZHeader &header)
+{
+	delete [] header.filename;
+	delete [] header.compressed_data;
+	header.filename = nullptr;
+	header.compressed_data = nullptr;
+}
+
 
 
 
@@ -104,6 +125,12 @@ struct LZHContext
 	uint16_t	left[2 * NC - 1];
 	uint16_t	right[2 * NC - 1];
 
+	// incremental decompression, bytes left to decode and the unread part
+	// of the last decoded window
+	uint32_t	remaining;
+	uint32_t	chunk_size;
+	uint32_t	chunk_offset;
+
 
 
 };
@@ -407,7 +434,7 @@ void decode(LZHContext &context, uint32_t size, uint8_t *buffer) {
 
 	while (--context.decode_j >= 0) {
 		buffer[r] = buffer[context.decode_i];
-		context.decode_i = (context.decode_i) & (DICSIZ - 1);
+		context.decode_i = (context.decode_i + 1) & (DICSIZ - 1);
 		if(++r == size)
 			return;
 	}
@@ -436,6 +463,7 @@ void decode(LZHContext &context, uint32_t size, uint8_t *buffer) {
 
 bool decompress(char *compressed, uint32_t compressed_size, char *decompressed, uint32_t decompressed_size)
 {
+	TRACE_SCOPE("lzh::decompress");
 	LZHContext context;
 	memset(&context, 0, sizeof(LZHContext));
 
@@ -461,5 +489,547 @@ bool decompress(char *compressed, uint32_t compressed_size, char *decompressed,
 	return true;
 }
 
+LZHContext *begin_decompress(char *compressed, uint32_t compressed_size, uint32_t decompressed_size)
+{
+	LZHContext *context = new LZHContext;
+	memset(context, 0, sizeof(LZHContext));
+
+	context->input.ptr = compressed;
+	context->input.size = compressed_size;
+	context->remaining = decompressed_size;
+
+	initialize(*context);
+	return context;
+}
+
+uint32_t decompress_next(LZHContext *context, char *decompressed, uint32_t size)
+{
+	uint32_t produced = 0;
+	while (produced < size) {
+		if (context->chunk_offset == context->chunk_size) {
+			if (context->remaining == 0)
+				break;
+
+			// the decoder works a whole window at a time
+			uint32_t n = (context->remaining > WINDOW_SIZE) ? WINDOW_SIZE : context->remaining;
+			decode(*context, n, context->decompress_buffer);
+			context->remaining -= n;
+			context->chunk_size = n;
+			context->chunk_offset = 0;
+		}
+
+		uint32_t available = context->chunk_size - context->chunk_offset;
+		uint32_t n = min(available, size - produced);
+		memcpy(decompressed + produced, context->decompress_buffer + context->chunk_offset, n);
+		context->chunk_offset += n;
+		produced += n;
+	}
+	return produced;
+}
+
+void end_decompress(LZHContext *context)
+{
+	delete context;
+}
+
+
+
+// -lh5- encoder. Tokens are collected per block, each block is sent with
+// its own huffman tables in the layout decode_c/decode_p read back.
+
+#define MAX_DISTANCE (DICSIZ - 1)
+#define HASH_BITS 15
+#define HASH_SIZE (1U << HASH_BITS)
+#define BLOCK_TOKENS 16384
+
+struct LZHToken
+{
+	uint16_t c;		// literal, or match length + 256 - THRESHOLD
+	uint16_t p;		// match distance - 1
+};
+
+struct LZHLevel
+{
+	uint32_t max_chain;
+	uint32_t nice_length;
+	bool lazy;
+};
+
+static const LZHLevel levels[] =
+{
+	{ 4, 16, false },
+	{ 8, 32, false },
+	{ 16, 64, false },
+	{ 16, 32, true },
+	{ 32, 64, true },
+	{ 64, 128, true },
+	{ 256, 256, true },
+	{ 1024, MAXMATCH, true },
+	{ 4096, MAXMATCH, true },
+};
+
+struct LZHEncoder
+{
+	std::vector<char> *output;
+	uint32_t bitbuf;
+	int bitcount;
 
-}
\ No newline at end of file
+	const uint8_t *data;
+	uint32_t size;
+	LZHLevel level;
+	int32_t head[HASH_SIZE];
+	int32_t prev[DICSIZ];
+
+	LZHToken tokens[BLOCK_TOKENS];
+	uint32_t token_count;
+
+	uint32_t c_freq[NC];
+	uint32_t p_freq[NP];
+	uint32_t t_freq[NT];
+	uint8_t c_len[NC];
+	uint16_t c_code[NC];
+	uint8_t pt_len[NPT];
+	uint16_t pt_code[NPT];
+};
+
+
+static void putbits(LZHEncoder &e, int n, uint32_t x)
+{
+	e.bitbuf = (e.bitbuf << n) | (x & ((1U << n) - 1));
+	e.bitcount += n;
+	while (e.bitcount >= 8) {
+		e.bitcount -= 8;
+		e.output->push_back((char)(e.bitbuf >> e.bitcount));
+	}
+	e.bitbuf &= (1U << e.bitcount) - 1;
+}
+
+static void flush_bits(LZHEncoder &e)
+{
+	if (e.bitcount > 0)
+		putbits(e, 8 - e.bitcount, 0);
+}
+
+// builds code lengths limited to CODE_BIT bits and the canonical codes that
+// make_table expects. Returns n when a tree was built, otherwise the only
+// used symbol (or 0) which is sent without a code.
+static int32_t make_tree(int32_t n, const uint32_t *freq, uint8_t *len, uint16_t *code)
+{
+	memset(len, 0, n);
+	memset(code, 0, n * sizeof(uint16_t));
+
+	std::vector<int32_t> leaves;
+	for (int32_t i = 0; i < n; ++i) {
+		if (freq[i] > 0)
+			leaves.push_back(i);
+	}
+	if (leaves.size() < 2)
+		return leaves.empty() ? 0 : leaves[0];
+
+	// plain huffman first, nodes [0, n) are leaves
+	std::vector<uint64_t> weight(2 * n);
+	std::vector<int32_t> parent(2 * n, -1);
+	typedef std::pair<uint64_t, int32_t> Node;
+	std::priority_queue<Node, std::vector<Node>, std::greater<Node> > heap;
+	for (size_t i = 0; i < leaves.size(); ++i) {
+		weight[leaves[i]] = freq[leaves[i]];
+		heap.push(Node(freq[leaves[i]], leaves[i]));
+	}
+	int32_t next = n;
+	while (heap.size() > 1) {
+		Node a = heap.top(); heap.pop();
+		Node b = heap.top(); heap.pop();
+		weight[next] = a.first + b.first;
+		parent[a.second] = next;
+		parent[b.second] = next;
+		heap.push(Node(weight[next], next));
+		next++;
+	}
+
+	uint32_t len_count[CODE_BIT + 1] = {};
+	std::vector<uint32_t> depth(n, 0);
+	for (size_t i = 0; i < leaves.size(); ++i) {
+		uint32_t d = 0;
+		for (int32_t node = leaves[i]; parent[node] >= 0; node = parent[node])
+			d++;
+		depth[leaves[i]] = d;
+		len_count[d > CODE_BIT ? CODE_BIT : d]++;
+	}
+
+	// clamping to CODE_BIT broke the kraft sum, move leaves down until it's
+	// exact again
+	uint32_t cum = 0;
+	for (int32_t i = CODE_BIT; i > 0; --i)
+		cum += len_count[i] << (CODE_BIT - i);
+	while (cum != (1U << CODE_BIT)) {
+		len_count[CODE_BIT]--;
+		for (int32_t i = CODE_BIT - 1; i > 0; --i) {
+			if (len_count[i] != 0) {
+				len_count[i]--;
+				len_count[i + 1] += 2;
+				break;
+			}
+		}
+		cum--;
+	}
+
+	// longest codes to the least frequent symbols
+	std::sort(leaves.begin(), leaves.end(), [&](int32_t a, int32_t b) {
+		if (freq[a] != freq[b])
+			return freq[a] < freq[b];
+		if (depth[a] != depth[b])
+			return depth[a] > depth[b];
+		return a < b;
+	});
+	size_t k = 0;
+	for (int32_t l = CODE_BIT; l > 0; --l) {
+		for (uint32_t j = 0; j < len_count[l]; ++j)
+			len[leaves[k++]] = (uint8_t)l;
+	}
+
+	uint16_t start[CODE_BIT + 2];
+	start[1] = 0;
+	for (int32_t i = 1; i <= CODE_BIT; ++i) {
+		uint32_t count = 0;
+		for (int32_t j = 0; j < n; ++j)
+			count += len[j] == i;
+		start[i + 1] = (uint16_t)((start[i] + count) << 1);
+	}
+	for (int32_t i = 0; i < n; ++i) {
+		if (len[i] > 0)
+			code[i] = start[len[i]]++;
+	}
+	return n;
+}
+
+static void count_t_freq(LZHEncoder &e)
+{
+	memset(e.t_freq, 0, sizeof(e.t_freq));
+	int32_t n = NC;
+	while (n > 0 && e.c_len[n - 1] == 0)
+		n--;
+
+	int32_t i = 0;
+	while (i < n) {
+		int32_t k = e.c_len[i++];
+		if (k == 0) {
+			int32_t count = 1;
+			while (i < n && e.c_len[i] == 0) {
+				i++;
+				count++;
+			}
+			if (count <= 2)
+				e.t_freq[0] += count;
+			else if (count <= 18)
+				e.t_freq[1]++;
+			else if (count == 19) {
+				e.t_freq[0]++;
+				e.t_freq[1]++;
+			}
+			else
+				e.t_freq[2]++;
+		}
+		else {
+			e.t_freq[k + 2]++;
+		}
+	}
+}
+
+static void write_pt_len(LZHEncoder &e, int32_t n, int32_t nbit, int32_t i_special)
+{
+	while (n > 0 && e.pt_len[n - 1] == 0)
+		n--;
+	putbits(e, nbit, n);
+
+	int32_t i = 0;
+	while (i < n) {
+		int32_t k = e.pt_len[i++];
+		if (k <= 6)
+			putbits(e, 3, k);
+		else
+			putbits(e, k - 3, (1U << (k - 3)) - 2);
+		if (i == i_special) {
+			while (i < 6 && e.pt_len[i] == 0)
+				i++;
+			putbits(e, 2, (i - 3) & 3);
+		}
+	}
+}
+
+static void write_c_len(LZHEncoder &e)
+{
+	int32_t n = NC;
+	while (n > 0 && e.c_len[n - 1] == 0)
+		n--;
+	putbits(e, CBIT, n);
+
+	int32_t i = 0;
+	while (i < n) {
+		int32_t k = e.c_len[i++];
+		if (k == 0) {
+			int32_t count = 1;
+			while (i < n && e.c_len[i] == 0) {
+				i++;
+				count++;
+			}
+			if (count <= 2) {
+				for (k = 0; k < count; k++)
+					putbits(e, e.pt_len[0], e.pt_code[0]);
+			}
+			else if (count <= 18) {
+				putbits(e, e.pt_len[1], e.pt_code[1]);
+				putbits(e, 4, count - 3);
+			}
+			else if (count == 19) {
+				putbits(e, e.pt_len[0], e.pt_code[0]);
+				putbits(e, e.pt_len[1], e.pt_code[1]);
+				putbits(e, 4, 15);
+			}
+			else {
+				putbits(e, e.pt_len[2], e.pt_code[2]);
+				putbits(e, CBIT, count - 20);
+			}
+		}
+		else {
+			putbits(e, e.pt_len[k + 2], e.pt_code[k + 2]);
+		}
+	}
+}
+
+static void encode_p(LZHEncoder &e, uint32_t p)
+{
+	uint32_t c = 0;
+	for (uint32_t q = p; q; q >>= 1)
+		c++;
+	putbits(e, e.pt_len[c], e.pt_code[c]);
+	if (c > 1)
+		putbits(e, c - 1, p & (0xffffU >> (17 - c)));
+}
+
+static void send_block(LZHEncoder &e)
+{
+	if (e.token_count == 0)
+		return;
+
+	memset(e.c_freq, 0, sizeof(e.c_freq));
+	memset(e.p_freq, 0, sizeof(e.p_freq));
+	for (uint32_t i = 0; i < e.token_count; ++i) {
+		const LZHToken &token = e.tokens[i];
+		e.c_freq[token.c]++;
+		if (token.c > UCHAR_MAX) {
+			uint32_t c = 0;
+			for (uint32_t q = token.p; q; q >>= 1)
+				c++;
+			e.p_freq[c]++;
+		}
+	}
+
+	putbits(e, 16, e.token_count);
+
+	int32_t root = make_tree(NC, e.c_freq, e.c_len, e.c_code);
+	if (root >= NC) {
+		count_t_freq(e);
+		root = make_tree(NT, e.t_freq, e.pt_len, e.pt_code);
+		if (root >= NT) {
+			write_pt_len(e, NT, TBIT, 3);
+		}
+		else {
+			putbits(e, TBIT, 0);
+			putbits(e, TBIT, root);
+		}
+		write_c_len(e);
+	}
+	else {
+		putbits(e, TBIT, 0);
+		putbits(e, TBIT, 0);
+		putbits(e, CBIT, 0);
+		putbits(e, CBIT, root);
+	}
+
+	root = make_tree(NP, e.p_freq, e.pt_len, e.pt_code);
+	if (root >= NP) {
+		write_pt_len(e, NP, PBIT, -1);
+	}
+	else {
+		putbits(e, PBIT, 0);
+		putbits(e, PBIT, root);
+	}
+
+	for (uint32_t i = 0; i < e.token_count; ++i) {
+		const LZHToken &token = e.tokens[i];
+		putbits(e, e.c_len[token.c], e.c_code[token.c]);
+		if (token.c > UCHAR_MAX)
+			encode_p(e, token.p);
+	}
+	e.token_count = 0;
+}
+
+static void add_token(LZHEncoder &e, uint16_t c, uint16_t p)
+{
+	e.tokens[e.token_count].c = c;
+	e.tokens[e.token_count].p = p;
+	if (++e.token_count == BLOCK_TOKENS)
+		send_block(e);
+}
+
+static inline uint32_t hash3(const uint8_t *p)
+{
+	return ((p[0] << 10) ^ (p[1] << 5) ^ p[2]) & (HASH_SIZE - 1);
+}
+
+static void insert_hash(LZHEncoder &e, uint32_t pos)
+{
+	if (pos + THRESHOLD > e.size)
+		return;
+	uint32_t h = hash3(e.data + pos);
+	e.prev[pos & (DICSIZ - 1)] = e.head[h];
+	e.head[h] = (int32_t)pos;
+}
+
+static uint32_t longest_match(LZHEncoder &e, uint32_t pos, uint32_t &distance)
+{
+	uint32_t max_length = min((uint32_t)MAXMATCH, e.size - pos);
+	if (max_length < THRESHOLD)
+		return 0;
+
+	const uint8_t *current = e.data + pos;
+	uint32_t best = THRESHOLD - 1;
+	uint32_t chain = e.level.max_chain;
+	int32_t candidate = e.head[hash3(current)];
+
+	while (candidate >= 0 && pos - candidate <= MAX_DISTANCE && chain-- > 0) {
+		const uint8_t *match = e.data + candidate;
+		if (match[best] == current[best] && match[0] == current[0]) {
+			uint32_t length = 1;
+			while (length < max_length && match[length] == current[length])
+				length++;
+			if (length > best) {
+				best = length;
+				distance = pos - candidate;
+				if (length >= e.level.nice_length || length == max_length)
+					break;
+			}
+		}
+
+		int32_t next = e.prev[candidate & (DICSIZ - 1)];
+		if (next >= candidate)
+			break;
+		candidate = next;
+	}
+	return best >= THRESHOLD ? best : 0;
+}
+
+static void encode(LZHEncoder &e)
+{
+	uint32_t pos = 0;
+	while (pos < e.size) {
+		uint32_t distance = 0;
+		uint32_t length = longest_match(e, pos, distance);
+		insert_hash(e, pos);
+
+		// lazy: prefer a literal if the next position has a longer match
+		if (e.level.lazy && length > 0 && length < e.level.nice_length && pos + 1 < e.size) {
+			uint32_t next_distance = 0;
+			uint32_t next_length = longest_match(e, pos + 1, next_distance);
+			if (next_length > length) {
+				add_token(e, e.data[pos], 0);
+				pos++;
+				continue;
+			}
+		}
+
+		if (length > 0) {
+			add_token(e, (uint16_t)(length + UCHAR_MAX + 1 - THRESHOLD), (uint16_t)(distance - 1));
+			for (uint32_t i = 1; i < length; ++i)
+				insert_hash(e, pos + i);
+			pos += length;
+		}
+		else {
+			add_token(e, e.data[pos], 0);
+			pos++;
+		}
+	}
+	send_block(e);
+	flush_bits(e);
+}
+
+static uint16_t crc16(const uint8_t *data, uint32_t size)
+{
+	uint16_t crc = 0;
+	for (uint32_t i = 0; i < size; ++i) {
+		crc ^= data[i];
+		for (int j = 0; j < 8; ++j)
+			crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+	}
+	return crc;
+}
+
+static void put_u16(std::vector<char> &out, uint16_t val)
+{
+	out.push_back((char)(val & 0xff));
+	out.push_back((char)(val >> 8));
+}
+
+static void put_u32(std::vector<char> &out, uint32_t val)
+{
+	put_u16(out, (uint16_t)(val & 0xffff));
+	put_u16(out, (uint16_t)(val >> 16));
+}
+
+bool compress(char *data, uint32_t size, std::vector<char> &compressed, int level)
+{
+	if (level < MIN_LEVEL || level > MAX_LEVEL)
+		return false;
+
+	LZHEncoder *e = new LZHEncoder;
+	e->output = &compressed;
+	e->bitbuf = 0;
+	e->bitcount = 0;
+	e->data = (const uint8_t*)data;
+	e->size = size;
+	e->level = levels[level - 1];
+	e->token_count = 0;
+	for (uint32_t i = 0; i < HASH_SIZE; ++i)
+		e->head[i] = -1;
+
+	encode(*e);
+	delete e;
+	return true;
+}
+
+bool pack(char *data, uint32_t size, const char *filename, uint32_t timestamp, int level, std::vector<char> &archive)
+{
+	size_t filename_length = strlen(filename);
+	if (filename_length > 255 - 22)
+		return false;
+
+	std::vector<char> compressed;
+	if (!compress(data, size, compressed, level))
+		return false;
+
+	archive.clear();
+	archive.push_back(0);	// header size, patched below
+	archive.push_back(0);	// header checksum
+	archive.insert(archive.end(), lzh_method, lzh_method + 5);
+	put_u32(archive, (uint32_t)compressed.size());
+	put_u32(archive, size);
+	put_u32(archive, timestamp);
+	archive.push_back(0x20);	// archive attribute
+	archive.push_back(0);	// level 0
+	archive.push_back((char)filename_length);
+	archive.insert(archive.end(), filename, filename + filename_length);
+	put_u16(archive, crc16((const uint8_t*)data, size));
+
+	uint8_t header_size = (uint8_t)(archive.size() - 2);
+	uint8_t checksum = 0;
+	for (size_t i = 2; i < archive.size(); ++i)
+		checksum += (uint8_t)archive[i];
+	archive[0] = (char)header_size;
+	archive[1] = (char)checksum;
+
+	archive.insert(archive.end(), compressed.begin(), compressed.end());
+	archive.push_back(0);	// end of archive
+	return true;
+}
+
+}
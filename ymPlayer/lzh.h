@@ -1,5 +1,6 @@
 #pragma once
 #include <stdint.h>
+#include <vector>
 
 namespace lzh {
 
@@ -19,7 +20,25 @@ struct LZHeader
 };
 
 bool read_header(char* data, uint32_t size, LZHeader &header);
+void free_header(LZHeader &header);
 bool decompress(char *compressed, uint32_t compressed_size, char *decompressed, uint32_t decompressed_size);
 
+// incremental decompression for callers that only need the start of the data
+struct LZHContext;
+LZHContext *begin_decompress(char *compressed, uint32_t compressed_size, uint32_t decompressed_size);
+uint32_t decompress_next(LZHContext *context, char *decompressed, uint32_t size);
+void end_decompress(LZHContext *context);
+
+// compression level trades speed for ratio, MIN_LEVEL is fastest
+static const int MIN_LEVEL = 1;
+static const int MAX_LEVEL = 9;
+static const int DEFAULT_LEVEL = 6;
+
+// raw -lh5- stream for data, appended to compressed
+bool compress(char *data, uint32_t size, std::vector<char> &compressed, int level);
+
+// single file archive with a level 0 header, timestamp is in ms-dos format
+bool pack(char *data, uint32_t size, const char *filename, uint32_t timestamp, int level, std::vector<char> &archive);
+
 
 }
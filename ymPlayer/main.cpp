@@ -1,14 +1,37 @@
+#ifdef _WIN32
 #include <windows.h>
+#include <conio.h>
+#else
+#include <signal.h>
+#endif
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
 #include <chrono>
-#include <conio.h>
 #include <string>
+#include <vector>
 
 #include "ym.h"
 #include "stream.h"
+#include "analysis.h"
+#include "batch.h"
+#include "control.h"
+#include "dedup.h"
+#include "fs.h"
+#include "library.h"
+#include "live.h"
+#include "loader.h"
 #include "lzh.h"
-#include "uart.h"
+#include "pages.h"
+#include "player.h"
+#include "sink.h"
+#include "status.h"
+#include "trace.h"
+#include "tune_cache.h"
+#include "ymc.h"
 
 
 void output(const char *format, ...)
@@ -20,54 +43,32 @@ void output(const char *format, ...)
 	vsprintf(buffer, format, args);
 	va_end(args);
 
+#ifdef _WIN32
 	if(IsDebuggerPresent())
 		OutputDebugStringA(buffer);
-	printf(buffer);
+#endif
+	printf("%s", buffer);
 }
 
-bool load_ym(const char * filename, YMTune &tune)
+bool load_ym(tune_cache::Cache &cache, const char * filename, tune_cache::Handle &handle)
 {
-	FILE *file = fopen(filename, "rb");
-	if(!file)
-		return false;
-
-	fseek(file, 0, SEEK_END);
-	DWORD size = ftell(file);
-	fseek(file, 0, SEEK_SET);
-	char *data = new char[size];
-	fread(data, 1, size, file);
-	fclose(file);
+	TRACE_SCOPE("load_ym");
+	auto start = std::chrono::steady_clock::now();
+	uint64_t faults = pages::fault_count();
+	bool hit;
+	loader::LoadResult result = cache.load(filename, handle, &hit);
+	faults = pages::fault_count() - faults;
 
 	printf("\n");
 
-	if (!is_ym_file(data)) {
-		output("compressed file, decompressing...");
-		lzh::LZHeader header;
-		if (!lzh::read_header(data, size, header)) {
-			output("Invalid lzh header\n");
-			return false;
-		}
-
-		char *decompressed_data = new char[header.decompressed_size];
-		if (lzh::decompress(header.compressed_data, header.compressed_size, decompressed_data, header.decompressed_size)) {
-			delete [] data;
-			data = decompressed_data;
-			size = header.decompressed_size;
-			output("done\n");
-		}
-		else {
-			output("Error while decompressing\n");
-			return false;
-		}
-	}
-
-	if (!is_ym_file(data)) {
-		output("Not a valid YM format!\n");
+	if (result != loader::LOAD_OK) {
+		output("%s\n", loader::result_string(result));
 		return false;
 	}
+	output("%s in %.2f ms, %llu page faults\n", hit ? "Cached" : "Loaded", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(),
+		(unsigned long long)faults);
 
-	tune = create_ym_tune(data, size);
-
+	const YMTune &tune = *handle;
 	output("File version: %s\n", tune.version);
 	output("Name: %s\n", tune.song_info.name);
 	output("Author: %s\n", tune.song_info.author);
@@ -82,6 +83,7 @@ bool load_ym(const char * filename, YMTune &tune)
 }
 
 
+#ifdef _WIN32
 std::string get_dropped_filename()
 {
 	std::string filename;
@@ -103,67 +105,442 @@ std::string get_dropped_filename()
 	}
 	return filename;
 }
+#endif
+
+// set by SIGINT/SIGTERM, the headless builds have no console to quit from
+static std::atomic<bool> quit_requested(false);
+
+#ifndef _WIN32
+static void on_quit_signal(int)
+{
+	quit_requested = true;
+}
+#endif
 
 
-struct SongState
+int render_command(int argc, char **argv)
 {
-	std::chrono::time_point<std::chrono::steady_clock> song_start;
-	uint32_t current_frame;
-	uint32_t frame_time_us;
-	bool is_playing;
+	if (argc < 2) {
+		output("usage: ymPlayer render <input dir> <output dir> [-threads n] [-rate hz] [-ay]\n");
+		return 1;
+	}
+
+	uint32_t thread_count = 0;
+	uint32_t sample_rate = 44100;
+	psg::ChipType chip_type = psg::CHIP_YM2149;
+	for (int i = 2; i < argc; ++i) {
+		if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc)
+			thread_count = strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(argv[i], "-rate") == 0 && i + 1 < argc)
+			sample_rate = strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(argv[i], "-ay") == 0)
+			chip_type = psg::CHIP_AY8910;
+	}
+
+	batch::RenderStats stats = batch::render_directory(argv[0], argv[1], chip_type, sample_rate, thread_count);
+	output("rendered %u files (%u failed) in %.2fs\n", stats.files - stats.failed, stats.failed, stats.wall_seconds);
+	if (stats.wall_seconds > 0.0) {
+		output("%.1f files/s, %.1f audio seconds per second\n", stats.files / stats.wall_seconds, stats.audio_seconds / stats.wall_seconds);
+	}
+	return stats.failed == 0 ? 0 : 1;
+}
+
+int index_command(int argc, char **argv)
+{
+	if (argc < 2) {
+		output("usage: ymPlayer index <dir> <index file> [-threads n] [-stats <file.csv>]\n");
+		return 1;
+	}
+
+	uint32_t thread_count = 0;
+	const char *stats_filename = nullptr;
+	for (int i = 2; i < argc; ++i) {
+		if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc)
+			thread_count = strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(argv[i], "-stats") == 0 && i + 1 < argc)
+			stats_filename = argv[++i];
+	}
+
+	library::BuildStats stats;
+	bool ok = library::build(argv[0], argv[1], thread_count, stats, stats_filename);
+	output("indexed %u files (%u reused, %u parsed, %u failed) in %.3fs\n", stats.files - stats.failed, stats.reused, stats.parsed, stats.failed, stats.wall_seconds);
+	if (stats_filename)
+		output("analyzed %u tunes, %.3fs of analysis\n", stats.analyzed, stats.analyze_seconds);
+	return ok ? 0 : 1;
+}
+
+int stats_command(int argc, char **argv)
+{
+	if (argc < 2) {
+		output("usage: ymPlayer stats <dir> <file.csv> [-threads n]\n");
+		return 1;
+	}
+
+	uint32_t thread_count = 0;
+	for (int i = 2; i < argc; ++i) {
+		if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc)
+			thread_count = strtoul(argv[++i], nullptr, 10);
+	}
+
+	analysis::BatchStats stats;
+	if (!analysis::analyze_directory(argv[0], argv[1], thread_count, stats)) {
+		output("couldn't write %s\n", argv[1]);
+		return 1;
+	}
+	output("analyzed %u files (%u failed, %u with issues) in %.2fs\n", stats.files - stats.failed, stats.failed, stats.with_issues, stats.wall_seconds);
+	if (stats.analyze_seconds > 0.0)
+		output("analysis %.3fs, %.1f M frames/s per thread\n", stats.analyze_seconds, stats.frames / stats.analyze_seconds / 1e6);
+	return stats.failed == 0 ? 0 : 1;
+}
+
+int search_command(int argc, char **argv)
+{
+	if (argc < 2) {
+		output("usage: ymPlayer search <index file> <term>\n");
+		return 1;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	library::Index index;
+	if (!library::open(index, argv[0])) {
+		output("couldn't open index %s\n", argv[0]);
+		return 1;
+	}
+
+	std::vector<uint32_t> results;
+	library::search(index, argv[1], results);
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	for (size_t i = 0; i < results.size(); ++i) {
+		const library::IndexEntry &entry = index.entries[results[i]];
+		output("%s - %s (%.4s, %us)\n", library::get_string(index, entry.name), library::get_string(index, entry.author),
+			entry.version, entry.frame_rate ? entry.frame_count / entry.frame_rate : 0);
+		output("    %s\n", library::get_string(index, entry.path));
+	}
+	output("%u of %u tunes in %.3f ms\n", (uint32_t)results.size(), index.header->entry_count,
+		std::chrono::duration<double, std::milli>(elapsed).count());
+
+	library::close(index);
+	return 0;
+}
+
+int convert_command(int argc, char **argv)
+{
+	if (argc < 2) {
+		output("usage: ymPlayer convert <file.ym> <file.ymc> [-pack]\n");
+		return 1;
+	}
+
+	bool pack = argc > 2 && strcmp(argv[2], "-pack") == 0;
+
 	YMTune tune;
-};
+	loader::LoadResult result = loader::load_tune(argv[0], tune);
+	if (result != loader::LOAD_OK) {
+		output("%s: %s\n", argv[0], loader::result_string(result));
+		return 1;
+	}
+
+	bool ok = ymc::write(tune, argv[1], pack);
+	destroy_ym_tune(tune);
+	if (!ok) {
+		output("couldn't write %s\n", argv[1]);
+		return 1;
+	}
+	return 0;
+}
+
+int pack_command(int argc, char **argv)
+{
+	if (argc < 2) {
+		output("usage: ymPlayer pack <input dir> <output dir> [-level 1-9] [-threads n]\n");
+		return 1;
+	}
 
+	int level = lzh::DEFAULT_LEVEL;
+	uint32_t thread_count = 0;
+	for (int i = 2; i < argc; ++i) {
+		if (strcmp(argv[i], "-level") == 0 && i + 1 < argc)
+			level = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc)
+			thread_count = strtoul(argv[++i], nullptr, 10);
+	}
+	if (level < lzh::MIN_LEVEL || level > lzh::MAX_LEVEL) {
+		output("level must be %d to %d\n", lzh::MIN_LEVEL, lzh::MAX_LEVEL);
+		return 1;
+	}
 
-SongState play_song(YMTune &tune) {
-	SongState state;
-	state.song_start = std::chrono::steady_clock::now();
-	state.current_frame = 0;
-	state.frame_time_us = 1000000U / tune.header.frame_rate;
-	state.is_playing = true;
-	state.tune = tune;
-	return state;
+	batch::PackStats stats = batch::pack_directory(argv[0], argv[1], level, thread_count);
+	output("packed %u files (%u failed) in %.2fs, %llu -> %llu bytes\n", stats.files - stats.failed, stats.failed, stats.wall_seconds,
+		(unsigned long long)stats.input_bytes, (unsigned long long)stats.output_bytes);
+	return stats.failed == 0 ? 0 : 1;
+}
+
+int dups_command(int argc, char **argv)
+{
+	if (argc < 1) {
+		output("usage: ymPlayer dups <dir> [-threads n] [-gram frames] [-similarity 0-1]\n");
+		return 1;
+	}
+
+	dedup::Options options = { 0, dedup::DEFAULT_GRAM_FRAMES, dedup::DEFAULT_SIMILARITY };
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc)
+			options.thread_count = strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(argv[i], "-gram") == 0 && i + 1 < argc)
+			options.gram_frames = strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(argv[i], "-similarity") == 0 && i + 1 < argc)
+			options.min_similarity = atof(argv[++i]);
+	}
+
+	dedup::Report report;
+	dedup::scan_directory(argv[0], options, report);
+
+	for (size_t c = 0; c < report.clusters.size(); ++c) {
+		const dedup::Cluster &cluster = report.clusters[c];
+		if (cluster.exact)
+			output("cluster %u: %u tunes, identical registers\n", (uint32_t)c + 1, (uint32_t)cluster.files.size());
+		else
+			output("cluster %u: %u tunes, similar, at least %.0f%% shared\n", (uint32_t)c + 1, (uint32_t)cluster.files.size(), cluster.similarity * 100.0);
+		for (size_t i = 0; i < cluster.files.size(); ++i) {
+			const dedup::FileResult &file = report.files[cluster.files[i]];
+			// = marks a tune with the same registers as the one above
+			bool same = i > 0 && file.register_hash == report.files[cluster.files[i - 1]].register_hash;
+			output("  %c %s (%u frames)\n", same ? '=' : ' ', file.path.c_str(), file.frame_count);
+		}
+	}
+
+	const dedup::ScanStats &stats = report.stats;
+	output("%u files (%u failed), %u duplicates in %u clusters, %llu pairs compared\n", stats.files, stats.failed, stats.duplicate_files,
+		(uint32_t)report.clusters.size(), (unsigned long long)stats.candidate_pairs);
+	output("%.2fs, %.1f files/s, %.1f M frames/s decoding per thread\n", stats.wall_seconds, stats.wall_seconds > 0.0 ? stats.files / stats.wall_seconds : 0.0,
+		stats.decode_seconds > 0.0 ? stats.frames / stats.decode_seconds / 1e6 : 0.0);
+	return stats.failed == 0 ? 0 : 1;
+}
+
+#ifdef _WIN32
+static const char *const DEFAULT_PORT = "com3";
+#else
+static const char *const DEFAULT_PORT = "/dev/ttyUSB0";
+#endif
+
+// how often an idle player looks for control commands
+static const uint64_t IDLE_POLL_US = 10000;
+
+void print_usage()
+{
+	output("usage: ymPlayer [options] [file.ym]\n");
+	output("       ymPlayer render <input dir> <output dir> [-threads n] [-rate hz] [-ay]\n");
+	output("       ymPlayer index <dir> <index file> [-threads n] [-stats <file.csv>]\n");
+	output("       ymPlayer search <index file> <term>\n");
+	output("       ymPlayer convert <file.ym> <file.ymc> [-pack]\n");
+	output("       ymPlayer pack <input dir> <output dir> [-level 1-9] [-threads n]\n");
+	output("       ymPlayer stats <dir> <file.csv> [-threads n]\n");
+	output("       ymPlayer dups <dir> [-threads n] [-gram frames] [-similarity 0-1]\n");
+	output("  -port <name>       serial port to play on (default %s)\n", DEFAULT_PORT);
+	output("  -null              discard output, for measuring the pipeline\n");
+	output("  -capture <file>    write sent frames to a capture file\n");
+	output("  -wav <file>        render with the built in synth to a wav file\n");
+	output("  -ay                synth emulates an AY-3-8910 instead of a YM2149\n");
+	output("  -frames <count>    quit after sending count frames\n");
+	output("  -fast              don't wait for the frame clock\n");
+	output("  -trace <file>      write a chrome trace of loading and playback (YM_TRACE builds)\n");
+	output("  -cache-mb <n>      memory for decoded tunes kept for replaying (default %u)\n", (uint32_t)(tune_cache::DEFAULT_BUDGET >> 20));
+	output("  -lock              lock decoded tunes in memory so playback never page faults\n");
+	output("  -control [socket]  accept commands on a unix socket (default %s), see ymctl\n", control::DEFAULT_SOCKET_PATH);
+	output("  -live <source>     forward a live register stream from - (stdin), a FIFO or unix:<socket>\n");
+	output("  -live-raw          live input is bare 16 byte frames instead of tagged records\n");
+	output("  -live-rate <hz>    live frame rate (default 50)\n");
+	output("  -live-depth <n>    frames buffered before live playout starts (default 2)\n");
 }
 
 int main(int argc, char **argv)
 {
-	YMTune tune;
+	if (argc > 1 && strcmp(argv[1], "render") == 0)
+		return render_command(argc - 2, argv + 2);
+	if (argc > 1 && strcmp(argv[1], "index") == 0)
+		return index_command(argc - 2, argv + 2);
+	if (argc > 1 && strcmp(argv[1], "search") == 0)
+		return search_command(argc - 2, argv + 2);
+	if (argc > 1 && strcmp(argv[1], "convert") == 0)
+		return convert_command(argc - 2, argv + 2);
+	if (argc > 1 && strcmp(argv[1], "pack") == 0)
+		return pack_command(argc - 2, argv + 2);
+	if (argc > 1 && strcmp(argv[1], "stats") == 0)
+		return stats_command(argc - 2, argv + 2);
+	if (argc > 1 && strcmp(argv[1], "dups") == 0)
+		return dups_command(argc - 2, argv + 2);
+
+	tune_cache::Handle tune;
 	bool have_tune = false;
+	uint64_t cache_budget = tune_cache::DEFAULT_BUDGET;
+
+	const char *port = DEFAULT_PORT;
+	const char *capture_filename = nullptr;
+	const char *wav_filename = nullptr;
+	psg::ChipType chip_type = psg::CHIP_YM2149;
+	const char *tune_filename = nullptr;
+	const char *trace_filename = nullptr;
+	const char *control_socket = nullptr;
+	const char *live_source = nullptr;
+	live::Options live_options = { live::FORMAT_TAGGED, 50, 2 };
+	bool null_sink = false;
+	bool fast = false;
+	bool lock_tunes = false;
+	uint32_t max_frames = 0;
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-port") == 0 && i + 1 < argc) {
+			port = argv[++i];
+		}
+		else if (strcmp(argv[i], "-capture") == 0 && i + 1 < argc) {
+			capture_filename = argv[++i];
+		}
+		else if (strcmp(argv[i], "-wav") == 0 && i + 1 < argc) {
+			wav_filename = argv[++i];
+		}
+		else if (strcmp(argv[i], "-ay") == 0) {
+			chip_type = psg::CHIP_AY8910;
+		}
+		else if (strcmp(argv[i], "-frames") == 0 && i + 1 < argc) {
+			max_frames = strtoul(argv[++i], nullptr, 10);
+		}
+		else if (strcmp(argv[i], "-null") == 0) {
+			null_sink = true;
+		}
+		else if (strcmp(argv[i], "-fast") == 0) {
+			fast = true;
+		}
+		else if (strcmp(argv[i], "-trace") == 0 && i + 1 < argc) {
+			trace_filename = argv[++i];
+		}
+		else if (strcmp(argv[i], "-live") == 0 && i + 1 < argc) {
+			live_source = argv[++i];
+		}
+		else if (strcmp(argv[i], "-live-raw") == 0) {
+			live_options.format = live::FORMAT_RAW;
+		}
+		else if (strcmp(argv[i], "-live-rate") == 0 && i + 1 < argc) {
+			live_options.frame_rate = strtoul(argv[++i], nullptr, 10);
+		}
+		else if (strcmp(argv[i], "-live-depth") == 0 && i + 1 < argc) {
+			live_options.initial_depth = strtoul(argv[++i], nullptr, 10);
+		}
+		else if (strcmp(argv[i], "-cache-mb") == 0 && i + 1 < argc) {
+			cache_budget = strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
+		}
+		else if (strcmp(argv[i], "-lock") == 0) {
+			lock_tunes = true;
+		}
+		else if (strcmp(argv[i], "-control") == 0) {
+			control_socket = (i + 1 < argc && argv[i + 1][0] != '-') ? argv[++i] : control::DEFAULT_SOCKET_PATH;
+		}
+		else if (argv[i][0] == '-') {
+			print_usage();
+			return 0;
+		}
+		else {
+			tune_filename = argv[i];
+		}
+	}
+
+	if (trace_filename) {
+		trace::set_enabled(true);
+		trace::set_thread_name("main");
+	}
 
-	if (argc > 1) {
-		have_tune = load_ym(argv[1], tune);
+	tune_cache::Cache cache(cache_budget);
+	cache.set_locked(lock_tunes);
+	if (tune_filename) {
+		have_tune = load_ym(cache, tune_filename, tune);
+#ifndef _WIN32
+		// without a control socket nothing could start another tune, only
+		// the windows console takes dropped files
+		if (!have_tune && !control_socket && !live_source)
+			return 1;
+#endif
 	}
 
-	void *comm_handle = uart::open("com3", 57600);
-	if (comm_handle == (void*)-1) {
+	sink::Sink out;
+	if (null_sink) {
+		sink::open_null(out);
+	}
+	else if (capture_filename) {
+		if (!sink::open_capture(out, capture_filename)) {
+			output("couldn't open capture file %s\n", capture_filename);
+			return 0;
+		}
+	}
+	else if (wav_filename) {
+		uint32_t clock = (have_tune && tune->header.clock) ? tune->header.clock : 2000000;
+		if (!sink::open_synth(out, wav_filename, chip_type, clock, 44100)) {
+			output("couldn't open wav file %s\n", wav_filename);
+			return 0;
+		}
+	}
+	else if (!sink::open_uart(out, port, 57600)) {
 		output("couldn't open com port for serial communincation\n");
 		return 0;
 	}
 
+#ifndef _WIN32
+	signal(SIGINT, on_quit_signal);
+	signal(SIGTERM, on_quit_signal);
+#endif
+
+	if (live_source) {
+		player::SystemClock clock;
+		live::Stats stats;
+		bool ok = live::run(live_source, live_options, out, clock, quit_requested, stats);
+		sink::close(out);
+		if (!ok) {
+			output("couldn't open live input %s\n", live_source);
+			return 1;
+		}
+		output("live: %llu frames received, %llu sent, %llu dropped, %llu underruns, %llu bad records\n",
+			(unsigned long long)stats.frames_received, (unsigned long long)stats.frames_sent, (unsigned long long)stats.frames_dropped,
+			(unsigned long long)stats.underruns, (unsigned long long)stats.bad_records);
+		output("buffer: depth %u, fill avg %.2f max %u, jitter %.0f us\n", stats.target_depth, stats.average_fill, stats.max_fill, stats.jitter_us);
+		output("latency: buffered avg %.0f us max %llu us", stats.average_buffer_latency_us, (unsigned long long)stats.max_buffer_latency_us);
+		if (stats.timestamped_frames)
+			output(", end to end avg %.0f us max %llu us", stats.average_latency_us, (unsigned long long)stats.max_latency_us);
+		output("\n");
+		return 0;
+	}
+
+	control::Server control_server(cache);
+	if (control_socket && !control_server.start(control_socket)) {
+		output("couldn't open control socket %s\n", control_socket);
+		sink::close(out);
+		return 0;
+	}
+
+#ifdef _WIN32
 	int last_esc_state = GetKeyState(VK_ESCAPE);
-	HANDLE out_handle = GetStdHandle(STD_OUTPUT_HANDLE);
-	CONSOLE_SCREEN_BUFFER_INFO screen_buffer_info;
-	GetConsoleScreenBufferInfo(out_handle, &screen_buffer_info);
-	COORD cursor_coords = screen_buffer_info.dwCursorPosition;
+#endif
 
-	SongState current_song = {};
+	player::SystemClock clock;
+	player::Player player;
+	player::init(player, &clock, &out);
 	if (have_tune) {
-		current_song = play_song(tune);
+		control_server.play(player, tune_filename, tune);
+	}
+	else {
+		player::stop(player);
 	}
 
-	// clear registers
-	uint8_t stop_byte = 0;
-	for (int j = 0; j < 16; ++j)
-		uart::send_byte(comm_handle, stop_byte);
+	int64_t work_time_us = 0;
 
+	// painted from its own thread, the loop only publishes snapshots
+	status::Renderer status_renderer;
+	status_renderer.start();
+	uint64_t start_faults = pages::fault_count();
 
-	static char print_buffer[255];
-	int bytes_sent = 0;
 	bool quit = false;
 	do 
 	{
-		auto frame_start = std::chrono::steady_clock::now();
+		uint64_t frame_start = clock.now_us();
 		
+#ifdef _WIN32
 		// exit on double esc
 		int esc_state = GetKeyState(VK_ESCAPE);
 		if (esc_state == 0 && esc_state != last_esc_state)
@@ -173,53 +550,78 @@ int main(int argc, char **argv)
 
 		std::string new_song_filename = get_dropped_filename();
 		if (!new_song_filename.empty()) {
-			YMTune new_tune;
-			if (load_ym(new_song_filename.c_str(), new_tune)) {
-				current_song = play_song(new_tune);
-
-				printf("\n");
-
-				CONSOLE_SCREEN_BUFFER_INFO screen_buffer_info;
-				GetConsoleScreenBufferInfo(out_handle, &screen_buffer_info);
-				cursor_coords = screen_buffer_info.dwCursorPosition;
-				bytes_sent = 0;
-
-				// clear registers
-				for (int j = 0; j < 16; ++j)
-					uart::send_byte(comm_handle, stop_byte);
-
+			tune_cache::Handle new_tune;
+			status_renderer.stop();
+			if (load_ym(cache, new_song_filename.c_str(), new_tune)) {
+				control_server.play(player, new_song_filename.c_str(), new_tune);
+				tune = new_tune;
 			}
+			status_renderer.start();
 		}
+#endif
+		if (quit_requested)
+			quit = true;
 
-		
-		if (current_song.is_playing) {
-			int bytes = uart::send_bytes(comm_handle, (uint8_t*)&current_song.tune.data.registers[current_song.current_frame * 16], 16);
-			bytes_sent += bytes;
-			auto song_time = std::chrono::steady_clock::now() - current_song.song_start;
-			int32_t minutes = std::chrono::duration_cast<std::chrono::minutes>(song_time).count();
-			int32_t seconds = std::chrono::duration_cast<std::chrono::seconds>(song_time).count() % 60;
-			sprintf_s(print_buffer, "Playing: %02d:%02d - frame: %d/%d - bytes sent: %d", minutes, seconds, (int)current_song.current_frame, (int)current_song.tune.header.frame_count, bytes_sent);
-
-			DWORD str_len = strlen(print_buffer);
-			DWORD output_written;
-			WriteConsoleOutputCharacterA(out_handle, print_buffer, str_len, cursor_coords, &output_written);
-
-			current_song.current_frame++;
-			if(current_song.current_frame > current_song.tune.header.frame_count)
-				current_song.current_frame = current_song.tune.header.loop_frame;
+		// commands and tunes from the control socket, never blocks
+		control_server.update(player);
 
-			// wait 1000000 / frame_rate us to send next frame.
-			while (std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - frame_start).count() < current_song.frame_time_us) {};
+		
+		uint32_t frame = player.current_frame;
+		if (player.is_playing) {
+			// frames that fell due while we were away go out in one write,
+			// unpaced playback hands the sink whole chunks
+			uint32_t count = fast ? transmit::CHUNK_FRAMES : player::due_frames(player);
+			if (max_frames > 0 && max_frames - player.frames_sent < count)
+				count = (uint32_t)(max_frames - player.frames_sent);
+			player::send_frames(player, count);
+			work_time_us += clock.now_us() - frame_start;
+
+			if (max_frames > 0 && player.frames_sent >= max_frames)
+				quit = true;
 		}
+		status_renderer.publish(player, frame);
+
+		// frames are due every 1000000 / frame_rate us from the start of the tune
+		if (!fast)
+			player::wait_next_frame(player);
+		if (!player.is_playing && control_socket)
+			clock.sleep_until(clock.now_us() + IDLE_POLL_US);
 
 	} while(!quit);
+	uint64_t play_faults = pages::fault_count() - start_faults;
+	status_renderer.stop();
 
 
-	// clear registers
-	for (int j = 0; j < 16; ++j)
-		uart::send_byte(comm_handle, stop_byte);
+	player::stop(player);
+	control_server.stop();
+	if (out.drum_starts > 0) {
+		double tick_us = 8000000.0 / out.chip->clock;
+		output("\ndigidrums: %llu started %.1f us from their frame time on average (max %.1f us), %llu steps within %.2f us\n",
+			(unsigned long long)out.drum_starts, out.drum_start_error_us_sum / out.drum_starts, out.drum_start_error_us_max,
+			(unsigned long long)out.chip->drum_steps, out.chip->drum_step_error_ticks * tick_us);
+	}
+	sink::close(out);
+
+	if (trace_filename && !trace::write_json(trace_filename))
+		output("couldn't write trace %s\n", trace_filename);
 
-	uart::close(comm_handle);
+	if (player.frames_sent > 0) {
+		output("\nframes sent: %llu, work per frame: %.2f us\n", (unsigned long long)player.frames_sent, (double)work_time_us / player.frames_sent);
+		output("page faults while playing: %llu\n", (unsigned long long)play_faults);
+	}
+	pages::Stats page_stats = pages::stats();
+	if (page_stats.mapped_bytes > 0) {
+		output("tune buffers: %.1f MB mapped, %.1f MB on huge pages, %.1f MB locked", page_stats.mapped_bytes / 1048576.0,
+			page_stats.huge_bytes / 1048576.0, page_stats.locked_bytes / 1048576.0);
+		if (page_stats.lock_failures)
+			output(", %llu buffers couldn't be locked", (unsigned long long)page_stats.lock_failures);
+		output("\n");
+	}
+	tune_cache::Stats cache_stats = cache.stats();
+	if (cache_stats.hits + cache_stats.misses > 1) {
+		output("tune cache: %llu hits, %llu misses, %llu evictions, %u tunes in %.1f MB\n", (unsigned long long)cache_stats.hits,
+			(unsigned long long)cache_stats.misses, (unsigned long long)cache_stats.evictions, cache_stats.entries, cache_stats.bytes / 1048576.0);
+	}
 
 	return 0;
-}
\ No newline at end of file
+}
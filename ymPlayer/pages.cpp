@@ -0,0 +1,294 @@
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+#include "pages.h"
+#include "trace.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <psapi.h>
+#include <malloc.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+
+namespace pages
+{
+
+// in front of every buffer, keeps the data 64 byte aligned
+struct Header
+{
+	// length of the mapping, zero for heap buffers
+	uint64_t mapped_size;
+	uint64_t size;
+	bool huge;
+	std::atomic<bool> locked;
+	char padding[64 - 2 * sizeof(uint64_t) - sizeof(bool) - sizeof(std::atomic<bool>)];
+};
+static_assert(sizeof(Header) == 64, "header must keep the data cache line aligned");
+
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+static std::atomic<uint64_t> mapped_bytes(0);
+static std::atomic<uint64_t> huge_bytes(0);
+static std::atomic<uint64_t> locked_bytes(0);
+static std::atomic<uint64_t> lock_failures(0);
+
+static size_t page_size()
+{
+	static size_t size = 0;
+	if (!size) {
+#ifdef _WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		size = info.dwPageSize;
+#else
+		size = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+	}
+	return size;
+}
+
+static size_t round_up(size_t size, size_t granularity)
+{
+	return (size + granularity - 1) / granularity * granularity;
+}
+
+// one write a page, for when the system can't populate a range itself
+static void touch(char *base, size_t size)
+{
+	size_t step = page_size();
+	for (size_t offset = 0; offset < size; offset += step)
+		*(volatile char*)(base + offset) = 0;
+}
+
+#ifdef _WIN32
+
+static char *map(size_t &size, bool &huge)
+{
+	// large pages need SeLockMemoryPrivilege, they're resident once allocated
+	size_t large = GetLargePageMinimum();
+	if (large && size >= large) {
+		size_t rounded = round_up(size, large);
+		void *base = VirtualAlloc(nullptr, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (base) {
+			size = rounded;
+			huge = true;
+			return (char*)base;
+		}
+	}
+
+	size = round_up(size, page_size());
+	char *base = (char*)VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (!base)
+		return nullptr;
+	touch(base, size);
+	huge = false;
+	return base;
+}
+
+static void unmap(char *base, size_t)
+{
+	VirtualFree(base, 0, MEM_RELEASE);
+}
+
+#else
+
+static char *map(size_t &size, bool &huge)
+{
+#ifdef MAP_HUGETLB
+	// only from reserved huge pages, usually there are none
+	if (size >= HUGE_PAGE_SIZE) {
+		size_t rounded = round_up(size, HUGE_PAGE_SIZE);
+		void *base = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+		if (base != MAP_FAILED) {
+			size = rounded;
+			huge = true;
+			return (char*)base;
+		}
+	}
+#endif
+
+	size = round_up(size, page_size());
+	huge = false;
+	// transparent huge pages have to be asked for before the range is
+	// faulted, so those ranges are populated after the advice
+#ifdef MADV_HUGEPAGE
+	bool transparent = size >= HUGE_PAGE_SIZE;
+#else
+	bool transparent = false;
+#endif
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	bool populated = false;
+#ifdef MAP_POPULATE
+	if (!transparent) {
+		flags |= MAP_POPULATE;
+		populated = true;
+	}
+#endif
+	char *base = (char*)mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (base == (char*)MAP_FAILED)
+		return nullptr;
+	if (populated)
+		return base;
+
+#ifdef MADV_HUGEPAGE
+	// only advice, the kernel backs what it can with huge pages
+	madvise(base, size, MADV_HUGEPAGE);
+#endif
+#ifdef MADV_POPULATE_WRITE
+	if (madvise(base, size, MADV_POPULATE_WRITE) == 0)
+		return base;
+#endif
+	touch(base, size);
+	return base;
+}
+
+static void unmap(char *base, size_t size)
+{
+	munmap(base, size);
+}
+
+#endif
+
+// heap buffers start on a page and fill their last one, so locking one never
+// pins, or unlocking one releases, pages shared with another allocation
+static size_t heap_size(size_t total)
+{
+	return round_up(total, page_size());
+}
+
+static char *heap_allocate(size_t total)
+{
+#ifdef _WIN32
+	return (char*)_aligned_malloc(heap_size(total), page_size());
+#else
+	void *base;
+	if (posix_memalign(&base, page_size(), heap_size(total)) != 0)
+		return nullptr;
+	return (char*)base;
+#endif
+}
+
+static void heap_free(char *base)
+{
+#ifdef _WIN32
+	_aligned_free(base);
+#else
+	free(base);
+#endif
+}
+
+char *allocate(size_t size)
+{
+	size_t total = sizeof(Header) + size;
+	char *base;
+	size_t mapped_size = 0;
+	bool huge = false;
+	if (total >= MAP_THRESHOLD) {
+		TRACE_SCOPE("pages::map");
+		mapped_size = total;
+		base = map(mapped_size, huge);
+		if (!base)
+			throw std::bad_alloc();
+		mapped_bytes += mapped_size;
+		if (huge)
+			huge_bytes += mapped_size;
+	}
+	else {
+		base = heap_allocate(total);
+		if (!base)
+			throw std::bad_alloc();
+	}
+
+	Header *header = new (base) Header;
+	header->mapped_size = mapped_size;
+	header->size = size;
+	header->huge = huge;
+	header->locked = false;
+	return base + sizeof(Header);
+}
+
+void release(char *ptr)
+{
+	if (!ptr)
+		return;
+
+	char *base = ptr - sizeof(Header);
+	Header *header = (Header*)base;
+	uint64_t mapped_size = header->mapped_size;
+	if (header->locked) {
+		// unmapping drops the lock by itself, heap pages go back locked
+		size_t size = mapped_size ? (size_t)mapped_size : heap_size((size_t)(sizeof(Header) + header->size));
+		if (!mapped_size) {
+#ifdef _WIN32
+			VirtualUnlock(base, size);
+#else
+			munlock(base, size);
+#endif
+		}
+		locked_bytes -= size;
+	}
+
+	if (!mapped_size) {
+		header->~Header();
+		heap_free(base);
+		return;
+	}
+	mapped_bytes -= mapped_size;
+	if (header->huge)
+		huge_bytes -= mapped_size;
+	header->~Header();
+	unmap(base, (size_t)mapped_size);
+}
+
+bool lock(const char *ptr)
+{
+	Header *header = (Header*)(ptr - sizeof(Header));
+	if (header->locked.exchange(true))
+		return true;
+
+	size_t size = header->mapped_size ? (size_t)header->mapped_size : heap_size((size_t)(sizeof(Header) + header->size));
+#ifdef _WIN32
+	bool ok = VirtualLock((void*)header, size) != 0;
+#else
+	bool ok = mlock(header, size) == 0;
+#endif
+	if (!ok) {
+		header->locked = false;
+		lock_failures++;
+		return false;
+	}
+	locked_bytes += size;
+	return true;
+}
+
+Stats stats()
+{
+	Stats stats;
+	stats.mapped_bytes = mapped_bytes;
+	stats.huge_bytes = huge_bytes;
+	stats.locked_bytes = locked_bytes;
+	stats.lock_failures = lock_failures;
+	return stats;
+}
+
+uint64_t fault_count()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.PageFaultCount;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+	return (uint64_t)usage.ru_minflt + (uint64_t)usage.ru_majflt;
+#endif
+}
+
+}
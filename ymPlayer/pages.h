@@ -0,0 +1,42 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Buffers of the tune library: file images, decompressed tunes, processed
+// registers and digidrum pools. Large buffers are mapped on their own pages,
+// on huge pages when the system has them, and faulted in up front so reading
+// a tune never traps into the kernel page by page. Small ones come from the
+// heap, on whole pages of their own so lock() never touches another
+// allocation. Everything from allocate() must go back through release().
+namespace pages
+{
+
+// buffers from this size on get their own mapping
+static const size_t MAP_THRESHOLD = 64 * 1024;
+
+struct Stats
+{
+	// live buffers in their own mappings, and the part of them on reserved
+	// huge pages. Transparent huge pages aren't counted, the kernel decides.
+	uint64_t mapped_bytes;
+	uint64_t huge_bytes;
+	uint64_t locked_bytes;
+	uint64_t lock_failures;
+};
+
+// never returns nullptr, the memory is not cleared
+char *allocate(size_t size);
+// ptr may be nullptr
+void release(char *ptr);
+
+// keeps the whole buffer resident until it's released. Fails when the
+// process may not lock that much more memory (RLIMIT_MEMLOCK on POSIX, the
+// working set size on Windows), the buffer is usable either way.
+bool lock(const char *ptr);
+
+Stats stats();
+
+// page faults the process has taken so far, minor and major
+uint64_t fault_count();
+
+}
@@ -0,0 +1,169 @@
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include "digidrum.h"
+#include "player.h"
+#include "trace.h"
+
+namespace player
+{
+
+// sleeping is only accurate to a millisecond or two, the rest is spun
+static const uint64_t SPIN_US = 2000;
+
+static uint64_t steady_ns()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+SystemClock::SystemClock() : _start_ns(steady_ns())
+{
+}
+
+uint64_t SystemClock::now_us()
+{
+	return (steady_ns() - _start_ns) / 1000;
+}
+
+void SystemClock::sleep_until(uint64_t time_us)
+{
+	uint64_t now = now_us();
+	if (now + SPIN_US < time_us)
+		std::this_thread::sleep_for(std::chrono::microseconds(time_us - now - SPIN_US));
+	while (now_us() < time_us) {}
+}
+
+static void clear_registers(Player &player)
+{
+	uint8_t stop_bytes[16] = {};
+	sink::stop_digidrums(*player.out);
+	sink::send_bytes(*player.out, stop_bytes, 16, player.stream_time_us);
+}
+
+void init(Player &player, Clock *clock, sink::Sink *out)
+{
+	memset(&player, 0, sizeof(Player));
+	player.clock = clock;
+	player.out = out;
+}
+
+void play(Player &player, const YMTune &tune)
+{
+	player.tune = tune;
+	player.is_playing = tune.header.frame_count > 0 && tune.header.frame_rate > 0;
+	player.current_frame = 0;
+	player.loops = 0;
+	player.start_us = player.clock->now_us();
+	player.frames_played = 0;
+	player.stream_start_us = player.stream_time_us;
+	transmit::build(player.plan, tune);
+	player.digidrums = tune.data.digidrums && sink::plays_digidrums(*player.out);
+	clear_registers(player);
+}
+
+void stop(Player &player)
+{
+	player.is_playing = false;
+	clear_registers(player);
+}
+
+void resume(Player &player)
+{
+	player.is_playing = player.tune.header.frame_count > 0 && player.tune.header.frame_rate > 0;
+	player.start_us = player.clock->now_us();
+	player.frames_played = 0;
+	player.stream_start_us = player.stream_time_us;
+}
+
+void seek(Player &player, uint32_t frame)
+{
+	if (frame < player.tune.header.frame_count)
+		player.current_frame = frame;
+}
+
+uint64_t next_frame_time(const Player &player)
+{
+	return player.start_us + player.frames_played * 1000000 / player.tune.header.frame_rate;
+}
+
+static void start_digidrums(Player &player, uint32_t frame, uint64_t time_us)
+{
+	digidrum::Trigger triggers[digidrum::MAX_TRIGGERS];
+	uint32_t count = digidrum::get_triggers(player.tune, frame, triggers);
+	for (uint32_t i = 0; i < count; ++i) {
+		uint32_t length;
+		const uint8_t *levels = get_digidrum(player.tune, triggers[i].sample, length);
+		if (levels)
+			sink::play_digidrum(*player.out, triggers[i].voice, levels, length, triggers[i].rate, time_us);
+	}
+}
+
+bool send_frame(Player &player)
+{
+	return send_frames(player, 1) > 0;
+}
+
+uint32_t send_frames(Player &player, uint32_t count)
+{
+	if (!player.is_playing)
+		return 0;
+
+	TRACE_SCOPE("frame");
+	transmit::Batch batch;
+	uint32_t next = transmit::take(player.plan, player.current_frame, count, batch);
+	if (batch.frame_count == 0)
+		return 0;
+
+	const YMHeader &header = player.tune.header;
+	transmit::Timeline timeline = { player.stream_start_us, player.frames_played, header.frame_rate };
+	player.stream_time_us = transmit::frame_time(timeline, batch.frame_count - 1);
+	player.last_emit_us = player.clock->now_us();
+	// later frames of a batch are due later, the first one on time ends it
+	for (uint32_t i = 0; i < batch.frame_count; ++i) {
+		uint64_t due = player.start_us + (player.frames_played + i) * 1000000 / header.frame_rate;
+		if (player.last_emit_us <= due + LATE_US)
+			break;
+		player.late_frames++;
+		if (player.last_emit_us - due > player.max_late_us)
+			player.max_late_us = player.last_emit_us - due;
+	}
+	if (player.digidrums) {
+		// drums start between frames, so the frames go one at a time
+		uint32_t frame = player.current_frame;
+		for (uint32_t i = 0; i < batch.frame_count; ++i) {
+			transmit::Batch single;
+			uint32_t after = transmit::take(player.plan, frame, 1, single);
+			transmit::Timeline at = { timeline.start_us, timeline.first_frame + i, timeline.frame_rate };
+			player.bytes_sent += sink::send_batch(*player.out, single, at);
+			start_digidrums(player, frame, transmit::frame_time(at, 0));
+			frame = after;
+		}
+	}
+	else {
+		player.bytes_sent += sink::send_batch(*player.out, batch, timeline);
+	}
+	player.frames_sent += batch.frame_count;
+	player.frames_played += batch.frame_count;
+	player.current_frame = next;
+	player.loops += batch.wraps;
+	return batch.frame_count;
+}
+
+uint32_t due_frames(const Player &player)
+{
+	if (!player.is_playing)
+		return 0;
+	uint64_t now = player.clock->now_us();
+	uint32_t count = 1;
+	while (count < transmit::CHUNK_FRAMES && player.start_us + (player.frames_played + count) * 1000000 / player.tune.header.frame_rate <= now)
+		count++;
+	return count;
+}
+
+void wait_next_frame(Player &player)
+{
+	if (player.is_playing)
+		player.clock->sleep_until(next_frame_time(player));
+}
+
+}
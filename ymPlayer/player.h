@@ -0,0 +1,108 @@
+#pragma once
+#include <stdint.h>
+#include "sink.h"
+#include "transmit.h"
+#include "ym.h"
+
+namespace player
+{
+
+// frames sent more than this after their deadline count as late
+static const uint64_t LATE_US = 2000;
+
+// time source of the frame loop, in microseconds from an arbitrary start
+class Clock
+{
+public:
+	virtual ~Clock() {}
+	virtual uint64_t now_us() = 0;
+	// returns at or after time_us
+	virtual void sleep_until(uint64_t time_us) = 0;
+};
+
+// steady_clock, sleeps until shortly before the deadline and spins the rest
+class SystemClock : public Clock
+{
+public:
+	SystemClock();
+	uint64_t now_us() override;
+	void sleep_until(uint64_t time_us) override;
+
+private:
+	uint64_t _start_ns;
+};
+
+// time only moves when told to, sleeping jumps straight to the deadline
+class VirtualClock : public Clock
+{
+public:
+	VirtualClock() : _now_us(0) {}
+	uint64_t now_us() override { return _now_us; }
+	void sleep_until(uint64_t time_us) override {
+		if (time_us > _now_us)
+			_now_us = time_us;
+	}
+	void advance(uint64_t us) { _now_us += us; }
+
+private:
+	uint64_t _now_us;
+};
+
+struct Player
+{
+	Clock *clock;
+	sink::Sink *out;
+
+	YMTune tune;
+	bool is_playing;
+	uint32_t current_frame;
+	// times the current tune has wrapped back to its loop frame
+	uint32_t loops;
+
+	// frame n of the current tune is due at start_us + n * 1000000 / frame_rate,
+	// computed from n every time so the schedule never drifts
+	uint64_t start_us;
+	uint64_t frames_played;
+
+	// playback time handed to the sink, continues across tunes
+	uint64_t stream_start_us;
+	uint64_t stream_time_us;
+
+	uint64_t frames_sent;
+	uint64_t bytes_sent;
+	uint64_t last_emit_us;
+	uint64_t late_frames;
+	uint64_t max_late_us;
+
+	// set by play() when the tune has digidrums and the sink plays them
+	bool digidrums;
+	// playback order of the current tune, built by play()
+	transmit::Plan plan;
+};
+
+void init(Player &player, Clock *clock, sink::Sink *out);
+
+// clears the chip registers and starts tune with its first frame due now.
+// The tune is not owned by the player.
+void play(Player &player, const YMTune &tune);
+void stop(Player &player);
+// continues a stopped tune from its current frame, due now
+void resume(Player &player);
+void seek(Player &player, uint32_t frame);
+
+// clock time the next frame is due
+uint64_t next_frame_time(const Player &player);
+
+// sends the current frame and moves on, wrapping to the loop frame after
+// the last one. Returns false when nothing is playing.
+bool send_frame(Player &player);
+// sends count frames from the current one in a single batch, at most
+// transmit::CHUNK_FRAMES. Returns the number sent.
+uint32_t send_frames(Player &player, uint32_t count);
+// frames due by now, at least one while playing and at most a chunk
+uint32_t due_frames(const Player &player);
+
+// sleeps until the next frame is due
+void wait_next_frame(Player &player);
+
+}
@@ -0,0 +1,482 @@
+#include <string.h>
+#include <math.h>
+#include "psg.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE2 1
+#include <emmintrin.h>
+#else
+#define USE_SSE2 0
+#endif
+
+namespace psg
+{
+
+// measured dac levels, 32 steps. The AY only has 16 so every level is doubled,
+// fixed volume v maps to index v * 2 + 1 on both chips.
+static const float ym_volume_table[32] =
+{
+	0.0f, 0.0f,
+	0.00465400167849f, 0.00772106507973f,
+	0.0109559777218f, 0.0139620050355f,
+	0.0169985503929f, 0.0200198367285f,
+	0.024368657969f, 0.029694056611f,
+	0.0350652323186f, 0.0403906309606f,
+	0.0485389486534f, 0.0583352407111f,
+	0.0680552376593f, 0.0777752346075f,
+	0.0925154497597f, 0.111085679408f,
+	0.129747463188f, 0.148485542077f,
+	0.17666895552f, 0.211551079576f,
+	0.246387426566f, 0.281101701381f,
+	0.333730067903f, 0.400427252613f,
+	0.467383840696f, 0.53443198291f,
+	0.635172045472f, 0.75800717174f,
+	0.879926756695f, 1.0f,
+};
+
+static const float ay_volume_table[32] =
+{
+	0.0f, 0.0f,
+	0.00999465934234f, 0.00999465934234f,
+	0.0144502937362f, 0.0144502937362f,
+	0.0210574502174f, 0.0210574502174f,
+	0.0307011520562f, 0.0307011520562f,
+	0.0455481803616f, 0.0455481803616f,
+	0.0644998855573f, 0.0644998855573f,
+	0.107362478065f, 0.107362478065f,
+	0.126588845655f, 0.126588845655f,
+	0.20498970016f, 0.20498970016f,
+	0.292210269322f, 0.292210269322f,
+	0.372838941024f, 0.372838941024f,
+	0.492530708782f, 0.492530708782f,
+	0.635324635691f, 0.635324635691f,
+	0.805584802014f, 0.805584802014f,
+	1.0f, 1.0f,
+};
+
+static const float OUTPUT_GAIN = 0.5f;
+static const float DC_POLE = 0.995f;
+static const double PI = 3.14159265358979323846;
+
+
+static void build_filter(Chip &chip)
+{
+	// cutoff just below the output nyquist, in cycles per tick
+	double tick_rate = chip.clock / 8.0;
+	double cutoff = 0.45 * chip.sample_rate / tick_rate;
+	if (cutoff > 0.5)
+		cutoff = 0.5;
+
+	for (uint32_t phase = 0; phase <= FILTER_PHASES; ++phase) {
+		float *taps = &chip.filter[phase * FILTER_TAPS];
+		double frac = (double)phase / FILTER_PHASES;
+		double sum = 0.0;
+		for (uint32_t k = 0; k < FILTER_TAPS; ++k) {
+			// distance from the output position to tick k
+			double t = (double)k - (FILTER_TAPS / 2 - 1) - frac;
+			double x = 2.0 * cutoff * t;
+			double sinc = (x == 0.0) ? 1.0 : sin(PI * x) / (PI * x);
+			double w = (t + FILTER_TAPS / 2.0) / FILTER_TAPS;
+			double window = 0.42 - 0.5 * cos(2.0 * PI * w) + 0.08 * cos(4.0 * PI * w);
+			double h = sinc * window;
+			taps[k] = (float)h;
+			sum += h;
+		}
+		// unity gain at dc for every phase
+		for (uint32_t k = 0; k < FILTER_TAPS; ++k)
+			taps[k] = (float)(taps[k] / sum);
+	}
+}
+
+static void reset_envelope(Chip &chip)
+{
+	uint8_t shape = chip.regs[13] & 0x0f;
+	chip.env_attack = (shape & 0x04) ? 0x1f : 0;
+	if ((shape & 0x08) == 0) {
+		chip.env_hold = 1;
+		chip.env_alternate = chip.env_attack;
+	}
+	else {
+		chip.env_hold = shape & 0x01;
+		chip.env_alternate = shape & 0x02;
+	}
+	chip.env_step = 0x1f;
+	chip.env_holding = 0;
+	chip.env_counter = 0;
+	chip.env_volume = chip.env_step ^ chip.env_attack;
+}
+
+static void update_channel(Chip &chip, uint32_t ch)
+{
+	int32_t period = chip.regs[ch * 2] | ((chip.regs[ch * 2 + 1] & 0x0f) << 8);
+	chip.tone_period_m1[ch] = (period == 0 ? 1 : period) - 1;
+	chip.tone_disable[ch] = (chip.regs[7] >> ch) & 1 ? -1 : 0;
+	chip.noise_disable[ch] = (chip.regs[7] >> (ch + 3)) & 1 ? -1 : 0;
+
+	uint8_t level = chip.regs[8 + ch];
+	chip.env_mode[ch] = (level & 0x10) ? -1 : 0;
+	chip.fixed_level[ch] = chip.volume_table[(level & 0x0f) * 2 + 1];
+	if (chip.drums_playing & (1 << ch)) {
+		const Drum &drum = chip.drums[ch];
+		chip.env_mode[ch] = 0;
+		chip.fixed_level[ch] = chip.volume_table[(drum.levels[drum.position] & 0x0f) * 2 + 1];
+	}
+}
+
+
+Chip *create(ChipType type, uint32_t clock, uint32_t sample_rate)
+{
+	Chip *chip = new Chip;
+	memset(chip, 0, sizeof(Chip));
+	chip->type = type;
+	chip->clock = clock;
+	chip->sample_rate = sample_rate;
+	chip->volume_table = (type == CHIP_YM2149) ? ym_volume_table : ay_volume_table;
+	chip->step = ((uint64_t)clock << 32) / (8ULL * sample_rate);
+	build_filter(*chip);
+	reset(*chip);
+	return chip;
+}
+
+void destroy(Chip *chip)
+{
+	delete chip;
+}
+
+void reset(Chip &chip)
+{
+	memset(chip.regs, 0, sizeof(chip.regs));
+	chip.drums_playing = 0;
+	memset(chip.tone_counter, 0, sizeof(chip.tone_counter));
+	memset(chip.tone_output, 0, sizeof(chip.tone_output));
+	for (uint32_t ch = 0; ch < 3; ++ch)
+		update_channel(chip, ch);
+	chip.tone_period_m1[3] = 0;
+	chip.tone_disable[3] = 0;
+	chip.noise_disable[3] = 0;
+	chip.env_mode[3] = 0;
+	chip.fixed_level[3] = 0.0f;
+
+	chip.noise_period = 2;
+	chip.noise_counter = 0;
+	chip.noise_lfsr = 1;
+	chip.noise_output = 0;
+
+	chip.env_period = 1;
+	reset_envelope(chip);
+
+	// history of silence so the first samples have a full filter window
+	memset(chip.ticks, 0, sizeof(chip.ticks));
+	chip.tick_count = FILTER_TAPS;
+	chip.position = (uint64_t)(FILTER_TAPS / 2 - 1) << 32;
+	chip.dc_in = 0.0f;
+	chip.dc_out = 0.0f;
+}
+
+void write_register(Chip &chip, uint32_t reg, uint8_t value)
+{
+	if (reg >= 14)
+		return;
+
+	chip.regs[reg] = value;
+	switch (reg) {
+		case 0: case 1:
+			update_channel(chip, 0);
+			break;
+		case 2: case 3:
+			update_channel(chip, 1);
+			break;
+		case 4: case 5:
+			update_channel(chip, 2);
+			break;
+		case 6:
+		{
+			int32_t period = value & 0x1f;
+			chip.noise_period = (period == 0 ? 1 : period) * 2;
+			break;
+		}
+		case 7:
+		case 8: case 9: case 10:
+			for (uint32_t ch = 0; ch < 3; ++ch)
+				update_channel(chip, ch);
+			break;
+		case 11: case 12:
+		{
+			int32_t period = chip.regs[11] | (chip.regs[12] << 8);
+			chip.env_period = period == 0 ? 1 : period;
+			break;
+		}
+		case 13:
+			reset_envelope(chip);
+			break;
+	}
+}
+
+void write_registers(Chip &chip, const uint8_t *regs, bool envelope_write)
+{
+	for (uint32_t reg = 0; reg < 13; ++reg) {
+		if (regs[reg] != chip.regs[reg])
+			write_register(chip, reg, regs[reg]);
+	}
+	if (envelope_write)
+		write_register(chip, 13, regs[13]);
+}
+
+void play_drum(Chip &chip, uint32_t channel, const uint8_t *levels, uint32_t length, uint32_t rate)
+{
+	if (channel >= 3 || !levels || length == 0 || rate == 0)
+		return;
+	Drum &drum = chip.drums[channel];
+	drum.levels = levels;
+	drum.length = length;
+	drum.position = 0;
+	drum.phase = 0;
+	drum.step = ((uint64_t)rate << 32) / (chip.clock / 8);
+	drum.start_tick = chip.tick_total;
+	drum.rate = rate;
+	chip.drums_playing |= 1 << channel;
+	update_channel(chip, channel);
+}
+
+void stop_drums(Chip &chip)
+{
+	chip.drums_playing = 0;
+	for (uint32_t ch = 0; ch < 3; ++ch)
+		update_channel(chip, ch);
+}
+
+float fixed_volume(ChipType type, uint32_t level)
+{
+	const float *table = (type == CHIP_YM2149) ? ym_volume_table : ay_volume_table;
+	return table[(level & 0x0f) * 2 + 1];
+}
+
+// moves the playing drums on by one tick, true when a level changed
+static bool step_drums(Chip &chip, uint64_t tick)
+{
+	bool changed = false;
+	for (uint32_t ch = 0; ch < 3; ++ch) {
+		if (!(chip.drums_playing & (1 << ch)))
+			continue;
+		Drum &drum = chip.drums[ch];
+		drum.phase += drum.step;
+		if (drum.phase < (1ull << 32))
+			continue;
+		drum.phase -= 1ull << 32;
+		drum.position++;
+		changed = true;
+		if (drum.position >= drum.length) {
+			chip.drums_playing &= ~(1u << ch);
+			update_channel(chip, ch);
+			continue;
+		}
+		chip.fixed_level[ch] = chip.volume_table[(drum.levels[drum.position] & 0x0f) * 2 + 1];
+
+		double ideal = drum.start_tick + (double)drum.position * (chip.clock / 8) / drum.rate;
+		double error = fabs((double)tick - ideal);
+		if (error > chip.drum_step_error_ticks)
+			chip.drum_step_error_ticks = error;
+		chip.drum_steps++;
+	}
+	return changed;
+}
+
+
+// one noise period, true when the output flipped state
+static inline bool step_noise(Chip &chip)
+{
+	if (++chip.noise_counter < chip.noise_period)
+		return false;
+	chip.noise_counter = 0;
+	chip.noise_lfsr ^= ((chip.noise_lfsr & 1) ^ ((chip.noise_lfsr >> 3) & 1)) << 17;
+	chip.noise_lfsr >>= 1;
+	chip.noise_output = (chip.noise_lfsr & 1) ? -1 : 0;
+	return true;
+}
+
+// one envelope period, true when the envelope volume moved
+static inline bool step_envelope(Chip &chip)
+{
+	if (chip.env_holding || ++chip.env_counter < chip.env_period)
+		return false;
+	chip.env_counter = 0;
+	chip.env_step--;
+	if (chip.env_step < 0) {
+		if (chip.env_hold) {
+			if (chip.env_alternate)
+				chip.env_attack ^= 0x1f;
+			chip.env_holding = 1;
+			chip.env_step = 0;
+		}
+		else {
+			if (chip.env_alternate && (chip.env_step & 0x20))
+				chip.env_attack ^= 0x1f;
+			chip.env_step &= 0x1f;
+		}
+	}
+	chip.env_volume = chip.env_step ^ chip.env_attack;
+	return true;
+}
+
+#if USE_SSE2
+
+// runs the generators for count ticks, one mixed sample per tick
+static void generate(Chip &chip, float *dst, uint32_t count)
+{
+	const __m128i one = _mm_set1_epi32(1);
+	__m128i counter = _mm_loadu_si128((const __m128i*)chip.tone_counter);
+	__m128i output = _mm_loadu_si128((const __m128i*)chip.tone_output);
+	__m128i period_m1 = _mm_loadu_si128((const __m128i*)chip.tone_period_m1);
+	__m128i tone_disable = _mm_loadu_si128((const __m128i*)chip.tone_disable);
+	__m128i noise_disable = _mm_loadu_si128((const __m128i*)chip.noise_disable);
+	__m128 env_mode = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)chip.env_mode));
+	__m128 fixed_level = _mm_andnot_ps(env_mode, _mm_loadu_ps(chip.fixed_level));
+
+	__m128i noise = _mm_set1_epi32(chip.noise_output);
+	__m128i noise_gate = _mm_or_si128(noise, noise_disable);
+	__m128 env_level = _mm_and_ps(env_mode, _mm_set1_ps(chip.volume_table[chip.env_volume]));
+	__m128 level = _mm_or_ps(env_level, fixed_level);
+
+	const float *volume_table = chip.volume_table;
+
+	for (uint32_t i = 0; i < count; ++i) {
+		// the three tone counters step in parallel, a lane flips its square
+		// wave when the counter passes the period
+		counter = _mm_add_epi32(counter, one);
+		__m128i wrap = _mm_cmpgt_epi32(counter, period_m1);
+		output = _mm_xor_si128(output, wrap);
+		counter = _mm_andnot_si128(wrap, counter);
+
+		if (step_noise(chip)) {
+			noise = _mm_set1_epi32(chip.noise_output);
+			noise_gate = _mm_or_si128(noise, noise_disable);
+		}
+
+		if (step_envelope(chip)) {
+			env_level = _mm_and_ps(env_mode, _mm_set1_ps(volume_table[chip.env_volume]));
+			level = _mm_or_ps(env_level, fixed_level);
+		}
+
+		if (chip.drums_playing && step_drums(chip, chip.tick_total + i)) {
+			env_mode = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)chip.env_mode));
+			fixed_level = _mm_andnot_ps(env_mode, _mm_loadu_ps(chip.fixed_level));
+			env_level = _mm_and_ps(env_mode, _mm_set1_ps(volume_table[chip.env_volume]));
+			level = _mm_or_ps(env_level, fixed_level);
+		}
+
+		__m128i gate = _mm_and_si128(_mm_or_si128(output, tone_disable), noise_gate);
+		__m128 v = _mm_and_ps(_mm_castsi128_ps(gate), level);
+		v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+		v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+		_mm_store_ss(&dst[i], v);
+	}
+
+	_mm_storeu_si128((__m128i*)chip.tone_counter, counter);
+	_mm_storeu_si128((__m128i*)chip.tone_output, output);
+	chip.tick_total += count;
+}
+
+static float convolve(const float *x, const float *h)
+{
+	__m128 acc0 = _mm_setzero_ps();
+	__m128 acc1 = _mm_setzero_ps();
+	for (uint32_t k = 0; k < FILTER_TAPS; k += 8) {
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x + k), _mm_loadu_ps(h + k)));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(x + k + 4), _mm_loadu_ps(h + k + 4)));
+	}
+	__m128 v = _mm_add_ps(acc0, acc1);
+	v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+	v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+	return _mm_cvtss_f32(v);
+}
+
+#else
+
+// the same lanes and the same order of additions as the SSE2 path, so both
+// give the same samples
+static void generate(Chip &chip, float *dst, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; ++i) {
+		for (int c = 0; c < 4; ++c) {
+			if (++chip.tone_counter[c] > chip.tone_period_m1[c]) {
+				chip.tone_counter[c] = 0;
+				chip.tone_output[c] = ~chip.tone_output[c];
+			}
+		}
+
+		step_noise(chip);
+		step_envelope(chip);
+		if (chip.drums_playing)
+			step_drums(chip, chip.tick_total + i);
+
+		float env_level = chip.volume_table[chip.env_volume];
+		float v[4];
+		for (int c = 0; c < 4; ++c) {
+			int32_t gate = (chip.tone_output[c] | chip.tone_disable[c]) & (chip.noise_output | chip.noise_disable[c]);
+			v[c] = gate ? (chip.env_mode[c] ? env_level : chip.fixed_level[c]) : 0.0f;
+		}
+		dst[i] = (v[0] + v[2]) + (v[1] + v[3]);
+	}
+	chip.tick_total += count;
+}
+
+static float convolve(const float *x, const float *h)
+{
+	float acc[8] = {};
+	for (uint32_t k = 0; k < FILTER_TAPS; k += 8) {
+		for (int j = 0; j < 8; ++j)
+			acc[j] += x[k + j] * h[k + j];
+	}
+	float v[4];
+	for (int j = 0; j < 4; ++j)
+		v[j] = acc[j] + acc[j + 4];
+	return (v[0] + v[2]) + (v[1] + v[3]);
+}
+
+#endif
+
+void render(Chip &chip, float *out, uint32_t count)
+{
+	if (count == 0)
+		return;
+	// one past the last tick the window of the last sample reaches
+	uint64_t last = ((chip.position + chip.step * (count - 1)) >> 32) + FILTER_TAPS / 2 + 1;
+
+	for (uint32_t n = 0; n < count; ++n) {
+		uint32_t index = (uint32_t)(chip.position >> 32);
+
+		// the window for this sample spans ticks [index - TAPS/2 + 1, index + TAPS/2]
+		uint32_t needed = index + FILTER_TAPS / 2 + 1;
+		if (needed > chip.tick_count) {
+			uint32_t first = index - (FILTER_TAPS / 2 - 1);
+			if (first > 0) {
+				// drop ticks no longer covered by the window
+				memmove(chip.ticks, chip.ticks + first, (chip.tick_count - first) * sizeof(float));
+				chip.tick_count -= first;
+				chip.position -= (uint64_t)first << 32;
+				index -= first;
+				needed -= first;
+				last -= first;
+			}
+			uint32_t space = TICK_BUFFER_SIZE + FILTER_TAPS - chip.tick_count;
+			uint32_t ticks = last - chip.tick_count < space ? (uint32_t)(last - chip.tick_count) : space;
+			generate(chip, chip.ticks + chip.tick_count, ticks);
+			chip.tick_count += ticks;
+		}
+
+		uint32_t frac = (uint32_t)chip.position;
+		uint32_t phase = (uint32_t)(((uint64_t)frac * FILTER_PHASES + 0x80000000ULL) >> 32);
+		const float *x = chip.ticks + index - (FILTER_TAPS / 2 - 1);
+		float sample = convolve(x, &chip.filter[phase * FILTER_TAPS]) * OUTPUT_GAIN;
+
+		// the chip output is unipolar, remove the dc offset
+		float y = sample - chip.dc_in + DC_POLE * chip.dc_out;
+		chip.dc_in = sample;
+		chip.dc_out = y;
+		out[n] = y;
+
+		chip.position += chip.step;
+	}
+}
+
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include <stdint.h>
+
+namespace psg
+{
+
+enum ChipType
+{
+	CHIP_YM2149,
+	CHIP_AY8910,
+};
+
+// the generators run at clock / 8, the tick stream is band limited and
+// decimated to the output rate with a polyphase windowed sinc.
+static const uint32_t FILTER_TAPS = 128;
+static const uint32_t FILTER_PHASES = 64;
+static const uint32_t TICK_BUFFER_SIZE = 4096;
+
+// a digidrum playing on a channel, its levels replace the level register.
+// Steps are timed in ticks with a 32.32 phase in samples.
+struct Drum
+{
+	const uint8_t *levels;
+	uint32_t length;
+	uint32_t position;
+	uint64_t phase;
+	uint64_t step;
+	uint64_t start_tick;
+	uint32_t rate;
+};
+
+struct Chip
+{
+	ChipType type;
+	uint32_t clock;
+	uint32_t sample_rate;
+	uint8_t regs[16];
+
+	// lanes 0-2 are tone A-C, lane 3 is always silent
+	int32_t tone_period_m1[4];
+	int32_t tone_counter[4];
+	int32_t tone_output[4];
+	int32_t tone_disable[4];
+	int32_t noise_disable[4];
+	int32_t env_mode[4];
+	float fixed_level[4];
+
+	int32_t noise_period;
+	int32_t noise_counter;
+	uint32_t noise_lfsr;
+	int32_t noise_output;
+
+	int32_t env_period;
+	int32_t env_counter;
+	int32_t env_step;
+	int32_t env_attack;
+	int32_t env_hold;
+	int32_t env_alternate;
+	int32_t env_holding;
+	int32_t env_volume;
+
+	const float *volume_table;
+
+	Drum drums[3];
+	// bit per channel
+	uint32_t drums_playing;
+	// ticks generated since create, where the next write takes effect
+	uint64_t tick_total;
+	// drum steps taken and the furthest one landed from its ideal time
+	uint64_t drum_steps;
+	double drum_step_error_ticks;
+
+	// resampler, position is in ticks as 32.32 fixed point relative to ticks[0]
+	uint64_t position;
+	uint64_t step;
+	uint32_t tick_count;
+	float ticks[TICK_BUFFER_SIZE + FILTER_TAPS];
+	float filter[(FILTER_PHASES + 1) * FILTER_TAPS];
+
+	float dc_in;
+	float dc_out;
+};
+
+Chip *create(ChipType type, uint32_t clock, uint32_t sample_rate);
+void destroy(Chip *chip);
+void reset(Chip &chip);
+
+void write_register(Chip &chip, uint32_t reg, uint8_t value);
+
+// writes a full 16 register frame. The envelope shape register restarts the
+// envelope on every write, YM files mark frames that don't touch it so the
+// caller decides.
+void write_registers(Chip &chip, const uint8_t *regs, bool envelope_write);
+
+// plays levels (4 bit fixed volumes) on channel at rate steps a second in
+// place of its level register, from the next tick on. levels must stay
+// valid until the drum ends or stop_drums.
+void play_drum(Chip &chip, uint32_t channel, const uint8_t *levels, uint32_t length, uint32_t rate);
+void stop_drums(Chip &chip);
+
+// output of fixed volume level 0-15, 1.0 at full scale
+float fixed_volume(ChipType type, uint32_t level);
+
+// renders count mono samples at the chip sample rate. Ticks are generated
+// only as far as these samples need, so writes between calls take effect
+// within half a filter window of where they were made.
+void render(Chip &chip, float *out, uint32_t count);
+
+}
@@ -0,0 +1,246 @@
+#include <math.h>
+#include <string.h>
+#include "sink.h"
+#include "uart.h"
+
+namespace sink
+{
+
+bool open_uart(Sink &sink, const char *port, uint32_t baud_rate)
+{
+	memset(&sink, 0, sizeof(Sink));
+	sink.type = SINK_UART;
+	sink.handle = uart::open(port, baud_rate);
+	return sink.handle != (void*)-1;
+}
+
+bool open_null(Sink &sink)
+{
+	memset(&sink, 0, sizeof(Sink));
+	sink.type = SINK_NULL;
+	return true;
+}
+
+static void flush_capture(Sink &sink)
+{
+	if (sink.write_offset > 0) {
+		fwrite(sink.write_buffer, 1, sink.write_offset, sink.file);
+		sink.write_offset = 0;
+	}
+}
+
+static void put_u16(uint8_t *dst, uint16_t val)
+{
+	dst[0] = val & 0xff;
+	dst[1] = (val >> 8) & 0xff;
+}
+
+static void put_u32(uint8_t *dst, uint32_t val)
+{
+	dst[0] = val & 0xff;
+	dst[1] = (val >> 8) & 0xff;
+	dst[2] = (val >> 16) & 0xff;
+	dst[3] = (val >> 24) & 0xff;
+}
+
+bool open_capture(Sink &sink, const char *filename)
+{
+	memset(&sink, 0, sizeof(Sink));
+	sink.type = SINK_CAPTURE;
+	sink.file = fopen(filename, "wb");
+	if (!sink.file)
+		return false;
+
+	// we do our own buffering, one fwrite per CAPTURE_BUFFER_SIZE bytes
+	setvbuf(sink.file, nullptr, _IONBF, 0);
+	sink.write_buffer = new uint8_t[CAPTURE_BUFFER_SIZE];
+
+	uint8_t *header = sink.write_buffer;
+	memcpy(header, "YMCP", 4);
+	put_u16(header + 4, CAPTURE_VERSION);
+	put_u16(header + 6, 0);
+	sink.write_offset = 8;
+	return true;
+}
+
+bool open_synth(Sink &sink, const char *wav_filename, psg::ChipType type, uint32_t clock, uint32_t sample_rate)
+{
+	memset(&sink, 0, sizeof(Sink));
+	sink.type = SINK_SYNTH;
+	if (!wav::open(sink.wav, wav_filename, sample_rate, 1, 256 * 1024))
+		return false;
+
+	sink.chip = psg::create(type, clock, sample_rate);
+	sink.sample_buffer = new float[SYNTH_BLOCK_SIZE];
+	return true;
+}
+
+// renders audio up to time_us with the registers currently set
+static void render_until(Sink &sink, uint64_t time_us)
+{
+	uint64_t target = time_us * sink.chip->sample_rate / 1000000;
+	while (sink.samples_rendered < target) {
+		uint64_t remaining = target - sink.samples_rendered;
+		uint32_t n = remaining > SYNTH_BLOCK_SIZE ? SYNTH_BLOCK_SIZE : (uint32_t)remaining;
+		psg::render(*sink.chip, sink.sample_buffer, n);
+		wav::write_samples(sink.wav, sink.sample_buffer, n);
+		sink.samples_rendered += n;
+	}
+}
+
+void close(Sink &sink)
+{
+	switch (sink.type) {
+		case SINK_UART:
+			uart::close(sink.handle);
+			break;
+		case SINK_NULL:
+			break;
+		case SINK_CAPTURE:
+			flush_capture(sink);
+			fclose(sink.file);
+			delete [] sink.write_buffer;
+			break;
+		case SINK_SYNTH:
+			wav::close(sink.wav);
+			psg::destroy(sink.chip);
+			delete [] sink.sample_buffer;
+			break;
+	}
+	memset(&sink, 0, sizeof(Sink));
+}
+
+int send_bytes(Sink &sink, uint8_t *buffer, uint32_t size, uint64_t time_us)
+{
+	int written = 0;
+	switch (sink.type) {
+		case SINK_UART:
+			written = uart::send_bytes(sink.handle, buffer, size);
+			break;
+		case SINK_NULL:
+			written = size;
+			break;
+		case SINK_CAPTURE:
+		{
+			uint32_t record_size = 6 + size;
+			if (sink.write_offset + record_size > CAPTURE_BUFFER_SIZE)
+				flush_capture(sink);
+
+			if (record_size > CAPTURE_BUFFER_SIZE) {
+				uint8_t record_header[6];
+				put_u32(record_header, (uint32_t)(time_us - sink.last_time_us));
+				put_u16(record_header + 4, size);
+				fwrite(record_header, 1, 6, sink.file);
+				fwrite(buffer, 1, size, sink.file);
+			}
+			else {
+				uint8_t *record = sink.write_buffer + sink.write_offset;
+				put_u32(record, (uint32_t)(time_us - sink.last_time_us));
+				put_u16(record + 4, size);
+				memcpy(record + 6, buffer, size);
+				sink.write_offset += record_size;
+			}
+			sink.last_time_us = time_us;
+			written = size;
+			break;
+		}
+		case SINK_SYNTH:
+		{
+			render_until(sink, time_us);
+			// bare frames (live input) carry no envelope write flag, treat a
+			// changed shape as a write. Tunes go through send_batch.
+			for (uint32_t i = 0; i + 16 <= size; i += 16) {
+				bool envelope_write = buffer[i + 13] != sink.chip->regs[13];
+				psg::write_registers(*sink.chip, buffer + i, envelope_write);
+			}
+			written = size;
+			break;
+		}
+	}
+
+	sink.bytes_sent += written;
+	sink.sends++;
+	return written;
+}
+
+bool plays_digidrums(const Sink &sink)
+{
+	return sink.type == SINK_SYNTH;
+}
+
+void play_digidrum(Sink &sink, uint32_t voice, const uint8_t *levels, uint32_t length, uint32_t rate, uint64_t time_us)
+{
+	if (sink.type != SINK_SYNTH)
+		return;
+	render_until(sink, time_us);
+	psg::play_drum(*sink.chip, voice, levels, length, rate);
+
+	// the drum starts on the next tick the chip generates
+	double tick_rate = sink.chip->clock / 8.0;
+	double error_us = fabs(sink.chip->tick_total / tick_rate * 1000000.0 - (double)time_us);
+	sink.drum_starts++;
+	sink.drum_start_error_us_sum += error_us;
+	if (error_us > sink.drum_start_error_us_max)
+		sink.drum_start_error_us_max = error_us;
+}
+
+void stop_digidrums(Sink &sink)
+{
+	if (sink.type == SINK_SYNTH)
+		psg::stop_drums(*sink.chip);
+}
+
+int send_batch(Sink &sink, const transmit::Batch &batch, const transmit::Timeline &timeline)
+{
+	int written = 0;
+	switch (sink.type) {
+		case SINK_UART:
+		case SINK_NULL:
+		{
+			const uint8_t *buffers[transmit::MAX_SPANS];
+			uint32_t sizes[transmit::MAX_SPANS];
+			for (uint32_t i = 0; i < batch.span_count; ++i) {
+				buffers[i] = batch.spans[i].data;
+				sizes[i] = batch.spans[i].frame_count * transmit::FRAME_SIZE;
+				written += sizes[i];
+			}
+			if (sink.type == SINK_UART)
+				written = uart::send_buffers(sink.handle, buffers, sizes, batch.span_count);
+			sink.bytes_sent += written;
+			sink.sends++;
+			break;
+		}
+		case SINK_SYNTH:
+		{
+			// the special registers say which frames write the envelope shape
+			uint32_t frame = 0;
+			for (uint32_t i = 0; i < batch.span_count; ++i) {
+				const transmit::Span &span = batch.spans[i];
+				for (uint32_t j = 0; j < span.frame_count; ++j, ++frame) {
+					render_until(sink, transmit::frame_time(timeline, frame));
+					psg::write_registers(*sink.chip, span.data + j * transmit::FRAME_SIZE,
+						is_envelope_write(span.special + j * transmit::FRAME_SIZE));
+					written += transmit::FRAME_SIZE;
+					sink.sends++;
+				}
+			}
+			sink.bytes_sent += written;
+			break;
+		}
+		case SINK_CAPTURE:
+		{
+			uint32_t frame = 0;
+			for (uint32_t i = 0; i < batch.span_count; ++i) {
+				const transmit::Span &span = batch.spans[i];
+				for (uint32_t j = 0; j < span.frame_count; ++j, ++frame) {
+					uint8_t *data = (uint8_t*)span.data + j * transmit::FRAME_SIZE;
+					written += send_bytes(sink, data, transmit::FRAME_SIZE, transmit::frame_time(timeline, frame));
+				}
+			}
+			break;
+		}
+	}
+	return written;
+}
+
+}
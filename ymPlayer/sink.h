@@ -0,0 +1,72 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include "psg.h"
+#include "transmit.h"
+#include "wav.h"
+
+namespace sink
+{
+
+enum SinkType
+{
+	SINK_UART,
+	SINK_NULL,
+	SINK_CAPTURE,
+	SINK_SYNTH,
+};
+
+// capture file layout: "YMCP", uint16 version, uint16 reserved, then one
+// record per send: uint32 delta time (us), uint16 size, size bytes.
+// All values little endian.
+static const uint32_t CAPTURE_VERSION = 1;
+static const uint32_t CAPTURE_BUFFER_SIZE = 64 * 1024;
+static const uint32_t SYNTH_BLOCK_SIZE = 1024;
+
+struct Sink
+{
+	SinkType type;
+	void *handle;
+	uint64_t bytes_sent;
+	uint32_t sends;
+
+	// capture
+	FILE *file;
+	uint8_t *write_buffer;
+	uint32_t write_offset;
+	uint64_t last_time_us;
+
+	// synth
+	psg::Chip *chip;
+	wav::Writer wav;
+	uint64_t samples_rendered;
+	float *sample_buffer;
+	// digidrums started, and how far from their playback time the chip
+	// started them
+	uint64_t drum_starts;
+	double drum_start_error_us_sum;
+	double drum_start_error_us_max;
+};
+
+bool open_uart(Sink &sink, const char *port, uint32_t baud_rate);
+bool open_null(Sink &sink);
+bool open_capture(Sink &sink, const char *filename);
+bool open_synth(Sink &sink, const char *wav_filename, psg::ChipType type, uint32_t clock, uint32_t sample_rate);
+void close(Sink &sink);
+
+// time_us is the playback time the bytes belong to, not the wall clock, so
+// captures of the same tune are byte identical between runs.
+int send_bytes(Sink &sink, uint8_t *buffer, uint32_t size, uint64_t time_us);
+// the frames of a batch, one vectored write on a uart. Captures and the
+// synth still get one send per frame at its own playback time.
+int send_batch(Sink &sink, const transmit::Batch &batch, const transmit::Timeline &timeline);
+
+// only the synth plays digidrums, a uart device gets the register frames
+// and has no way to receive the samples
+bool plays_digidrums(const Sink &sink);
+// starts a digidrum on voice 0-2 after the frame sent for time_us, levels
+// must stay valid until stop_digidrums
+void play_digidrum(Sink &sink, uint32_t voice, const uint8_t *levels, uint32_t length, uint32_t rate, uint64_t time_us);
+void stop_digidrums(Sink &sink);
+
+}
@@ -0,0 +1,257 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "status.h"
+
+namespace status
+{
+
+static const uint32_t FRESH = 4;
+static const uint32_t INDEX_MASK = 3;
+// unchanged cells between two changes are written over when skipping
+// them would take about as many bytes of escapes
+static const uint32_t MIN_SKIP = 6;
+static const uint32_t METER_CELLS = 15;
+// C1 to C8 in four semitone cells
+static const uint32_t PITCH_CELLS = 22;
+static const int PITCH_LOW = 24;
+static const int PITCH_HIGH = 108;
+
+static const char *const note_names[12] = { "C-", "C#", "D-", "D#", "E-", "F-", "F#", "G-", "G#", "A-", "A#", "B-" };
+
+static void format_channel(const Snapshot &snapshot, int channel, char *row)
+{
+	const uint8_t *regs = snapshot.registers;
+	uint32_t level = regs[8 + channel] & 0x0f;
+	bool envelope = (regs[8 + channel] & 0x10) != 0;
+	bool tone = !(regs[7] & (1 << channel));
+	bool noise = !(regs[7] & (8 << channel));
+	uint32_t period = ((regs[channel * 2 + 1] & 0x0f) << 8) | regs[channel * 2];
+	bool audible = envelope || level > 0;
+
+	char meter[METER_CELLS + 1];
+	for (uint32_t i = 0; i < METER_CELLS; ++i)
+		meter[i] = envelope ? '~' : (i < level ? '#' : '.');
+	meter[METER_CELLS] = 0;
+
+	char level_text[4];
+	if (envelope)
+		strcpy(level_text, "env");
+	else
+		sprintf(level_text, "%3u", level);
+
+	char pitch[PITCH_CELLS + 1];
+	memset(pitch, '.', PITCH_CELLS);
+	pitch[PITCH_CELLS] = 0;
+	char note[32] = "";
+	if (audible && tone && period > 0 && snapshot.clock > 0) {
+		double frequency = snapshot.clock / (16.0 * period);
+		int midi = (int)floor(69.0 + 12.0 * log2(frequency / 440.0) + 0.5);
+		if (midi >= 0)
+			sprintf(note, "%s%d %7.1f Hz", note_names[midi % 12], midi / 12 - 1, frequency);
+		int cell = (midi - PITCH_LOW) * (int)PITCH_CELLS / (PITCH_HIGH - PITCH_LOW);
+		cell = cell < 0 ? 0 : (cell >= (int)PITCH_CELLS ? PITCH_CELLS - 1 : cell);
+		pitch[cell] = '|';
+	}
+
+	snprintf(row, COLUMNS + 1, "%c %s %s [%s] %-17s %-4s %s", 'A' + channel, meter, level_text, pitch, note,
+		audible && tone ? "tone" : "", audible && noise ? "noise" : "");
+}
+
+void format(const Snapshot &snapshot, char rows[ROWS][COLUMNS + 1])
+{
+	uint32_t rate = snapshot.frame_rate ? snapshot.frame_rate : 50;
+	uint32_t position = snapshot.frame / rate;
+	uint32_t length = snapshot.frame_count / rate;
+	const char *state = snapshot.frame_count == 0 ? "Idle" : (snapshot.is_playing ? "Playing" : "Stopped");
+	snprintf(rows[0], COLUMNS + 1, "%s: %02u:%02u / %02u:%02u - frame: %u/%u - bytes sent: %llu - late: %llu", state,
+		position / 60, position % 60, length / 60, length % 60, snapshot.frame, snapshot.frame_count,
+		(unsigned long long)snapshot.bytes_sent, (unsigned long long)snapshot.late_frames);
+	for (int c = 0; c < 3; ++c)
+		format_channel(snapshot, c, rows[c + 1]);
+
+	for (uint32_t r = 0; r < ROWS; ++r) {
+		size_t length = strlen(rows[r]);
+		memset(rows[r] + length, ' ', COLUMNS - length);
+		rows[r][COLUMNS] = 0;
+	}
+}
+
+Renderer::Renderer() : _back(0), _front(2), _latest(1), _running(false), _quit(false), _output_size(0), _cursor_row(0),
+	_console(nullptr), _origin_x(0), _origin_y(0)
+{
+	memset(_buffers, 0, sizeof(_buffers));
+	memset(_screen, ' ', sizeof(_screen));
+}
+
+Renderer::~Renderer()
+{
+	stop();
+}
+
+bool Renderer::start()
+{
+	if (_running)
+		return true;
+
+#ifdef _WIN32
+	HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+	CONSOLE_SCREEN_BUFFER_INFO info;
+	if (!GetConsoleScreenBufferInfo(console, &info))
+		return false;
+	for (uint32_t r = 0; r < ROWS; ++r)
+		printf("\n");
+	fflush(stdout);
+	GetConsoleScreenBufferInfo(console, &info);
+	_console = console;
+	_origin_x = 0;
+	_origin_y = (int16_t)(info.dwCursorPosition.Y - ROWS);
+#else
+	if (!isatty(STDOUT_FILENO))
+		return false;
+	for (uint32_t r = 0; r < ROWS; ++r)
+		printf("\n");
+	fflush(stdout);
+	_cursor_row = ROWS;
+#endif
+
+	// the reserved rows start out blank
+	for (uint32_t r = 0; r < ROWS; ++r) {
+		memset(_screen[r], ' ', COLUMNS);
+		_screen[r][COLUMNS] = 0;
+	}
+	_quit = false;
+	_running = true;
+	_thread = std::thread(&Renderer::thread_main, this);
+	return true;
+}
+
+void Renderer::stop()
+{
+	if (!_running)
+		return;
+	_quit = true;
+	_thread.join();
+
+	if (_latest.load(std::memory_order_acquire) & FRESH)
+		_front = _latest.exchange(_front, std::memory_order_acq_rel) & INDEX_MASK;
+	paint(_buffers[_front]);
+
+#ifndef _WIN32
+	// back to the line below the status
+	char *out = _output;
+	if (_cursor_row < ROWS)
+		out += sprintf(out, "\x1b[%uB", ROWS - _cursor_row);
+	*out++ = '\r';
+	ssize_t written = write(STDOUT_FILENO, _output, out - _output);
+	(void)written;
+	_cursor_row = ROWS;
+#endif
+	_running = false;
+}
+
+void Renderer::publish(const player::Player &player, uint32_t frame)
+{
+	if (!_running)
+		return;
+
+	Snapshot &snapshot = _buffers[_back];
+	const YMTune &tune = player.tune;
+	snapshot.is_playing = player.is_playing;
+	snapshot.frame = frame;
+	snapshot.frame_count = tune.header.frame_count;
+	snapshot.frame_rate = tune.header.frame_rate;
+	snapshot.clock = tune.header.clock;
+	snapshot.bytes_sent = player.bytes_sent;
+	snapshot.late_frames = player.late_frames;
+	if (tune.data.registers && frame < tune.header.frame_count)
+		memcpy(snapshot.registers, tune.data.registers + frame * 16, 16);
+	else
+		memset(snapshot.registers, 0, 16);
+
+	_back = _latest.exchange(_back | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+}
+
+void Renderer::thread_main()
+{
+	auto period = std::chrono::microseconds(1000000 / RENDER_HZ);
+	auto next = std::chrono::steady_clock::now();
+	while (!_quit) {
+		if (_latest.load(std::memory_order_acquire) & FRESH)
+			_front = _latest.exchange(_front, std::memory_order_acq_rel) & INDEX_MASK;
+		paint(_buffers[_front]);
+
+		next += period;
+		std::this_thread::sleep_until(next);
+	}
+}
+
+void Renderer::paint(const Snapshot &snapshot)
+{
+	char rows[ROWS][COLUMNS + 1];
+	format(snapshot, rows);
+
+	_output_size = 0;
+	for (uint32_t r = 0; r < ROWS; ++r) {
+		uint32_t c = 0;
+		while (c < COLUMNS) {
+			if (rows[r][c] == _screen[r][c]) {
+				++c;
+				continue;
+			}
+			uint32_t end = c + 1;
+			uint32_t same = 0;
+			for (uint32_t i = c + 1; i < COLUMNS; ++i) {
+				if (rows[r][i] != _screen[r][i]) {
+					end = i + 1;
+					same = 0;
+				}
+				else if (++same >= MIN_SKIP) {
+					break;
+				}
+			}
+			write_cells(r, c, rows[r] + c, end - c);
+			c = end;
+		}
+		memcpy(_screen[r], rows[r], COLUMNS);
+	}
+
+#ifndef _WIN32
+	if (_output_size > 0) {
+		ssize_t written = write(STDOUT_FILENO, _output, _output_size);
+		(void)written;
+	}
+#endif
+}
+
+void Renderer::write_cells(uint32_t row, uint32_t column, const char *text, uint32_t length)
+{
+#ifdef _WIN32
+	COORD position;
+	position.X = (SHORT)(_origin_x + column);
+	position.Y = (SHORT)(_origin_y + row);
+	DWORD written;
+	WriteConsoleOutputCharacterA((HANDLE)_console, text, length, position, &written);
+#else
+	char *out = _output + _output_size;
+	if (row < _cursor_row)
+		out += sprintf(out, "\x1b[%uA", _cursor_row - row);
+	else if (row > _cursor_row)
+		out += sprintf(out, "\x1b[%uB", row - _cursor_row);
+	*out++ = '\r';
+	if (column > 0)
+		out += sprintf(out, "\x1b[%uC", column);
+	memcpy(out, text, length);
+	out += length;
+	_output_size = (uint32_t)(out - _output);
+	_cursor_row = row;
+#endif
+}
+
+}
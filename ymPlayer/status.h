@@ -0,0 +1,79 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include "player.h"
+
+// Console status line and channel meters, kept off the frame loop. The
+// output thread publishes a snapshot per frame, a copy and one atomic
+// exchange that never blocks. The renderer's own thread repaints at
+// RENDER_HZ and writes only the cells that changed, with ANSI cursor moves
+// on POSIX terminals and WriteConsoleOutputCharacterA on Windows.
+namespace status
+{
+
+static const uint32_t RENDER_HZ = 12;
+static const uint32_t ROWS = 4;
+static const uint32_t COLUMNS = 78;
+
+struct Snapshot
+{
+	bool is_playing;
+	uint32_t frame;
+	uint32_t frame_count;
+	uint16_t frame_rate;
+	uint32_t clock;
+	uint64_t bytes_sent;
+	uint64_t late_frames;
+	// of the frame last sent
+	uint8_t registers[16];
+};
+
+// the status text of a snapshot, every row padded to COLUMNS
+void format(const Snapshot &snapshot, char rows[ROWS][COLUMNS + 1]);
+
+class Renderer
+{
+public:
+	Renderer();
+	~Renderer();
+
+	// reserves ROWS lines below the cursor and starts painting. Returns
+	// false, and publish does nothing, when stdout isn't a console.
+	bool start();
+	// paints the last snapshot and leaves the cursor below the status
+	void stop();
+
+	// output thread, frame is the one just sent
+	void publish(const player::Player &player, uint32_t frame);
+
+private:
+	void thread_main();
+	void paint(const Snapshot &snapshot);
+	void write_cells(uint32_t row, uint32_t column, const char *text, uint32_t length);
+
+	// triple buffer: the output thread fills _buffers[_back] and swaps it
+	// into _latest, the renderer swaps a fresh _latest for _front
+	Snapshot _buffers[3];
+	uint32_t _back;
+	uint32_t _front;
+	std::atomic<uint32_t> _latest;
+
+	// what the console shows now
+	char _screen[ROWS][COLUMNS + 1];
+	bool _running;
+	std::atomic<bool> _quit;
+	std::thread _thread;
+
+	// POSIX, escapes for one repaint and the row the cursor is on
+	char _output[ROWS * (COLUMNS + 16) * 4];
+	uint32_t _output_size;
+	uint32_t _cursor_row;
+
+	// Windows
+	void *_console;
+	int16_t _origin_x;
+	int16_t _origin_y;
+};
+
+}
@@ -1,6 +1,8 @@
 #pragma once
 #include <stdint.h>
+#ifdef _MSC_VER
 #include <intrin.h>
+#endif
 #include <string.h>
 
 template <typename T>
@@ -8,6 +10,7 @@ inline T swap_endian(T val) {
 	return val;
 }
 
+#ifdef _MSC_VER
 template <>
 inline uint32_t swap_endian(uint32_t val) {
 	return  _byteswap_ulong(val);
@@ -22,6 +25,22 @@ template <>
 inline uint64_t swap_endian(uint64_t val) {
 	return _byteswap_uint64(val);
 }
+#else
+template <>
+inline uint32_t swap_endian(uint32_t val) {
+	return __builtin_bswap32(val);
+}
+
+template <>
+inline uint16_t swap_endian(uint16_t val) {
+	return __builtin_bswap16(val);
+}
+
+template <>
+inline uint64_t swap_endian(uint64_t val) {
+	return __builtin_bswap64(val);
+}
+#endif
 
 template <typename T>
 inline T *offset_ptr(T *ptr, int size) {
@@ -97,6 +116,10 @@ public:
 		return (_ptr);
 	}
 
+	uint32_t remaining() const {
+		return (uint32_t)(_buffer + _size - _ptr);
+	}
+
 	void skip(uint32_t size) {
 		_ptr += size;
 	}
@@ -0,0 +1,111 @@
+#include "thread_pool.h"
+#include "trace.h"
+
+static thread_local int current_worker = -1;
+
+ThreadPool::ThreadPool(uint32_t thread_count) : _next_queue(0), _queued(0), _pending(0), _quit(false)
+{
+	if (thread_count == 0)
+		thread_count = std::thread::hardware_concurrency();
+	if (thread_count == 0)
+		thread_count = 1;
+
+	for (uint32_t i = 0; i < thread_count; ++i)
+		_queues.push_back(new WorkerQueue);
+	for (uint32_t i = 0; i < thread_count; ++i)
+		_workers.push_back(std::thread(&ThreadPool::worker_main, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_quit = true;
+	}
+	_work_available.notify_all();
+
+	for (size_t i = 0; i < _workers.size(); ++i)
+		_workers[i].join();
+	for (size_t i = 0; i < _queues.size(); ++i)
+		delete _queues[i];
+}
+
+void ThreadPool::submit(Job job)
+{
+	// jobs spawned from a worker stay local, others are spread round robin
+	uint32_t index = current_worker >= 0 ? (uint32_t)current_worker : _next_queue++ % _queues.size();
+	_pending++;
+	{
+		std::lock_guard<std::mutex> lock(_queues[index]->mutex);
+		_queues[index]->jobs.push_back(std::move(job));
+	}
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_queued++;
+	}
+	_work_available.notify_one();
+}
+
+void ThreadPool::wait()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	_work_done.wait(lock, [this] { return _pending == 0; });
+}
+
+int ThreadPool::worker_index()
+{
+	return current_worker;
+}
+
+bool ThreadPool::pop_job(uint32_t index, Job &job)
+{
+	{
+		WorkerQueue &own = *_queues[index];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.jobs.empty()) {
+			job = std::move(own.jobs.back());
+			own.jobs.pop_back();
+			return true;
+		}
+	}
+
+	uint32_t count = (uint32_t)_queues.size();
+	for (uint32_t i = 1; i < count; ++i) {
+		WorkerQueue &victim = *_queues[(index + i) % count];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.jobs.empty()) {
+			job = std::move(victim.jobs.front());
+			victim.jobs.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadPool::worker_main(uint32_t index)
+{
+	current_worker = (int)index;
+	trace::set_thread_name("pool worker");
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_work_available.wait(lock, [this] { return _quit || _queued > 0; });
+			if (_queued == 0)
+				return;
+			_queued--;
+		}
+
+		// a job is reserved for us, it's in one of the queues
+		Job job;
+		while (!pop_job(index, job))
+			std::this_thread::yield();
+
+		job();
+
+		if (--_pending == 0) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			_work_done.notify_all();
+		}
+	}
+}
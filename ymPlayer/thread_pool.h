@@ -0,0 +1,51 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work stealing pool. Every worker owns a queue and pops its newest job,
+// idle workers steal the oldest job from the other queues.
+class ThreadPool
+{
+public:
+	typedef std::function<void()> Job;
+
+	// thread_count 0 uses one worker per hardware thread
+	explicit ThreadPool(uint32_t thread_count = 0);
+	~ThreadPool();
+
+	void submit(Job job);
+
+	// blocks until every submitted job has finished
+	void wait();
+
+	uint32_t thread_count() const { return (uint32_t)_workers.size(); }
+
+	// index of the calling worker in [0, thread_count), -1 outside the pool
+	static int worker_index();
+
+private:
+	struct WorkerQueue
+	{
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	void worker_main(uint32_t index);
+	bool pop_job(uint32_t index, Job &job);
+
+	std::vector<std::thread> _workers;
+	std::vector<WorkerQueue*> _queues;
+	std::mutex _mutex;
+	std::condition_variable _work_available;
+	std::condition_variable _work_done;
+	std::atomic<uint32_t> _next_queue;
+	std::atomic<uint32_t> _queued;
+	std::atomic<uint32_t> _pending;
+	bool _quit;
+};
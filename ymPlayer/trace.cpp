@@ -0,0 +1,165 @@
+#include "trace.h"
+
+#ifdef YM_TRACE
+#include <stdio.h>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+namespace trace
+{
+
+std::atomic<bool> recording(false);
+
+// single writer ring, the owning thread only ever appends. Fields are
+// relaxed atomics so write_json can read a ring while it is being written,
+// events overwritten during the copy are dropped using head.
+struct Event
+{
+	std::atomic<const char*> name;
+	std::atomic<uint64_t> start;
+	std::atomic<uint64_t> end;
+};
+
+struct Ring
+{
+	Event events[EVENTS_PER_THREAD];
+	std::atomic<uint64_t> head;
+	std::atomic<const char*> thread_name;
+	uint32_t thread_id;
+};
+
+static_assert((EVENTS_PER_THREAD & (EVENTS_PER_THREAD - 1)) == 0, "ring size must be a power of two");
+
+// rings live until exit so events of finished threads can still be written
+static std::mutex rings_mutex;
+static std::vector<Ring*> rings;
+static const uint64_t epoch_ns = now_ns();
+
+static Ring *thread_ring()
+{
+	static thread_local Ring *ring = nullptr;
+	if (!ring) {
+		Ring *created = new Ring();
+		created->head.store(0, std::memory_order_relaxed);
+		created->thread_name.store(nullptr, std::memory_order_relaxed);
+
+		std::lock_guard<std::mutex> lock(rings_mutex);
+		created->thread_id = (uint32_t)rings.size() + 1;
+		rings.push_back(created);
+		ring = created;
+	}
+	return ring;
+}
+
+uint64_t now_ns()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void set_thread_name(const char *name)
+{
+	thread_ring()->thread_name.store(name, std::memory_order_relaxed);
+}
+
+void record(const char *name, uint64_t start_ns, uint64_t end_ns)
+{
+	Ring *ring = thread_ring();
+	uint64_t head = ring->head.load(std::memory_order_relaxed);
+	Event &event = ring->events[head & (EVENTS_PER_THREAD - 1)];
+	event.name.store(name, std::memory_order_relaxed);
+	event.start.store(start_ns, std::memory_order_relaxed);
+	event.end.store(end_ns, std::memory_order_relaxed);
+	ring->head.store(head + 1, std::memory_order_release);
+}
+
+struct Copy
+{
+	const char *name;
+	uint64_t start;
+	uint64_t end;
+};
+
+static void copy_events(Ring *ring, std::vector<Copy> &events)
+{
+	uint64_t head = ring->head.load(std::memory_order_acquire);
+	uint64_t first = head > EVENTS_PER_THREAD ? head - EVENTS_PER_THREAD : 0;
+
+	events.clear();
+	for (uint64_t i = first; i < head; ++i) {
+		Event &event = ring->events[i & (EVENTS_PER_THREAD - 1)];
+		Copy copy;
+		copy.name = event.name.load(std::memory_order_relaxed);
+		copy.start = event.start.load(std::memory_order_relaxed);
+		copy.end = event.end.load(std::memory_order_relaxed);
+		events.push_back(copy);
+	}
+
+	// the writer may have lapped the oldest slots (and be writing the slot
+	// after head) while they were copied
+	std::atomic_thread_fence(std::memory_order_acquire);
+	uint64_t after = ring->head.load(std::memory_order_relaxed);
+	uint64_t valid = after + 1 > EVENTS_PER_THREAD ? after + 1 - EVENTS_PER_THREAD : 0;
+	if (valid > first) {
+		size_t drop = (size_t)(valid - first);
+		events.erase(events.begin(), events.begin() + (drop < events.size() ? drop : events.size()));
+	}
+}
+
+static void write_string(FILE *file, const char *str)
+{
+	fputc('"', file);
+	for (; *str; ++str) {
+		if (*str == '"' || *str == '\\')
+			fputc('\\', file);
+		if ((unsigned char)*str >= 0x20)
+			fputc(*str, file);
+	}
+	fputc('"', file);
+}
+
+bool write_json(const char *filename)
+{
+	FILE *file = fopen(filename, "wb");
+	if (!file)
+		return false;
+
+	std::vector<Ring*> snapshot;
+	{
+		std::lock_guard<std::mutex> lock(rings_mutex);
+		snapshot = rings;
+	}
+
+	fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	bool first = true;
+	std::vector<Copy> events;
+	for (size_t r = 0; r < snapshot.size(); ++r) {
+		Ring *ring = snapshot[r];
+		const char *thread_name = ring->thread_name.load(std::memory_order_relaxed);
+		if (thread_name) {
+			fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", first ? "" : ",", ring->thread_id);
+			write_string(file, thread_name);
+			fprintf(file, "}}");
+			first = false;
+		}
+
+		copy_events(ring, events);
+		for (size_t i = 0; i < events.size(); ++i) {
+			const Copy &event = events[i];
+			uint64_t start = event.start > epoch_ns ? event.start - epoch_ns : 0;
+			fprintf(file, "%s\n{\"name\":", first ? "" : ",");
+			write_string(file, event.name);
+			fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", ring->thread_id,
+				start / 1000.0, (event.end - event.start) / 1000.0);
+			first = false;
+		}
+	}
+	fprintf(file, "\n]}\n");
+
+	bool ok = ferror(file) == 0;
+	fclose(file);
+	return ok;
+}
+
+}
+#endif
@@ -0,0 +1,67 @@
+#pragma once
+#include <stdint.h>
+#ifdef YM_TRACE
+#include <atomic>
+#endif
+
+// Scoped trace points, written to Chrome trace event JSON (chrome://tracing,
+// ui.perfetto.dev). Built only with YM_TRACE defined, otherwise TRACE_SCOPE
+// expands to nothing and the functions below are empty.
+//
+// Every thread records into its own ring buffer, so a trace point is two
+// clock reads and a store. Rings keep the newest EVENTS_PER_THREAD events.
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#ifdef YM_TRACE
+#define TRACE_SCOPE(name) trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name)
+#endif
+
+namespace trace
+{
+
+static const uint32_t EVENTS_PER_THREAD = 8192;
+
+#ifdef YM_TRACE
+
+extern std::atomic<bool> recording;
+
+// recording starts disabled, names must be string literals
+inline void set_enabled(bool enabled) { recording.store(enabled, std::memory_order_relaxed); }
+inline bool is_enabled() { return recording.load(std::memory_order_relaxed); }
+void set_thread_name(const char *name);
+
+uint64_t now_ns();
+void record(const char *name, uint64_t start_ns, uint64_t end_ns);
+
+// writes the events of every thread recorded so far, can be called while
+// other threads keep recording
+bool write_json(const char *filename);
+
+class Scope
+{
+public:
+	explicit Scope(const char *name) : _name(name), _start(is_enabled() ? now_ns() : 0) {}
+	~Scope() {
+		if (_start)
+			record(_name, _start, now_ns());
+	}
+
+private:
+	const char *_name;
+	uint64_t _start;
+};
+
+#else
+
+inline void set_enabled(bool) {}
+inline bool is_enabled() { return false; }
+inline void set_thread_name(const char *) {}
+inline bool write_json(const char *) { return false; }
+
+#endif
+
+}
@@ -0,0 +1,76 @@
+#include <string.h>
+#include "transmit.h"
+
+namespace transmit
+{
+
+void build(Plan &plan, const YMTune &tune)
+{
+	const YMHeader &header = tune.header;
+	plan.registers = (const uint8_t*)tune.data.registers;
+	plan.special_registers = (const uint8_t*)tune.data.special_registers;
+	plan.frame_count = plan.registers ? header.frame_count : 0;
+	plan.loop_frame = header.loop_frame < plan.frame_count ? header.loop_frame : 0;
+	plan.loop_length = plan.frame_count - plan.loop_frame;
+	plan.unrolled_frames = 0;
+
+	// a chunk starting anywhere in the loop then fits in one span
+	if (plan.loop_length > 0 && plan.loop_length < CHUNK_FRAMES) {
+		plan.unrolled_frames = CHUNK_FRAMES + plan.loop_length - 1;
+		const uint8_t *loop = plan.registers + plan.loop_frame * FRAME_SIZE;
+		const uint8_t *loop_special = plan.special_registers + plan.loop_frame * FRAME_SIZE;
+		for (uint32_t i = 0; i < plan.unrolled_frames; i += plan.loop_length) {
+			uint32_t frames = plan.unrolled_frames - i < plan.loop_length ? plan.unrolled_frames - i : plan.loop_length;
+			memcpy(plan.unrolled + i * FRAME_SIZE, loop, frames * FRAME_SIZE);
+			memcpy(plan.unrolled_special + i * FRAME_SIZE, loop_special, frames * FRAME_SIZE);
+		}
+	}
+}
+
+// frames from frame on of registers and the special registers next to them
+static void add_span(Batch &batch, const uint8_t *registers, const uint8_t *special_registers, uint32_t frame, uint32_t frame_count)
+{
+	Span &span = batch.spans[batch.span_count++];
+	span.data = registers + frame * FRAME_SIZE;
+	span.special = special_registers + frame * FRAME_SIZE;
+	span.frame_count = frame_count;
+	batch.frame_count += frame_count;
+}
+
+uint32_t take(const Plan &plan, uint32_t frame, uint32_t count, Batch &batch)
+{
+	batch.span_count = 0;
+	batch.frame_count = 0;
+	batch.wraps = 0;
+	if (count > CHUNK_FRAMES)
+		count = CHUNK_FRAMES;
+	if (count == 0 || frame >= plan.frame_count)
+		return frame;
+
+	if (plan.unrolled_frames > 0 && frame >= plan.loop_frame) {
+		uint32_t offset = frame - plan.loop_frame;
+		add_span(batch, plan.unrolled, plan.unrolled_special, offset, count);
+		batch.wraps = (offset + count) / plan.loop_length;
+		return plan.loop_frame + (offset + count) % plan.loop_length;
+	}
+
+	uint32_t first = plan.frame_count - frame < count ? plan.frame_count - frame : count;
+	add_span(batch, plan.registers, plan.special_registers, frame, first);
+	if (frame + first < plan.frame_count)
+		return frame + first;
+
+	batch.wraps = 1;
+	uint32_t rest = count - first;
+	if (rest == 0)
+		return plan.loop_frame;
+	// rest is less than a chunk, so it never passes the end of a long loop
+	if (plan.unrolled_frames > 0) {
+		add_span(batch, plan.unrolled, plan.unrolled_special, 0, rest);
+		batch.wraps += rest / plan.loop_length;
+		return plan.loop_frame + rest % plan.loop_length;
+	}
+	add_span(batch, plan.registers, plan.special_registers, plan.loop_frame, rest);
+	return plan.loop_frame + rest;
+}
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <stdint.h>
+#include "ym.h"
+
+// Playback order of a tune as spans of wire-ready frames. Processed registers
+// already are the 16 byte wire encoding, so spans point into the tune and the
+// wrap to the loop frame is a span boundary rather than a test per frame.
+// Loops shorter than a chunk are unrolled once into the plan so a chunk never
+// needs more than two spans.
+namespace transmit
+{
+
+static const uint32_t FRAME_SIZE = 16;
+// most frames in one batch, what the unpaced loop hands the sink at once
+static const uint32_t CHUNK_FRAMES = 512;
+static const uint32_t MAX_SPANS = 2;
+static const uint32_t UNROLLED_MAX = CHUNK_FRAMES * 2;
+
+struct Span
+{
+	const uint8_t *data;
+	// the same frames' special registers, which say whether the envelope
+	// shape is written (see is_envelope_write)
+	const uint8_t *special;
+	uint32_t frame_count;
+};
+
+struct Batch
+{
+	Span spans[MAX_SPANS];
+	uint32_t span_count;
+	uint32_t frame_count;
+	// times the batch goes from the last frame back to the loop frame
+	uint32_t wraps;
+};
+
+// frame i of a batch belongs to playback time start_us + (first_frame + i) * 1000000 / frame_rate
+struct Timeline
+{
+	uint64_t start_us;
+	uint64_t first_frame;
+	uint16_t frame_rate;
+};
+
+inline uint64_t frame_time(const Timeline &timeline, uint32_t i)
+{
+	return timeline.start_us + (timeline.first_frame + i) * 1000000 / timeline.frame_rate;
+}
+
+struct Plan
+{
+	const uint8_t *registers;
+	const uint8_t *special_registers;
+	uint32_t frame_count;
+	uint32_t loop_frame;
+	uint32_t loop_length;
+	// a short loop repeated to at least CHUNK_FRAMES + loop_length frames,
+	// zero when the loop is read from the tune
+	uint32_t unrolled_frames;
+	uint8_t unrolled[UNROLLED_MAX * FRAME_SIZE];
+	uint8_t unrolled_special[UNROLLED_MAX * FRAME_SIZE];
+};
+
+// registers must be processed, the plan points into them
+void build(Plan &plan, const YMTune &tune);
+
+// up to CHUNK_FRAMES frames starting at frame, returns the frame after them
+uint32_t take(const Plan &plan, uint32_t frame, uint32_t count, Batch &batch);
+
+}
@@ -0,0 +1,203 @@
+#include <string.h>
+#include "tune_cache.h"
+#include "fs.h"
+#include "pages.h"
+#include "trace.h"
+
+namespace tune_cache
+{
+
+static const uint64_t PRIME1 = 0x9e3779b185ebca87ull;
+static const uint64_t PRIME2 = 0xc2b2ae3d27d4eb4full;
+
+static inline uint64_t rotl(uint64_t v, int bits)
+{
+	return (v << bits) | (v >> (64 - bits));
+}
+
+static inline uint64_t read_u64(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static inline uint64_t accumulate(uint64_t acc, uint64_t input)
+{
+	return rotl(acc + input * PRIME2, 31) * PRIME1;
+}
+
+uint64_t hash_bytes(const void *data, size_t size)
+{
+	TRACE_SCOPE("tune_cache::hash_bytes");
+	const uint8_t *p = (const uint8_t*)data;
+	const uint8_t *end = p + size;
+
+	// four independent lanes so the multiplies overlap
+	uint64_t h = PRIME1 ^ size;
+	if (size >= 32) {
+		uint64_t v1 = h + PRIME1 + PRIME2;
+		uint64_t v2 = h + PRIME2;
+		uint64_t v3 = h;
+		uint64_t v4 = h - PRIME1;
+		for (; end - p >= 32; p += 32) {
+			v1 = accumulate(v1, read_u64(p));
+			v2 = accumulate(v2, read_u64(p + 8));
+			v3 = accumulate(v3, read_u64(p + 16));
+			v4 = accumulate(v4, read_u64(p + 24));
+		}
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+	}
+	for (; end - p >= 8; p += 8)
+		h = accumulate(h, read_u64(p));
+	for (; p < end; ++p)
+		h = rotl(h ^ (*p * PRIME1), 11) * PRIME2;
+
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME1;
+	h ^= h >> 32;
+	return h;
+}
+
+uint64_t tune_bytes(const YMTune &tune)
+{
+	uint64_t bytes = sizeof(YMTune) + 2ull * tune.header.frame_count * tune.data.register_stride + tune.data.digidrums_size;
+	if (tune.song_info.name)
+		bytes += strlen(tune.song_info.name) + 1;
+	if (tune.song_info.author)
+		bytes += strlen(tune.song_info.author) + 1;
+	if (tune.song_info.description)
+		bytes += strlen(tune.song_info.description) + 1;
+	return bytes;
+}
+
+// a tune used in place holds everything in its storage
+static void lock_tune(const YMTune &tune)
+{
+	if (tune.storage) {
+		pages::lock(tune.storage);
+		return;
+	}
+	if (tune.data.registers)
+		pages::lock(tune.data.registers);
+	if (tune.data.special_registers)
+		pages::lock(tune.data.special_registers);
+	if (tune.data.digidrums)
+		pages::lock(tune.data.digidrums);
+}
+
+static void destroy_tune(const YMTune *tune)
+{
+	destroy_ym_tune(*const_cast<YMTune*>(tune));
+	delete tune;
+}
+
+Cache::Cache(uint64_t budget) : _budget(budget), _locked(false), _bytes(0), _hits(0), _misses(0), _evictions(0)
+{
+}
+
+loader::LoadResult Cache::load(const char *filename, Handle &tune, bool *hit)
+{
+	char *data;
+	uint32_t size;
+	if (!fs::read_file(filename, data, size))
+		return loader::LOAD_FILE_ERROR;
+
+	uint64_t hash = hash_bytes(data, size);
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto found = _index.find(hash);
+		if (found != _index.end() && found->second->file_size == size) {
+			_items.splice(_items.begin(), _items, found->second);
+			tune = found->second->tune;
+			_hits++;
+			if (hit)
+				*hit = true;
+			pages::release(data);
+			return loader::LOAD_OK;
+		}
+		_misses++;
+	}
+	if (hit)
+		*hit = false;
+
+	YMTune decoded;
+	loader::LoadResult result = loader::create_tune(data, size, decoded);
+	if (result != loader::LOAD_OK)
+		return result;
+	if (_locked)
+		lock_tune(decoded);
+	Handle created(new YMTune(decoded), destroy_tune);
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto found = _index.find(hash);
+	if (found != _index.end()) {
+		// decoded by another thread meanwhile, or a hash collision which
+		// the newer file wins
+		if (found->second->file_size == size) {
+			tune = found->second->tune;
+			return loader::LOAD_OK;
+		}
+		_bytes -= found->second->bytes;
+		_items.erase(found->second);
+		_index.erase(found);
+	}
+
+	Item item = { hash, size, tune_bytes(decoded), created };
+	_items.push_front(item);
+	_index[hash] = _items.begin();
+	_bytes += item.bytes;
+	tune = created;
+	evict();
+	return loader::LOAD_OK;
+}
+
+void Cache::evict()
+{
+	// tunes still held elsewhere stay, even if that leaves the cache over
+	// budget until they're released
+	auto it = _items.end();
+	while (_bytes > _budget && it != _items.begin()) {
+		--it;
+		if (it->tune.use_count() > 1)
+			continue;
+		_bytes -= it->bytes;
+		_index.erase(it->hash);
+		it = _items.erase(it);
+		_evictions++;
+	}
+}
+
+void Cache::set_budget(uint64_t budget)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_budget = budget;
+	evict();
+}
+
+void Cache::set_locked(bool locked)
+{
+	_locked = locked;
+}
+
+Stats Cache::stats()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	Stats stats;
+	stats.hits = _hits;
+	stats.misses = _misses;
+	stats.evictions = _evictions;
+	stats.bytes = _bytes;
+	stats.budget = _budget;
+	stats.entries = (uint32_t)_items.size();
+	stats.in_use = 0;
+	for (const Item &item : _items) {
+		if (item.tune.use_count() > 1)
+			stats.in_use++;
+	}
+	return stats;
+}
+
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "loader.h"
+#include "ym.h"
+
+// Decoded tunes kept in memory, keyed by a hash of the file contents so a
+// renamed or copied file still hits and an edited one doesn't. Tunes are
+// handed out as shared handles, the cache evicts least recently used tunes
+// over its byte budget but never one that somebody still holds.
+namespace tune_cache
+{
+
+static const uint64_t DEFAULT_BUDGET = 64 * 1024 * 1024;
+
+// destroys the tune with the last reference
+typedef std::shared_ptr<const YMTune> Handle;
+
+struct Stats
+{
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t bytes;
+	uint64_t budget;
+	uint32_t entries;
+	// held outside the cache, can't be evicted right now
+	uint32_t in_use;
+};
+
+uint64_t hash_bytes(const void *data, size_t size);
+
+// memory a decoded tune holds, registers and strings
+uint64_t tune_bytes(const YMTune &tune);
+
+// thread safe, files are read and decoded outside the lock
+class Cache
+{
+public:
+	explicit Cache(uint64_t budget = DEFAULT_BUDGET);
+
+	// reads filename and returns the tune decoded from the same contents
+	// earlier, or decodes it and adds it. hit is optional.
+	loader::LoadResult load(const char *filename, Handle &tune, bool *hit = nullptr);
+
+	// evicts right away if the cache is now over budget
+	void set_budget(uint64_t budget);
+	// tunes decoded from now on are locked in memory (see pages::lock) so
+	// playing them never page faults
+	void set_locked(bool locked);
+	Stats stats();
+
+private:
+	struct Item
+	{
+		uint64_t hash;
+		uint32_t file_size;
+		uint64_t bytes;
+		Handle tune;
+	};
+	typedef std::list<Item> ItemList;
+
+	// with _mutex held
+	void evict();
+
+	std::mutex _mutex;
+	// most recently used first
+	ItemList _items;
+	std::unordered_map<uint64_t, ItemList::iterator> _index;
+	uint64_t _budget;
+	std::atomic<bool> _locked;
+	uint64_t _bytes;
+	uint64_t _hits;
+	uint64_t _misses;
+	uint64_t _evictions;
+};
+
+}
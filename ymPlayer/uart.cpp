@@ -1,14 +1,25 @@
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#else
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
 #include "uart.h"
+#include "trace.h"
 
 namespace uart
 {
 
+#ifdef _WIN32
+
 void *open(const char *port, uint32_t baud_rate)
 {
 	HANDLE serial_comm = CreateFileA(port, GENERIC_READ | GENERIC_WRITE, 0, 0, OPEN_EXISTING, 0, 0);
-	
+
 	DCB dcb;
 	dcb.DCBlength = sizeof(dcb);
 	GetCommState(serial_comm, &dcb);
@@ -30,9 +41,99 @@ int send_byte(void *handle, uint8_t b)
 
 int send_bytes(void *handle, uint8_t *buffer, uint32_t size)
 {
+	TRACE_SCOPE("uart::send_bytes");
 	DWORD written;
 	WriteFile(handle, buffer, size, &written, nullptr);
 	return written;
 }
 
-}
\ No newline at end of file
+// serial handles can't take WriteFileGather, which wants whole pages
+int send_buffers(void *handle, const uint8_t *const *buffers, const uint32_t *sizes, uint32_t count)
+{
+	TRACE_SCOPE("uart::send_buffers");
+	int total = 0;
+	for (uint32_t i = 0; i < count; ++i) {
+		DWORD written;
+		WriteFile(handle, buffers[i], sizes[i], &written, nullptr);
+		total += written;
+		if (written < sizes[i])
+			break;
+	}
+	return total;
+}
+
+#else
+
+static speed_t baud_constant(uint32_t baud_rate)
+{
+	switch (baud_rate) {
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+	}
+	return B57600;
+}
+
+// handles are file descriptors, (void*)-1 on failure like INVALID_HANDLE_VALUE
+void *open(const char *port, uint32_t baud_rate)
+{
+	int fd = ::open(port, O_RDWR | O_NOCTTY);
+	if (fd < 0)
+		return (void*)-1;
+
+	termios tty;
+	if (tcgetattr(fd, &tty) == 0) {
+		cfmakeraw(&tty);
+		cfsetispeed(&tty, baud_constant(baud_rate));
+		cfsetospeed(&tty, baud_constant(baud_rate));
+		tcsetattr(fd, TCSANOW, &tty);
+	}
+	return (void*)(intptr_t)fd;
+}
+
+void close(void *handle) {
+	::close((int)(intptr_t)handle);
+}
+
+int send_byte(void *handle, uint8_t b)
+{
+	return send_bytes(handle, &b, 1);
+}
+
+int send_bytes(void *handle, uint8_t *buffer, uint32_t size)
+{
+	TRACE_SCOPE("uart::send_bytes");
+	ssize_t written = write((int)(intptr_t)handle, buffer, size);
+	return written < 0 ? 0 : (int)written;
+}
+
+int send_buffers(void *handle, const uint8_t *const *buffers, const uint32_t *sizes, uint32_t count)
+{
+	TRACE_SCOPE("uart::send_buffers");
+	static const uint32_t MAX_IOV = 16;
+	int total = 0;
+	for (uint32_t first = 0; first < count; first += MAX_IOV) {
+		iovec iov[MAX_IOV];
+		uint32_t n = count - first < MAX_IOV ? count - first : MAX_IOV;
+		size_t size = 0;
+		for (uint32_t i = 0; i < n; ++i) {
+			iov[i].iov_base = (void*)buffers[first + i];
+			iov[i].iov_len = sizes[first + i];
+			size += sizes[first + i];
+		}
+		ssize_t written = writev((int)(intptr_t)handle, iov, (int)n);
+		if (written < 0)
+			break;
+		total += (int)written;
+		if ((size_t)written < size)
+			break;
+	}
+	return total;
+}
+
+#endif
+
+}
@@ -8,6 +8,8 @@ void *open(const char *port, uint32_t baud_rate);
 void close(void *handle);
 int send_byte(void *handle, uint8_t b);
 int send_bytes(void *handle, uint8_t *buffer, uint32_t size);
+// buffers in order, as one writev where there is one
+int send_buffers(void *handle, const uint8_t *const *buffers, const uint32_t *sizes, uint32_t count);
 
 
 }
\ No newline at end of file
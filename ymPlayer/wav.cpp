@@ -0,0 +1,133 @@
+#include <string.h>
+#include <math.h>
+#include "wav.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE2 1
+#include <emmintrin.h>
+#else
+#define USE_SSE2 0
+#endif
+
+namespace wav
+{
+
+static const uint32_t HEADER_SIZE = 44;
+
+static void put_u16(uint8_t *dst, uint16_t val)
+{
+	dst[0] = val & 0xff;
+	dst[1] = (val >> 8) & 0xff;
+}
+
+static void put_u32(uint8_t *dst, uint32_t val)
+{
+	dst[0] = val & 0xff;
+	dst[1] = (val >> 8) & 0xff;
+	dst[2] = (val >> 16) & 0xff;
+	dst[3] = (val >> 24) & 0xff;
+}
+
+static void make_header(Writer &writer, uint8_t *header)
+{
+	uint16_t block_align = writer.channels * 2;
+	memcpy(header, "RIFF", 4);
+	put_u32(header + 4, 36 + writer.data_bytes);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	put_u32(header + 16, 16);
+	put_u16(header + 20, 1);
+	put_u16(header + 22, writer.channels);
+	put_u32(header + 24, writer.sample_rate);
+	put_u32(header + 28, writer.sample_rate * block_align);
+	put_u16(header + 32, block_align);
+	put_u16(header + 34, 16);
+	memcpy(header + 36, "data", 4);
+	put_u32(header + 40, writer.data_bytes);
+}
+
+static void flush(Writer &writer)
+{
+	if (writer.offset > 0) {
+		fwrite(writer.buffer, 1, writer.offset, writer.file);
+		writer.offset = 0;
+	}
+}
+
+bool open(Writer &writer, const char *filename, uint32_t sample_rate, uint16_t channels, uint32_t buffer_size)
+{
+	memset(&writer, 0, sizeof(Writer));
+	writer.file = fopen(filename, "wb");
+	if (!writer.file)
+		return false;
+
+	setvbuf(writer.file, nullptr, _IONBF, 0);
+	writer.sample_rate = sample_rate;
+	writer.channels = channels;
+	writer.buffer_size = buffer_size < HEADER_SIZE ? HEADER_SIZE : buffer_size & ~15U;
+	writer.buffer = new uint8_t[writer.buffer_size];
+
+	// placeholder, rewritten with the final sizes on close
+	make_header(writer, writer.buffer);
+	writer.offset = HEADER_SIZE;
+	return true;
+}
+
+// rounds to nearest like cvtps2dq does and saturates like packssdw
+static inline int16_t to_sample(float x)
+{
+	float s = x * 32767.0f;
+	if (s > 32767.0f) s = 32767.0f;
+	if (s < -32768.0f) s = -32768.0f;
+	return (int16_t)lrintf(s);
+}
+
+void write_samples(Writer &writer, const float *samples, uint32_t count)
+{
+#if USE_SSE2
+	const __m128 scale = _mm_set1_ps(32767.0f);
+#endif
+	uint32_t i = 0;
+	while (i < count) {
+		if (writer.offset + 16 > writer.buffer_size)
+			flush(writer);
+
+		uint32_t space = (writer.buffer_size - writer.offset) / 2;
+		uint32_t n = count - i < space ? count - i : space;
+		int16_t *dst = (int16_t*)(writer.buffer + writer.offset);
+
+		uint32_t j = 0;
+#if USE_SSE2
+		// convert eight at a time, packs saturates to the int16 range
+		for (; j + 8 <= n; j += 8) {
+			__m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(samples + i + j), scale));
+			__m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(samples + i + j + 4), scale));
+			_mm_storeu_si128((__m128i*)(dst + j), _mm_packs_epi32(lo, hi));
+		}
+#endif
+		for (; j < n; ++j)
+			dst[j] = to_sample(samples[i + j]);
+
+		writer.offset += n * 2;
+		writer.data_bytes += n * 2;
+		i += n;
+	}
+}
+
+bool close(Writer &writer)
+{
+	flush(writer);
+
+	uint8_t header[HEADER_SIZE];
+	make_header(writer, header);
+	fseek(writer.file, 0, SEEK_SET);
+	fwrite(header, 1, HEADER_SIZE, writer.file);
+	bool ok = ferror(writer.file) == 0;
+	if (fclose(writer.file) != 0)
+		ok = false;
+
+	delete [] writer.buffer;
+	memset(&writer, 0, sizeof(Writer));
+	return ok;
+}
+
+}
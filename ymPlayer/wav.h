@@ -0,0 +1,26 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+
+namespace wav
+{
+
+// 16 bit pcm wav writer. Samples are converted and collected in buffer and
+// written buffer_size bytes at a time, the header sizes are patched on close.
+struct Writer
+{
+	FILE *file;
+	uint8_t *buffer;
+	uint32_t buffer_size;
+	uint32_t offset;
+	uint32_t data_bytes;
+	uint32_t sample_rate;
+	uint16_t channels;
+};
+
+bool open(Writer &writer, const char *filename, uint32_t sample_rate, uint16_t channels, uint32_t buffer_size);
+void write_samples(Writer &writer, const float *samples, uint32_t count);
+// false when any write failed
+bool close(Writer &writer);
+
+}
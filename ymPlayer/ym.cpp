@@ -1,12 +1,29 @@
 #include "ym.h"
+#include "digidrum.h"
+#include "pages.h"
 #include "stream.h"
+#include "trace.h"
+#include "ymc.h"
 
+static const uint32_t YM2 = ('Y' << 24) | ('M' << 16) | ('2' << 8) | ('!');
 static const uint32_t YM3 = ('Y' << 24) | ('M' << 16) | ('3' << 8) | ('!');
+static const uint32_t YM3B = ('Y' << 24) | ('M' << 16) | ('3' << 8) | ('b');
 static const uint32_t YM4 = ('Y' << 24) | ('M' << 16) | ('4' << 8) | ('!');
 static const uint32_t YM5 = ('Y' << 24) | ('M' << 16) | ('5' << 8) | ('!');
 static const uint32_t YM6 = ('Y' << 24) | ('M' << 16) | ('6' << 8) | ('!');
+static const uint32_t YMC = ('Y' << 24) | ('M' << 16) | ('C' << 8) | ('!');
 static const uint32_t END = ('E' << 24) | ('n' << 16) | ('d' << 8) | ('!');
 
+// YM2 and YM3 hold only the registers, 14 a frame and interleaved, YM3b
+// adds the loop frame
+static const uint32_t YM3_REGISTERS = 14;
+// up to the digidrums, id included
+static const uint32_t YM4_HEADER_SIZE = 4 + 8 + 4 * 4;
+static const uint32_t YM5_HEADER_SIZE = 4 + 8 + 4 + 4 + 2 + 4 + 2 + 4 + 2;
+// versions before YM5 are all Atari ST tunes
+static const uint32_t ATARI_CLOCK = 2000000;
+static const uint16_t ATARI_FRAME_RATE = 50;
+
 static const unsigned char reg_masks[] =
 {
 	0xff,	// fine tone A
@@ -53,58 +70,260 @@ bool is_ym_file(char *buffer)
 	Stream stream(buffer, 4);
 	stream.set_endian_swap(true);
 	uint32_t id = stream.read_type<uint32_t>();
+	is_ym |= id == YM2;
 	is_ym |= id == YM3;
+	is_ym |= id == YM3B;
 	is_ym |= id == YM4;
 	is_ym |= id == YM5;
 	is_ym |= id == YM6;
+	is_ym |= id == YMC;
 	return is_ym;
 }
 
-bool load_ym5(YMTune &tune, Stream &input)
+const uint8_t *get_digidrum(const YMTune &tune, uint32_t index, uint32_t &length)
 {
-	const char *version = "YM5";
-	strcpy(tune.version, version);
+	length = 0;
+	if (!tune.data.digidrums || index >= tune.header.digidrum_count)
+		return nullptr;
+	const uint32_t *offsets = (const uint32_t*)tune.data.digidrums;
+	length = offsets[index + 1] - offsets[index];
+	return (const uint8_t*)tune.data.digidrums + offsets[index];
+}
 
-	YMHeader &header = tune.header;
-	YMSongInfo &song_info = tune.song_info;
-	YMData &data = tune.data;
+static const char *empty_string = "";
+
+// finds the end of a c string starting at offset, false if it runs past size
+static bool find_string_end(const char *buffer, uint32_t size, uint32_t &offset)
+{
+	const void *end = memchr(buffer + offset, 0, size - offset);
+	if (!end)
+		return false;
+	offset = (uint32_t)((const char*)end - buffer) + 1;
+	return true;
+}
+
+YMInfoResult read_ym_info(char *buffer, uint32_t size, uint32_t file_size, YMInfo &info)
+{
+	memset(&info, 0, sizeof(YMInfo));
+	info.name = info.author = info.description = empty_string;
+	if (size < 4)
+		return file_size < 4 ? YM_INFO_INVALID : YM_INFO_NEED_MORE;
+
+	Stream input(buffer, size);
+	input.set_endian_swap(true);
+	YMHeader &header = info.header;
+	header.id = input.read_type<uint32_t>();
+
+	uint32_t header_size = 0;
+	switch (header.id) {
+		case YM2:
+		case YM3:
+		case YM3B:
+		{
+			bool has_loop = header.id == YM3B;
+			strcpy(info.version, header.id == YM2 ? "YM2" : "YM3");
+			uint32_t data_size = file_size - 4 - (has_loop ? 4 : 0);
+			header.frame_count = file_size >= 4 + (has_loop ? 4 : 0) ? data_size / YM3_REGISTERS : 0;
+			header.attributes = YM_ATTRIBUTE_INTERLEAVED;
+			header.clock = ATARI_CLOCK;
+			header.frame_rate = ATARI_FRAME_RATE;
+			// the loop frame is at the end, only known when the whole file is here
+			if (has_loop && size == file_size && size >= 8) {
+				Stream loop(buffer, size, size - 4);
+				header.loop_frame = loop.read_type<uint32_t>();
+			}
+			return YM_INFO_OK;
+		}
+		case YM4:
+			strcpy(info.version, "YM4");
+			header_size = YM4_HEADER_SIZE;
+			break;
+		case YM5:
+			strcpy(info.version, "YM5");
+			header_size = YM5_HEADER_SIZE;
+			break;
+		case YM6:
+			strcpy(info.version, "YM6");
+			header_size = YM5_HEADER_SIZE;
+			break;
+		default:
+			return YM_INFO_INVALID;
+	}
+
+	if (size < header_size)
+		return file_size < header_size ? YM_INFO_INVALID : YM_INFO_NEED_MORE;
 
 	input.read_bytes(header.leonardo, 8);
 	header.frame_count = input.read_type<uint32_t>();
 	header.attributes = input.read_type<uint32_t>();
-	header.digidrum_count = input.read_type<uint16_t>();
-	header.clock = input.read_type<uint32_t>();
-	header.frame_rate = input.read_type<uint16_t>();
-	header.loop_frame = input.read_type<uint32_t>();
-	header.reserved = input.read_type<uint16_t>();
+	if (header.id == YM4) {
+		header.digidrum_count = (uint16_t)input.read_type<uint32_t>();
+		header.loop_frame = input.read_type<uint32_t>();
+		header.clock = ATARI_CLOCK;
+		header.frame_rate = ATARI_FRAME_RATE;
+	}
+	else {
+		header.digidrum_count = input.read_type<uint16_t>();
+		header.clock = input.read_type<uint32_t>();
+		header.frame_rate = input.read_type<uint16_t>();
+		header.loop_frame = input.read_type<uint32_t>();
+		header.reserved = input.read_type<uint16_t>();
+	}
 
-	// Todo, read digidrum samples
-	if (header.digidrum_count > 0) {
-		uint32_t size = input.read_type<uint32_t>();
-		input.skip(size);
+	uint32_t offset = header_size;
+	for (uint32_t i = 0; i < header.digidrum_count; ++i) {
+		if (offset + 4 > size)
+			return offset + 4 > file_size ? YM_INFO_INVALID : YM_INFO_NEED_MORE;
+		Stream drum(buffer, size, offset);
+		drum.set_endian_swap(true);
+		uint32_t sample_size = drum.read_type<uint32_t>();
+		offset += 4 + sample_size;
+		if (offset > file_size)
+			return YM_INFO_INVALID;
+	}
+
+	uint32_t name = offset;
+	if (offset >= size || !find_string_end(buffer, size, offset))
+		return size < file_size ? YM_INFO_NEED_MORE : YM_INFO_INVALID;
+	uint32_t author = offset;
+	if (offset >= size || !find_string_end(buffer, size, offset))
+		return size < file_size ? YM_INFO_NEED_MORE : YM_INFO_INVALID;
+	uint32_t description = offset;
+	if (offset >= size || !find_string_end(buffer, size, offset))
+		return size < file_size ? YM_INFO_NEED_MORE : YM_INFO_INVALID;
+
+	info.name = buffer + name;
+	info.author = buffer + author;
+	info.description = buffer + description;
+	return YM_INFO_OK;
+}
+
+static char *copy_string(const char *str)
+{
+	char *copy = new char[strlen(str) + 1];
+	strcpy(copy, str);
+	return copy;
+}
+
+// a copy of the string at the read position, null when it isn't terminated
+// before the end of the input
+static char *read_string(Stream &input)
+{
+	const char *start = input.ptr();
+	const char *end = (const char*)memchr(start, 0, input.remaining());
+	if (!end)
+		return nullptr;
+	input.skip((uint32_t)(end - start) + 1);
+	return copy_string(start);
+}
+
+// the registers are used in place, process_registers deinterleaves and
+// widens them to 16 a frame
+bool load_ym3(YMTune &tune, Stream &input)
+{
+	YMHeader &header = tune.header;
+	YMData &data = tune.data;
+	bool has_loop = header.id == YM3B;
+	strcpy(tune.version, header.id == YM2 ? "YM2" : "YM3");
+
+	uint32_t size = input.remaining();
+	uint32_t data_size = has_loop ? (size >= 4 ? size - 4 : 0) : size;
+	header.frame_count = data_size / YM3_REGISTERS;
+	header.attributes = YM_ATTRIBUTE_INTERLEAVED;
+	header.clock = ATARI_CLOCK;
+	header.frame_rate = ATARI_FRAME_RATE;
+
+	tune.song_info.name = copy_string("");
+	tune.song_info.author = copy_string("");
+	tune.song_info.description = copy_string("");
+
+	data.register_stride = 16;
+	data.unprocessed_regs = input.ptr();
+	data.unprocessed_registers = YM3_REGISTERS;
+	if (has_loop && size >= 4) {
+		// little endian unlike everything else in YM files
+		input.skip(data_size);
+		input.set_endian_swap(false);
+		header.loop_frame = input.read_type<uint32_t>();
 	}
+	return data_size % YM3_REGISTERS == 0;
+}
 
-	char *name = input.read_c_string();
-	song_info.name = new char[strlen(name) + 1];
-	strcpy(song_info.name, name);
+// everything after the header: digidrums, song strings and registers
+static bool load_ym_body(YMTune &tune, Stream &input)
+{
+	YMHeader &header = tune.header;
+	YMSongInfo &song_info = tune.song_info;
+	YMData &data = tune.data;
 
-	char *author = input.read_c_string();
-	song_info.author = new char[strlen(author) + 1];
-	strcpy(song_info.author, author);
+	if (header.digidrum_count > 0) {
+		data.digidrums = digidrum::read_samples(input, header.digidrum_count, header.attributes, data.digidrums_size);
+		if (!data.digidrums) {
+			// nothing after the samples can be found
+			header.frame_count = 0;
+			return false;
+		}
+	}
 
-	char *description = input.read_c_string();
-	song_info.description = new char[strlen(description) + 1];
-	strcpy(song_info.description, description);
+	song_info.name = read_string(input);
+	if (!song_info.name)
+		return false;
+	song_info.author = read_string(input);
+	if (!song_info.author)
+		return false;
+	song_info.description = read_string(input);
+	if (!song_info.description)
+		return false;
 
 	data.register_stride = 16;
 	data.unprocessed_regs = input.ptr();
+	data.unprocessed_registers = 16;
 
-	input.skip(header.frame_count * tune.data.register_stride);
+	// the registers and the end marker
+	if ((uint64_t)header.frame_count * data.unprocessed_registers + 4 > input.remaining())
+		return false;
+	input.skip(header.frame_count * data.unprocessed_registers);
 
 	uint32_t end_marker = input.read_type<uint32_t>();
 	return end_marker == END;
 }
 
+bool load_ym4(YMTune &tune, Stream &input)
+{
+	strcpy(tune.version, "YM4");
+	if (input.remaining() < YM4_HEADER_SIZE - 4)
+		return false;
+
+	YMHeader &header = tune.header;
+	input.read_bytes(header.leonardo, 8);
+	header.frame_count = input.read_type<uint32_t>();
+	header.attributes = input.read_type<uint32_t>();
+	header.digidrum_count = (uint16_t)input.read_type<uint32_t>();
+	header.loop_frame = input.read_type<uint32_t>();
+	header.clock = ATARI_CLOCK;
+	header.frame_rate = ATARI_FRAME_RATE;
+	return load_ym_body(tune, input);
+}
+
+bool load_ym5(YMTune &tune, Stream &input)
+{
+	const char *version = "YM5";
+	strcpy(tune.version, version);
+	if (input.remaining() < YM5_HEADER_SIZE - 4)
+		return false;
+
+	YMHeader &header = tune.header;
+	input.read_bytes(header.leonardo, 8);
+	header.frame_count = input.read_type<uint32_t>();
+	header.attributes = input.read_type<uint32_t>();
+	header.digidrum_count = input.read_type<uint16_t>();
+	header.clock = input.read_type<uint32_t>();
+	header.frame_rate = input.read_type<uint16_t>();
+	header.loop_frame = input.read_type<uint32_t>();
+	header.reserved = input.read_type<uint16_t>();
+	return load_ym_body(tune, input);
+}
+
 bool load_ym6(YMTune &tune, Stream &input)
 {
 	if (load_ym5(tune, input)) {
@@ -119,67 +338,113 @@ bool load_ym6(YMTune &tune, Stream &input)
 
 void process_registers(YMData &data, uint32_t frame_count, bool deinterleave)
 {
-	data.registers = new char[frame_count * data.register_stride];
-	data.special_registers = new char[frame_count * data.register_stride];
+	TRACE_SCOPE("process_registers");
+	data.registers = pages::allocate(frame_count * data.register_stride);
+	data.special_registers = pages::allocate(frame_count * data.register_stride);
 
 	uint32_t fc = frame_count;
 	uint32_t stride = data.register_stride;
 	char *src_regs = data.unprocessed_regs;
 	char *dst_regs = data.registers;
 	char *dst_special = data.special_registers;
+	uint32_t sources = data.unprocessed_registers < stride ? data.unprocessed_registers : stride;
 
 	if (deinterleave) {
-		// deinterleave frames
+		// deinterleave frames, registers the source doesn't have are zero
 		for (uint32_t i = 0; i < fc; ++i) {
 			for (uint32_t j = 0; j < stride; ++j) {
-				*dst_special = src_regs[j * fc + i] & ~reg_masks[j];
-				*dst_regs = src_regs[j * fc + i] & reg_masks[j] | reg_fill_bits[j];
+				char value = j < sources ? src_regs[j * fc + i] : 0;
+				*dst_special = value & ~reg_masks[j];
+				*dst_regs = (value & reg_masks[j]) | reg_fill_bits[j];
 				dst_special++;
 				dst_regs++;
 			}
 		}
 	}
-	else {
+	else if (sources == stride) {
 		for (uint32_t i = 0; i < fc * stride; ++i) {
 			*dst_special = src_regs[i] & ~reg_masks[i % stride];
-			*dst_regs = src_regs[i] & reg_masks[i % stride] | reg_fill_bits[i % stride];
+			*dst_regs = (src_regs[i] & reg_masks[i % stride]) | reg_fill_bits[i % stride];
 			dst_special++;
 			dst_regs++;
 		}
 	}
+	else {
+		for (uint32_t i = 0; i < fc; ++i) {
+			for (uint32_t j = 0; j < stride; ++j) {
+				char value = j < sources ? src_regs[i * sources + j] : 0;
+				*dst_special = value & ~reg_masks[j];
+				*dst_regs = (value & reg_masks[j]) | reg_fill_bits[j];
+				dst_special++;
+				dst_regs++;
+			}
+		}
+	}
 }
 
-YMTune create_ym_tune(char *buffer, uint32_t size)
+bool create_ym_tune(char *buffer, uint32_t size, YMTune &tune)
 {
+	TRACE_SCOPE("create_ym_tune");
 	Stream input(buffer, size);
 	input.set_endian_swap(true);
 
-	YMTune tune = {};
+	memset(&tune, 0, sizeof(YMTune));
 	
 	// read header
 	tune.header.id = input.read_type<uint32_t>();
 
+	bool loaded = false;
 	switch (tune.header.id) {
+		case YMC:
+			if (!ymc::read(tune, buffer, size)) {
+				memset(&tune, 0, sizeof(YMTune));
+				return false;
+			}
+			return true;
+		case YM2:
 		case YM3:
+		case YM3B:
+			loaded = load_ym3(tune, input);
 			break;
 		case YM4:
+			loaded = load_ym4(tune, input);
 			break;
 		case YM5:
-			load_ym5(tune, input);
+			loaded = load_ym5(tune, input);
 			break;
 		case YM6:
-			load_ym6(tune, input);
+			loaded = load_ym6(tune, input);
 			break;
 	}
-	
-	process_registers(tune.data, tune.header.frame_count, tune.header.attributes & 0x1);
-	return tune;
+
+	// truncated or malformed, nothing to process
+	const YMData &data = tune.data;
+	if (!loaded || (uint64_t)tune.header.frame_count * data.unprocessed_registers > (uint64_t)(buffer + size - data.unprocessed_regs)) {
+		destroy_ym_tune(tune);
+		memset(&tune, 0, sizeof(YMTune));
+		return false;
+	}
+
+	process_registers(tune.data, tune.header.frame_count, tune.header.attributes & YM_ATTRIBUTE_INTERLEAVED);
+
+	// frames are timed by the frame rate, a tune without one can't be played
+	if (tune.header.frame_rate == 0) {
+		destroy_ym_tune(tune);
+		memset(&tune, 0, sizeof(YMTune));
+		return false;
+	}
+	return true;
 }
 
 void destroy_ym_tune(YMTune &tune)
 {
-	delete [] tune.data.registers;
-	delete [] tune.data.special_registers;
+	if (tune.storage) {
+		pages::release(tune.storage);
+		return;
+	}
+	pages::release(tune.data.registers);
+	pages::release(tune.data.special_registers);
+	pages::release(tune.data.digidrums);
 	delete [] tune.song_info.author;
 	delete [] tune.song_info.name;
 	delete [] tune.song_info.description;
@@ -21,12 +21,26 @@ struct YMSongInfo
 	char *description;
 };
 
+enum YMAttributes
+{
+	YM_ATTRIBUTE_INTERLEAVED = 1,
+	YM_ATTRIBUTE_DRUM_SIGNED = 2,
+	YM_ATTRIBUTE_DRUM_4BIT = 4,
+};
+
 struct YMData
 {
 	char *unprocessed_regs;
+	// registers a frame in unprocessed_regs, 14 for YM2/YM3
+	uint32_t unprocessed_registers;
 	char *registers;
 	char *special_registers;
 	uint32_t register_stride;
+	// every digidrum in one block, already converted to 4 bit levels:
+	// digidrum_count + 1 uint32 offsets from the start of the block, sample
+	// i runs from offsets[i] to offsets[i + 1]. Null without digidrums.
+	char *digidrums;
+	uint32_t digidrums_size;
 };
 
 struct YMTune
@@ -35,8 +49,59 @@ struct YMTune
 	YMHeader header;
 	YMSongInfo song_info;
 	YMData data;
+	// set when the tune was created in place from a cache file, data and
+	// strings point into this buffer which is owned by the tune
+	char *storage;
+};
+
+// header and song strings of a tune, strings point into the parsed buffer
+struct YMInfo
+{
+	char version[4];
+	YMHeader header;
+	const char *name;
+	const char *author;
+	const char *description;
+};
+
+enum YMInfoResult
+{
+	YM_INFO_OK,
+	YM_INFO_NEED_MORE,
+	YM_INFO_INVALID,
 };
 
+// YM files store 0xff in the envelope shape register for frames that
+// don't write it, writing the register restarts the envelope. special is
+// the 16 special registers of one frame.
+inline bool is_envelope_write(const uint8_t *special)
+{
+	return special[13] != 0xf0;
+}
+
+inline bool is_envelope_write(const YMData &data, uint32_t frame)
+{
+	return is_envelope_write((const uint8_t*)data.special_registers + frame * 16);
+}
+
 bool is_ym_file(char *buffer);
-YMTune create_ym_tune(char *buffer, uint32_t size);
+
+// levels of digidrum index, nullptr if the tune doesn't have it
+const uint8_t *get_digidrum(const YMTune &tune, uint32_t index, uint32_t &length);
+
+// reads the header and song strings without touching the register data.
+// buffer may hold just the first size bytes of a file_size byte tune,
+// YM_INFO_NEED_MORE asks for a longer prefix.
+YMInfoResult read_ym_info(char *buffer, uint32_t size, uint32_t file_size, YMInfo &info);
+// YMC cache files without packed sections are used in place, the tune then
+// owns buffer (tune.storage == buffer), which must come from pages::allocate.
+// Otherwise buffer stays the caller's. Returns false, with tune cleared, for
+// a cache file that can't be read and for tunes without a frame rate.
+bool create_ym_tune(char *buffer, uint32_t size, YMTune &tune);
 void destroy_ym_tune(YMTune &tune);
+
+// masks data.unprocessed_regs into data.registers and data.special_registers,
+// interleaved data is stored one register at a time for all frames. Sources
+// with fewer registers a frame (data.unprocessed_registers) are widened to
+// data.register_stride with the rest zero.
+void process_registers(YMData &data, uint32_t frame_count, bool deinterleave);
@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "ymc.h"
+#include "blockpack.h"
+#include "digidrum.h"
+#include "pages.h"
+
+namespace ymc
+{
+
+struct SectionData
+{
+	SectionType type;
+	const char *data;
+	uint32_t size;
+};
+
+static uint32_t align(uint32_t offset)
+{
+	return (offset + SECTION_ALIGNMENT - 1) & ~(SECTION_ALIGNMENT - 1);
+}
+
+bool write(const YMTune &tune, const char *filename, bool compress)
+{
+	const YMHeader &header = tune.header;
+	uint32_t register_size = header.frame_count * tune.data.register_stride;
+
+	InfoSection info = {};
+	memcpy(info.version, tune.version, 4);
+	info.id = header.id;
+	memcpy(info.leonardo, header.leonardo, 8);
+	info.frame_count = header.frame_count;
+	info.attributes = header.attributes;
+	info.clock = header.clock;
+	info.loop_frame = header.loop_frame;
+	info.register_stride = tune.data.register_stride;
+	info.frame_rate = header.frame_rate;
+	info.digidrum_count = header.digidrum_count;
+
+	std::string strings;
+	strings.append(tune.song_info.name ? tune.song_info.name : "");
+	strings.push_back(0);
+	strings.append(tune.song_info.author ? tune.song_info.author : "");
+	strings.push_back(0);
+	strings.append(tune.song_info.description ? tune.song_info.description : "");
+	strings.push_back(0);
+
+	SectionData sections[] =
+	{
+		{ SECTION_INFO, (const char*)&info, sizeof(InfoSection) },
+		{ SECTION_STRINGS, strings.data(), (uint32_t)strings.size() },
+		{ SECTION_REGISTERS, tune.data.registers, register_size },
+		{ SECTION_SPECIAL_REGISTERS, tune.data.special_registers, register_size },
+		{ SECTION_DIGIDRUMS, tune.data.digidrums, tune.data.digidrums_size },
+	};
+	const uint32_t section_count = sizeof(sections) / sizeof(sections[0]) - (tune.data.digidrums ? 0 : 1);
+
+	FileHeader file_header = {};
+	memcpy(file_header.id, "YMC!", 4);
+	file_header.version = VERSION;
+	file_header.section_count = section_count;
+
+	std::vector<char> packed[sizeof(sections) / sizeof(sections[0])];
+	Section table[sizeof(sections) / sizeof(sections[0])];
+	uint32_t offset = align(sizeof(FileHeader) + section_count * sizeof(Section));
+	for (uint32_t i = 0; i < section_count; ++i) {
+		Section &section = table[i];
+		memset(&section, 0, sizeof(Section));
+		section.type = sections[i].type;
+		section.unpacked_size = sections[i].size;
+		section.size = sections[i].size;
+
+		bool is_registers = sections[i].type == SECTION_REGISTERS || sections[i].type == SECTION_SPECIAL_REGISTERS;
+		if (compress && is_registers && sections[i].size > 0) {
+			packed[i].resize(blockpack::compress_bound(sections[i].size));
+			uint32_t packed_size = blockpack::compress(sections[i].data, sections[i].size, packed[i].data());
+			// keep the section raw if packing doesn't pay off
+			if (packed_size < sections[i].size) {
+				section.flags = SECTION_BLOCKPACK;
+				section.size = packed_size;
+			}
+		}
+
+		section.offset = offset;
+		offset = align(offset + section.size);
+	}
+
+	FILE *file = fopen(filename, "wb");
+	if (!file)
+		return false;
+
+	static const char padding[SECTION_ALIGNMENT] = {};
+	fwrite(&file_header, sizeof(FileHeader), 1, file);
+	fwrite(table, sizeof(Section), section_count, file);
+	uint32_t written = sizeof(FileHeader) + section_count * sizeof(Section);
+	for (uint32_t i = 0; i < section_count; ++i) {
+		fwrite(padding, 1, table[i].offset - written, file);
+		const char *data = (table[i].flags & SECTION_BLOCKPACK) ? packed[i].data() : sections[i].data;
+		fwrite(data, 1, table[i].size, file);
+		written = table[i].offset + table[i].size;
+	}
+
+	bool ok = ferror(file) == 0;
+	fclose(file);
+	return ok;
+}
+
+static const Section *find_section(const Section *table, uint32_t count, SectionType type)
+{
+	for (uint32_t i = 0; i < count; ++i) {
+		if (table[i].type == (uint32_t)type)
+			return &table[i];
+	}
+	return nullptr;
+}
+
+static char *unpack_section(char *buffer, const Section &section)
+{
+	char *data = pages::allocate(section.unpacked_size);
+	if (!blockpack::decompress(buffer + section.offset, section.size, data, section.unpacked_size)) {
+		pages::release(data);
+		return nullptr;
+	}
+	return data;
+}
+
+// raw sections are used as they are, so they must hold all of their data
+static bool has_data(const Section &section)
+{
+	return (section.flags & SECTION_BLOCKPACK) || section.size >= section.unpacked_size;
+}
+
+static char *copy_string(const char *str)
+{
+	char *copy = new char[strlen(str) + 1];
+	strcpy(copy, str);
+	return copy;
+}
+
+bool read(YMTune &tune, char *buffer, uint32_t size)
+{
+	if (size < sizeof(FileHeader))
+		return false;
+
+	const FileHeader *file_header = (const FileHeader*)buffer;
+	if (memcmp(file_header->id, "YMC!", 4) != 0 || file_header->version != VERSION)
+		return false;
+
+	uint32_t count = file_header->section_count;
+	if (sizeof(FileHeader) + (uint64_t)count * sizeof(Section) > size)
+		return false;
+
+	const Section *table = (const Section*)(buffer + sizeof(FileHeader));
+	bool packed = false;
+	for (uint32_t i = 0; i < count; ++i) {
+		if ((uint64_t)table[i].offset + table[i].size > size)
+			return false;
+		packed |= (table[i].flags & SECTION_BLOCKPACK) != 0;
+	}
+
+	const Section *info_section = find_section(table, count, SECTION_INFO);
+	const Section *strings_section = find_section(table, count, SECTION_STRINGS);
+	const Section *registers = find_section(table, count, SECTION_REGISTERS);
+	const Section *special_registers = find_section(table, count, SECTION_SPECIAL_REGISTERS);
+	if (!info_section || !strings_section || !registers || !special_registers || info_section->size < sizeof(InfoSection))
+		return false;
+
+	const InfoSection &info = *(const InfoSection*)(buffer + info_section->offset);
+	// everything indexes the registers by frame * 16, and frames are timed
+	// by the frame rate
+	uint64_t total_register_size = (uint64_t)info.frame_count * info.register_stride;
+	if (info.register_stride != 16 || info.frame_rate == 0 || total_register_size > UINT32_MAX)
+		return false;
+	uint32_t register_size = (uint32_t)total_register_size;
+	if (registers->unpacked_size != register_size || special_registers->unpacked_size != register_size ||
+		!has_data(*registers) || !has_data(*special_registers))
+		return false;
+	// caches written before digidrums were kept have none
+	const Section *digidrums = find_section(table, count, SECTION_DIGIDRUMS);
+	if (digidrums && ((digidrums->flags & SECTION_BLOCKPACK) || !has_data(*digidrums) ||
+		!digidrum::is_valid_pool(buffer + digidrums->offset, digidrums->unpacked_size, info.digidrum_count)))
+		return false;
+
+	// name, author and description, all zero terminated. The last byte is
+	// zero, so strlen stops inside the section once a string starts in it
+	const char *strings = buffer + strings_section->offset;
+	const char *strings_end = strings + strings_section->size;
+	if (strings_section->size < 3 || strings_end[-1] != 0)
+		return false;
+	const char *name = strings;
+	const char *author = name + strlen(name) + 1;
+	if (author >= strings_end)
+		return false;
+	const char *description = author + strlen(author) + 1;
+	if (description >= strings_end)
+		return false;
+
+	memcpy(tune.version, info.version, 4);
+	YMHeader &header = tune.header;
+	header.id = info.id;
+	memcpy(header.leonardo, info.leonardo, 8);
+	header.frame_count = info.frame_count;
+	header.attributes = info.attributes;
+	header.digidrum_count = info.digidrum_count;
+	header.clock = info.clock;
+	header.frame_rate = info.frame_rate;
+	header.loop_frame = info.loop_frame;
+	tune.data.register_stride = info.register_stride;
+	tune.data.unprocessed_regs = nullptr;
+	tune.data.unprocessed_registers = 0;
+	tune.data.digidrums = nullptr;
+	tune.data.digidrums_size = digidrums ? digidrums->unpacked_size : 0;
+
+	if (!packed) {
+		tune.song_info.name = (char*)name;
+		tune.song_info.author = (char*)author;
+		tune.song_info.description = (char*)description;
+		tune.data.registers = buffer + registers->offset;
+		tune.data.special_registers = buffer + special_registers->offset;
+		if (digidrums)
+			tune.data.digidrums = buffer + digidrums->offset;
+		tune.storage = buffer;
+		return true;
+	}
+
+	tune.data.registers = (registers->flags & SECTION_BLOCKPACK) ? unpack_section(buffer, *registers) : nullptr;
+	tune.data.special_registers = (special_registers->flags & SECTION_BLOCKPACK) ? unpack_section(buffer, *special_registers) : nullptr;
+	if (!(registers->flags & SECTION_BLOCKPACK)) {
+		tune.data.registers = pages::allocate(register_size);
+		memcpy(tune.data.registers, buffer + registers->offset, register_size);
+	}
+	if (!(special_registers->flags & SECTION_BLOCKPACK)) {
+		tune.data.special_registers = pages::allocate(register_size);
+		memcpy(tune.data.special_registers, buffer + special_registers->offset, register_size);
+	}
+	if (digidrums) {
+		tune.data.digidrums = pages::allocate(digidrums->unpacked_size);
+		memcpy(tune.data.digidrums, buffer + digidrums->offset, digidrums->unpacked_size);
+	}
+	tune.song_info.name = copy_string(name);
+	tune.song_info.author = copy_string(author);
+	tune.song_info.description = copy_string(description);
+	tune.storage = nullptr;
+
+	if (!tune.data.registers || !tune.data.special_registers) {
+		destroy_ym_tune(tune);
+		memset(&tune, 0, sizeof(YMTune));
+		return false;
+	}
+	return true;
+}
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <stdint.h>
+#include "ym.h"
+
+// Native cache format for fast loading. Registers are stored deinterleaved
+// and masked exactly as process_registers leaves them, so an uncompressed
+// file is used in place without any processing.
+//
+// Layout: FileHeader, Section table, sections aligned to SECTION_ALIGNMENT.
+// The id is "YMC!" like the YM ids, everything else is little endian.
+namespace ymc
+{
+
+static const uint32_t VERSION = 1;
+static const uint32_t SECTION_ALIGNMENT = 64;
+
+enum SectionType
+{
+	SECTION_INFO = 1,
+	SECTION_STRINGS,
+	SECTION_REGISTERS,
+	SECTION_SPECIAL_REGISTERS,
+	// the digidrum pool as YMData holds it, only written when there is one
+	SECTION_DIGIDRUMS,
+};
+
+enum SectionFlags
+{
+	SECTION_BLOCKPACK = 1,
+};
+
+struct FileHeader
+{
+	char id[4];
+	uint32_t version;
+	uint32_t section_count;
+	uint32_t reserved;
+};
+
+struct Section
+{
+	uint32_t type;
+	uint32_t flags;
+	uint32_t offset;
+	uint32_t size;
+	uint32_t unpacked_size;
+	uint32_t reserved;
+};
+
+struct InfoSection
+{
+	char version[4];
+	uint32_t id;
+	char leonardo[8];
+	uint32_t frame_count;
+	uint32_t attributes;
+	uint32_t clock;
+	uint32_t loop_frame;
+	uint32_t register_stride;
+	uint16_t frame_rate;
+	uint16_t digidrum_count;
+};
+
+// writes a created tune, compress packs the register sections with blockpack
+bool write(const YMTune &tune, const char *filename, bool compress);
+
+// fills tune from a cache file in buffer. Without packed sections the tune
+// points into buffer and takes ownership of it (tune.storage == buffer),
+// otherwise the data is unpacked into new allocations.
+bool read(YMTune &tune, char *buffer, uint32_t size);
+
+}
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <string>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "control.h"
+
+// command line client for the player's control socket, sends one request
+// and prints the answer
+static void print_usage()
+{
+	printf("usage: ymctl [-socket <path>] <command>\n");
+	printf("  play [file]        play file now, or resume without one\n");
+	printf("  queue <file>       play file after the current tune\n");
+	printf("  stop\n");
+	printf("  seek <frame>       or seek <seconds>s\n");
+	printf("  status\n");
+	printf("  stats\n");
+	printf("  raw <json>         send a request as is\n");
+}
+
+// the player resolves paths from its own working directory
+static std::string absolute_path(const char *path)
+{
+	char resolved[PATH_MAX];
+	if (realpath(path, resolved))
+		return resolved;
+	return path;
+}
+
+static bool build_request(int argc, char **argv, std::string &request)
+{
+	const char *cmd = argv[0];
+	if ((strcmp(cmd, "play") == 0 || strcmp(cmd, "queue") == 0) && argc > 1) {
+		request = std::string("{\"cmd\":\"") + cmd + "\",\"file\":" + control::json_string(absolute_path(argv[1]).c_str()) + "}";
+		return true;
+	}
+	if (strcmp(cmd, "play") == 0 || strcmp(cmd, "stop") == 0 || strcmp(cmd, "status") == 0 || strcmp(cmd, "stats") == 0) {
+		request = std::string("{\"cmd\":\"") + cmd + "\"}";
+		return true;
+	}
+	if (strcmp(cmd, "seek") == 0 && argc > 1) {
+		char *end;
+		double value = strtod(argv[1], &end);
+		if (end == argv[1])
+			return false;
+		char buffer[128];
+		if (*end == 's')
+			sprintf(buffer, "{\"cmd\":\"seek\",\"seconds\":%g}", value);
+		else
+			sprintf(buffer, "{\"cmd\":\"seek\",\"frame\":%u}", (uint32_t)value);
+		request = buffer;
+		return true;
+	}
+	if (strcmp(cmd, "raw") == 0 && argc > 1) {
+		request = argv[1];
+		return true;
+	}
+	return false;
+}
+
+int main(int argc, char **argv)
+{
+	const char *socket_path = control::DEFAULT_SOCKET_PATH;
+	int first = 1;
+	if (argc > 2 && strcmp(argv[1], "-socket") == 0) {
+		socket_path = argv[2];
+		first = 3;
+	}
+
+	std::string request;
+	if (first >= argc || !build_request(argc - first, argv + first, request)) {
+		print_usage();
+		return 1;
+	}
+
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(address.sun_path)) {
+		fprintf(stderr, "socket path too long\n");
+		return 1;
+	}
+	strcpy(address.sun_path, socket_path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+		fprintf(stderr, "couldn't connect to %s, is the player running with -control?\n", socket_path);
+		return 1;
+	}
+
+	request += '\n';
+	size_t sent = 0;
+	while (sent < request.size()) {
+		ssize_t written = write(fd, request.data() + sent, request.size() - sent);
+		if (written <= 0) {
+			fprintf(stderr, "couldn't send request\n");
+			close(fd);
+			return 1;
+		}
+		sent += (size_t)written;
+	}
+
+	std::string response;
+	char buffer[1024];
+	while (response.find('\n') == std::string::npos) {
+		ssize_t received = read(fd, buffer, sizeof(buffer));
+		if (received <= 0)
+			break;
+		response.append(buffer, (size_t)received);
+	}
+	close(fd);
+
+	size_t newline = response.find('\n');
+	if (newline == std::string::npos) {
+		fprintf(stderr, "no response\n");
+		return 1;
+	}
+	response.erase(newline);
+	printf("%s\n", response.c_str());
+	return response.compare(0, 10, "{\"ok\":true") == 0 ? 0 : 1;
+}